@@ -1,7 +1,51 @@
 #include <am.h>
+#include <nemu.h>
 #include <stdatomic.h>
 #include <klib-macros.h>
 
+#ifdef __NEMU_MPE__
+#define MPE_ID    (MPE_ADDR + 0x00)
+#define MPE_COUNT (MPE_ADDR + 0x04)
+#define MPE_SP    (MPE_ADDR + 0x08)
+#define MPE_PC    (MPE_ADDR + 0x0c)
+#define MPE_START (MPE_ADDR + 0x10)
+
+#define MAX_CPU 8
+#define STACK_SIZE (32 * 1024)
+
+static uint8_t stack[MAX_CPU][STACK_SIZE] __attribute__((aligned(16)));
+static void (* volatile user_entry)();
+
+static void othercpu_entry() {
+  user_entry();
+  panic("MPE entry returns");
+}
+
+bool mpe_init(void (*entry)()) {
+  user_entry = entry;
+  for (int cpu = 1; cpu < cpu_count(); cpu ++) {
+    // leave room for the return address, as if the entry is called
+    outl(MPE_SP, (uintptr_t)&stack[cpu][STACK_SIZE] - sizeof(uintptr_t));
+    outl(MPE_PC, (uintptr_t)othercpu_entry);
+    outl(MPE_START, cpu);
+  }
+  othercpu_entry();
+  return true;
+}
+
+int cpu_count() {
+  // the harts of NEMU, no more than asked for by `smp'
+  int n = inl(MPE_COUNT);
+  if (n > __NEMU_MPE__) n = __NEMU_MPE__;
+  return (n < MAX_CPU ? n : MAX_CPU);
+}
+
+int cpu_current() {
+  return inl(MPE_ID);
+}
+
+#else
+// a single hart without the hart controller
 bool mpe_init(void (*entry)()) {
   entry();
   panic("MPE entry returns");
@@ -14,6 +58,7 @@ int cpu_count() {
 int cpu_current() {
   return 0;
 }
+#endif
 
 int atomic_xchg(int *addr, int newval) {
   return atomic_exchange(addr, newval);
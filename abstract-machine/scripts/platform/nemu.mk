@@ -10,6 +10,11 @@ AM_SRCS := platform/nemu/trm.c \
 CFLAGS    += -fdata-sections -ffunction-sections
 CFLAGS    += -I$(AM_HOME)/am/src/platform/nemu/include
 LDSCRIPTS += $(AM_HOME)/scripts/linker.ld
+# run on `smp' harts, e.g. `make smp=4 run', which needs the hart
+# controller of NEMU built with CONFIG_HAS_MPE
+ifneq ($(filter-out 0 1,$(smp)),)
+CFLAGS    += -D__NEMU_MPE__=$(smp)
+endif
 LDFLAGS   += --defsym=_pmem_start=0x80000000 --defsym=_entry_offset=0x0
 LDFLAGS   += --gc-sections -e _start
 NEMUFLAGS += -l $(shell dirname $(IMAGE).elf)/nemu-log.txt -e $(IMAGE).elf -b #这里加-b可以批量执行，不用手动按c
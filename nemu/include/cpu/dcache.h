@@ -0,0 +1,80 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#ifndef __CPU_DCACHE_H__
+#define __CPU_DCACHE_H__
+
+#include <cpu/decode.h>
+#include <memory/paddr.h>
+
+#ifdef CONFIG_DCACHE
+
+// --- decoded instruction cache ---
+// An entry remembers everything `isa_exec_once()` derived from the bytes
+// at `pc`, plus the address of the code which executes the instruction.
+// Values depending on the machine state (e.g. effective addresses) are
+// NOT cached, the ISA recomputes them from `isa` on every execution.
+typedef struct {
+  vaddr_t pc;
+  vaddr_t snpc;
+  const void *handler; // NULL means the entry is invalid
+  ISADecodeInfo isa;
+} DCacheEntry;
+
+extern DCacheEntry dcache[CONFIG_DCACHE_SIZE];
+extern uint8_t dcache_code_page[CONFIG_MSIZE >> PAGE_SHIFT];
+extern uint64_t dcache_hit, dcache_miss, dcache_nr_invalidate;
+// changed whenever code registered with dcache_mark_code() may be
+// modified, so that a user keeping translated code knows when to check
+// it again
+extern uint64_t dcache_version;
+
+static inline DCacheEntry* dcache_slot(vaddr_t pc) {
+  return &dcache[pc & (CONFIG_DCACHE_SIZE - 1)];
+}
+
+static inline DCacheEntry* dcache_lookup(vaddr_t pc) {
+  DCacheEntry *e = dcache_slot(pc);
+  if (likely(e->handler != NULL && e->pc == pc)) {
+    dcache_hit ++;
+    return e;
+  }
+  dcache_miss ++;
+  return NULL;
+}
+
+void dcache_insert(Decode *s, const void *handler);
+// stores to [addr, addr + len) change `dcache_version' from now on,
+// until the next dcache_flush()
+void dcache_mark_code(paddr_t addr, int len);
+void dcache_invalidate(paddr_t addr, int len);
+void dcache_flush();
+
+// execute the instruction whose decoding result is already in `s`,
+// `handler` is the one recorded by dcache_insert()
+int isa_exec_cached(Decode *s, const void *handler);
+
+// called by paddr_write() for every store to pmem
+static inline void dcache_check_write(paddr_t addr, int len) {
+  if (unlikely(dcache_code_page[pmem_page(addr)] | dcache_code_page[pmem_last_page(addr, len)])) {
+    dcache_invalidate(addr, len);
+  }
+}
+#else
+static inline void dcache_flush() {}
+#endif
+
+#endif
@@ -17,13 +17,14 @@
 #define __CPU_DECODE_H__
 
 #include <isa.h>
+#include <cpu/itrace.h>
 
 typedef struct Decode {
   vaddr_t pc;
   vaddr_t snpc; // static next pc
   vaddr_t dnpc; // dynamic next pc
   ISADecodeInfo isa;
-  IFDEF(CONFIG_ITRACE, char logbuf[128]);
+  IFDEF(CONFIG_ITRACE, ItraceRecord trace);
 } Decode;
 
 // --- pattern matching mechanism ---
@@ -86,17 +87,76 @@ finish:
 }
 
 
+// --- decode table ---
+/* A table built from the INSTPAT list of a decoder on its first use.
+ * The instructions are put into buckets by the index field `inst[hi:lo]',
+ * each bucket lists the patterns which may match an instruction in it,
+ * in their order in the source, and ends with one matching all the rest.
+ * Overlapping patterns are rejected when the table is built, unless the
+ * earlier one is strictly more specific than the later one.
+ */
+typedef struct {
+  uint64_t key, mask;
+  const void *target;
+} InstPatEntry;
+
+typedef struct {
+  int hi, lo;
+  bool built;
+  int nr_pat, nr_bucket;
+  struct InstPat *pat;
+  InstPatEntry *entry;
+  InstPatEntry **bucket;
+} InstPatTable;
+
+void instpat_add(InstPatTable *t, uint64_t key, uint64_t mask, uint64_t shift,
+    const void *target, const char *pattern, const char *name, int line);
+void instpat_build(InstPatTable *t, const void *end);
+
+static inline const void* instpat_lookup(InstPatTable *t, uint64_t inst) {
+  const InstPatEntry *e = t->bucket[(inst >> t->lo) & (t->nr_bucket - 1)];
+  while ((inst & e->mask) != e->key) e ++;
+  return e->target;
+}
+
 // --- pattern matching wrappers for decode ---
-#define INSTPAT(pattern, ...) do { \
+#define INSTPAT_NAME(name, ...) #name
+#define INSTPAT(pattern, ...) INSTPAT_ID(__COUNTER__, pattern, __VA_ARGS__)
+#define INSTPAT_ID(id, pattern, ...) do { \
   uint64_t key, mask, shift; \
   pattern_decode(pattern, STRLEN(pattern), &key, &mask, &shift); \
-  if ((((uint64_t)INSTPAT_INST(s) >> shift) & mask) == key) { \
+  if (__instpat_table != NULL) { \
+    instpat_add(__instpat_table, key, mask, shift, &&concat(__instpat_, id), \
+        pattern, INSTPAT_NAME(__VA_ARGS__), __LINE__); \
+  } else if ((((uint64_t)INSTPAT_INST(s) >> shift) & mask) == key) { \
+    concat(__instpat_, id): \
     INSTPAT_MATCH(s, ##__VA_ARGS__); \
     goto *(__instpat_end); \
   } \
 } while (0)
 
-#define INSTPAT_START(name) { const void * __instpat_end = &&concat(__instpat_end_, name);
-#define INSTPAT_END(name)   concat(__instpat_end_, name): ; }
+// match the patterns one by one
+#define INSTPAT_START(name) { const void * __instpat_end = &&concat(__instpat_end_, name); \
+  InstPatTable *__instpat_table = NULL; \
+  __attribute__((unused)) const void *__instpat_dispatch = NULL;
+
+// match the patterns with a decode table indexed by `inst[hi:lo]',
+// `INSTPAT_DISPATCH()' should be placed where the instruction is fetched
+#define INSTPAT_TABLE_START(name, hi, lo) { const void * __instpat_end = &&concat(__instpat_end_, name); \
+  static InstPatTable concat(__instpat_table_, name) = { hi, lo }; \
+  InstPatTable *__instpat_table = &concat(__instpat_table_, name); \
+  const void *__instpat_dispatch = &&concat(__instpat_dispatch_, name);
+
+// before the table is built, fall through to register the patterns in it
+#define INSTPAT_DISPATCH(name) \
+  concat(__instpat_dispatch_, name): \
+  if (likely(__instpat_table->built)) goto *instpat_lookup(__instpat_table, INSTPAT_INST(s));
+
+#define INSTPAT_END(name) \
+  if (__instpat_table != NULL) { \
+    instpat_build(__instpat_table, __instpat_end); \
+    goto *(__instpat_dispatch); \
+  } \
+  concat(__instpat_end_, name): ; }
 
 #endif
@@ -24,13 +24,26 @@ void difftest_skip_ref();
 void difftest_skip_dut(int nr_ref, int nr_dut);
 void difftest_set_patch(void (*fn)(void *arg), void *arg);
 void difftest_step(vaddr_t pc, vaddr_t npc);
+void difftest_sync();
 void difftest_detach();
 void difftest_attach();
+// pages saved for going back to the start of the batch, the
+// stores to the other pages go through difftest_check_write()
+extern uint8_t difftest_saved_page[];
+void difftest_check_write(paddr_t addr, int len);
+#ifndef CONFIG_DIFFTEST_PIPELINE
+// the values read from the devices by the current instruction, which
+// are replayed when it runs again to look for a difference
+extern bool difftest_dev_replaying;
+void difftest_record_read(word_t val);
+word_t difftest_replay_read();
+#endif
 #else
 static inline void difftest_skip_ref() {}
 static inline void difftest_skip_dut(int nr_ref, int nr_dut) {}
 static inline void difftest_set_patch(void (*fn)(void *arg), void *arg) {}
 static inline void difftest_step(vaddr_t pc, vaddr_t npc) {}
+static inline void difftest_sync() {}
 static inline void difftest_detach() {}
 static inline void difftest_attach() {}
 #endif
@@ -0,0 +1,46 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __CPU_EVENT_H__
+#define __CPU_EVENT_H__
+
+#include <common.h>
+
+/* Timed work outside the CPU is driven by events with a deadline in
+ * guest instructions. The CPU loop runs instructions without checking
+ * devices or interrupts until `g_nr_guest_inst' reaches `event_deadline',
+ * the earliest deadline of all events.
+ */
+typedef void (*event_handler_t) ();
+
+extern uint64_t event_deadline;
+
+// an event run once for each call to `event_schedule()'
+int event_add(const char *name, event_handler_t handler);
+// an event run every `period_us' of the guest time, see get_guest_time()
+int event_add_periodic(const char *name, event_handler_t handler, uint64_t period_us);
+// run the event after `delay' instructions, 0 means at the end of the current one,
+// e.g. to handle an MMIO write
+void event_schedule(int id, uint64_t delay);
+// check for interrupts at the end of the current instruction,
+// after the guest enables them or a device raises one
+void event_check_intr();
+// run the events reaching their deadlines
+void event_run();
+// start the events again from the current instruction count,
+// after the machine is brought back to a checkpoint
+void event_reset();
+
+#endif
@@ -0,0 +1,60 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __CPU_ITRACE_H__
+#define __CPU_ITRACE_H__
+
+#include <common.h>
+
+// --- instruction trace ---
+// Each instruction is traced as a fixed-size record. The text log and
+// the ring buffer disassemble a record only when it is printed, and with
+// ITRACE_BIN the records are written to a file as they are, to be read
+// by tools/nemu-trace-dump.
+
+#define ITRACE_MAGIC "NEMUITR2"
+#define ITRACE_NO_REG 0xff
+
+typedef struct {
+  uint64_t pc;
+  uint64_t val;     // the new value of register `reg'
+  uint8_t inst[16]; // the longest x86 instruction has 15 bytes
+  uint8_t len;
+  uint8_t reg;      // the first register written, or ITRACE_NO_REG
+} ItraceRecord;
+
+// the records are written to the trace file as they are
+static_assert(sizeof(((ItraceRecord *)0)->inst) >= 15, "an x86 instruction does not fit in ItraceRecord");
+static_assert(sizeof(ItraceRecord) == 40, "the layout of ItraceRecord is changed, update ITRACE_MAGIC");
+
+typedef struct {
+  char magic[8];
+  char isa[16];
+  uint32_t record_size;
+  uint32_t nr_reg;
+  char reg_name[32][8];
+} ItraceHeader;
+
+// format `r' as a line of the text log
+void itrace_format(char *str, int size, const ItraceRecord *r);
+
+void init_itrace(const char *file);
+void itrace_write(const ItraceRecord *r);
+void itrace_flush();
+
+void iringbuf_write(const ItraceRecord *r);
+void iringbuf_display();
+
+#endif
@@ -0,0 +1,67 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __CPU_MPE_H__
+#define __CPU_MPE_H__
+
+#include <common.h>
+
+#ifdef CONFIG_HAS_MPE
+#include <stdatomic.h>
+
+/* Every hart runs on its own host thread. Hart 0 is the thread of NEMU,
+ * which also runs the monitor and the events, and the other harts only
+ * run while it is in cpu_exec(). `cpu', the instruction count and the
+ * TLB are HART_LOCAL. Other threads ask a hart for something by setting
+ * a bit in its request word, which the hart checks after every
+ * instruction and serves with mpe_serve().
+ */
+enum {
+  HART_REQ_INTR = 1,      // raise the interrupt line
+  HART_REQ_CHECK = 2,     // check for interrupts, they are enabled again
+  HART_REQ_TLB_FLUSH = 4,
+  HART_REQ_PAUSE = 8,     // wait until hart 0 runs again
+};
+
+typedef struct {
+  _Atomic uint32_t req;
+} __attribute__((aligned(64))) HartReq;
+
+extern HartReq hart_req[CONFIG_NR_HART];
+extern HART_LOCAL int hart_id;
+
+static inline bool hart_req_pending() {
+  return atomic_load_explicit(&hart_req[hart_id].req, memory_order_relaxed) != 0;
+}
+
+void mpe_serve();
+// let the other harts run while hart 0 runs, and stop them
+void mpe_resume();
+void mpe_pause();
+// raise the interrupt line of every hart
+void mpe_raise_intr();
+// flush the TLB of every hart, for a change to a page seen by all of them
+void mpe_tlb_flush();
+// the devices are accessed by one hart at a time, see device/io/map.c
+void device_lock();
+void device_unlock();
+// the instructions run by the other harts, they are paused
+uint64_t mpe_nr_inst();
+
+// the loop of the harts other than hart 0, it never returns
+void cpu_exec_hart();
+#endif
+
+#endif
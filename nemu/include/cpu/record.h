@@ -0,0 +1,44 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __CPU_RECORD_H__
+#define __CPU_RECORD_H__
+
+#include <common.h>
+
+/* With --record, the values read from the devices and the interrupts
+ * taken are logged to a file, stamped with the instruction count. With
+ * --replay, the values are read from the file instead of the devices,
+ * the writes to the devices are dropped and the interrupts are taken at
+ * the same instruction counts, so that the run follows exactly the
+ * recorded one without a window and at full speed.
+ */
+extern bool record_on;
+extern bool record_replaying;
+
+void init_record(const char *record_file, const char *replay_file);
+// end the recording, the exit handler is skipped on a panic
+void record_flush();
+
+void record_read(word_t val);
+word_t record_replay_read();
+void record_intr(word_t intr);
+
+// the instruction count to take the next recorded interrupt at and
+// the interrupt in `intr', which is INTR_EMPTY where the recording ends
+uint64_t record_next_intr(word_t *intr);
+void record_pop_intr();
+
+#endif
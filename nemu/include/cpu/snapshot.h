@@ -0,0 +1,62 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __CPU_SNAPSHOT_H__
+#define __CPU_SNAPSHOT_H__
+
+#include <common.h>
+#include <memory/paddr.h>
+
+// register device state to be saved with the CPU and pmem
+void snapshot_add_state(void *p, size_t size);
+
+// a snapshot file holds the whole machine, a later run can start from it
+void snapshot_save_file(const char *file);
+void snapshot_load_file(const char *file);
+
+#ifdef CONFIG_SNAPSHOT
+
+// --- checkpoints for reverse execution ---
+// A checkpoint holds the CPU, the device states registered with
+// `snapshot_add_state()' and the pmem pages written after it, which are
+// copied before their first write. Values read from devices and the
+// interrupts taken are logged, so that replaying from a checkpoint
+// follows exactly the same path without running the devices.
+
+extern bool snapshot_on;
+extern bool snapshot_replaying;
+// pages to copy before the next write to them
+extern uint8_t snapshot_cow_page[CONFIG_MSIZE >> PAGE_SHIFT];
+
+void snapshot_start();
+void snapshot_save_page(paddr_t addr, int len);
+
+void snapshot_record_read(word_t val);
+word_t snapshot_replay_read();
+void snapshot_record_intr(word_t intr);
+
+// the sdb commands `rsi' and `rc'
+void snapshot_step_back(uint64_t n);
+void snapshot_reverse_continue();
+
+// called by paddr_write() for every store to pmem
+static inline void snapshot_check_write(paddr_t addr, int len) {
+  if (unlikely(snapshot_cow_page[pmem_page(addr)] | snapshot_cow_page[pmem_last_page(addr, len)])) {
+    snapshot_save_page(addr, len);
+  }
+}
+#endif
+
+#endif
@@ -17,6 +17,7 @@
 #define __DEVICE_MAP_H__
 
 #include <cpu/difftest.h>
+#include <cpu/snapshot.h>
 
 typedef void(*io_callback_t)(uint32_t, int, bool);
 uint8_t* new_space(int size);
@@ -20,5 +20,8 @@
 
 word_t mmio_read(paddr_t addr, int len);
 void mmio_write(paddr_t addr, int len, word_t data);
+// the host address of `addr' if the whole page holding it is a region
+// without callback, so that it can be accessed as memory, or NULL
+uint8_t* mmio_host_page(paddr_t addr);
 
 #endif
@@ -29,7 +29,7 @@ extern unsigned char isa_logo[];
 void init_isa();
 
 // reg
-extern CPU_state cpu;
+extern HART_LOCAL CPU_state cpu;
 void isa_reg_display();
 word_t isa_reg_str2val(const char *name, bool *success);
 
@@ -51,7 +51,12 @@ vaddr_t isa_raise_intr(word_t NO, vaddr_t epc);
 #define INTR_EMPTY ((word_t)-1)
 word_t isa_query_intr();
 
+// multiple harts
+void isa_hart_start(CPU_state *hart, vaddr_t pc, word_t sp);
+
 // difftest
+// the rule of all difftest modes, it does not touch `cpu'
+bool isa_difftest_cmpregs(CPU_state *ref_r, CPU_state *dut_r);
 bool isa_difftest_checkregs(CPU_state *ref_r, vaddr_t pc);
 void isa_difftest_attach();
 
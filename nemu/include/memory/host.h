@@ -38,4 +38,17 @@ static inline void host_write(void *addr, int len, word_t data) {
   }
 }
 
+#ifdef CONFIG_HAS_MPE
+// atomic to the other harts
+static inline bool host_cmpxchg(void *addr, int len, word_t old, word_t data) {
+  switch (len) {
+    case 1: { uint8_t  o = old; return __atomic_compare_exchange_n((uint8_t  *)addr, &o, data, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST); }
+    case 2: { uint16_t o = old; return __atomic_compare_exchange_n((uint16_t *)addr, &o, data, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST); }
+    case 4: { uint32_t o = old; return __atomic_compare_exchange_n((uint32_t *)addr, &o, data, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST); }
+    IFDEF(CONFIG_ISA64, case 8: { uint64_t o = old; return __atomic_compare_exchange_n((uint64_t *)addr, &o, data, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST); });
+    default: panic("invalid length %d of a locked access", len);
+  }
+}
+#endif
+
 #endif
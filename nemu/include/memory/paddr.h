@@ -17,9 +17,10 @@
 #define __MEMORY_PADDR_H__
 
 #include <common.h>
+#include <memory/vaddr.h>
 
 #define PMEM_LEFT  ((paddr_t)CONFIG_MBASE)
-#define PMEM_RIGHT ((paddr_t)CONFIG_MBASE + CONFIG_MSIZE - 1)
+#define PMEM_RIGHT ((paddr_t)(CONFIG_MBASE + pmem_size - 1))
 #define RESET_VECTOR (PMEM_LEFT + CONFIG_PC_RESET_OFFSET)
 
 /* convert the guest physical address in the guest program to host virtual address in NEMU */
@@ -27,11 +28,59 @@ uint8_t* guest_to_host(paddr_t paddr);
 /* convert the host virtual address in NEMU to guest physical address in the guest program */
 paddr_t host_to_guest(uint8_t *haddr);
 
+// the size of pmem chosen at runtime, at most CONFIG_MSIZE
+extern size_t pmem_size;
+
 static inline bool in_pmem(paddr_t addr) {
-  return addr - CONFIG_MBASE < CONFIG_MSIZE;
+  return addr - CONFIG_MBASE < pmem_size;
+}
+
+// index of the page holding `addr' in the arrays with an entry per page of pmem
+static inline uint32_t pmem_page(paddr_t addr) {
+  return (addr - CONFIG_MBASE) >> PAGE_SHIFT;
 }
 
+// index of the page holding the last byte of [addr, addr + len), where `addr'
+// is in pmem; an access running over the end of pmem gets the page of `addr',
+// so that the arrays above are not indexed beyond their end
+static inline uint32_t pmem_last_page(paddr_t addr, int len) {
+  return pmem_page(likely(in_pmem(addr + len - 1)) ? addr + len - 1 : addr);
+}
+
+// pmem is filled lazily with MEM_RANDOM, call this before the host
+// accesses [addr, addr + len) through guest_to_host()
+#ifdef CONFIG_MEM_RANDOM
+extern uint8_t pmem_fresh_page[];
+extern uint8_t pmem_fill_byte;
+void pmem_prepare(paddr_t addr, size_t len);
+#else
+static inline void pmem_prepare(paddr_t addr, size_t len) {}
+#endif
+
+void pmem_map_file(int fd, size_t offset);
+// map the image at the reset vector, its pages are shared with the
+// other mappings of the file until they are written, return its size
+long pmem_map_img(const char *img_file);
+#if defined(CONFIG_PMEM_MALLOC) && !defined(CONFIG_TARGET_AM)
+uint8_t* pmem_switch(uint8_t *p);
+#endif
+
 word_t paddr_read(paddr_t addr, int len);
 void paddr_write(paddr_t addr, int len, word_t data);
+#ifdef CONFIG_HAS_MPE
+bool paddr_cmpxchg(paddr_t addr, int len, word_t old, word_t data);
+#endif
+
+// a write to a watched page sets `paddr_watch_hit'
+extern bool paddr_watch_hit;
+void paddr_watch(paddr_t addr, int len);
+void paddr_unwatch_all();
+
+// the page table walker in isa_mmu_translate() should mark the pages it
+// reads, a later store to them flushes the TLB
+void paddr_mark_pt_page(paddr_t addr);
+// a store to a plain page needs nothing more than writing pmem, thus
+// the TLB can keep a host pointer for it
+bool paddr_plain_page(paddr_t addr);
 
 #endif
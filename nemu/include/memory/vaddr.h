@@ -21,9 +21,25 @@
 word_t vaddr_ifetch(vaddr_t addr, int len);
 word_t vaddr_read(vaddr_t addr, int len);
 void vaddr_write(vaddr_t addr, int len, word_t data);
+#ifdef CONFIG_HAS_MPE
+// write `data' only if the memory still holds `old'
+bool vaddr_cmpxchg(vaddr_t addr, int len, word_t old, word_t data);
+#endif
 
 #define PAGE_SHIFT        12
 #define PAGE_SIZE         (1ul << PAGE_SHIFT)
 #define PAGE_MASK         (PAGE_SIZE - 1)
 
+#ifdef CONFIG_TLB
+extern HART_LOCAL uint64_t tlb_hit, tlb_miss, tlb_nr_flush;
+// should be called by the ISA when the address space changes (e.g. a write
+// to CR3/satp) or a mapping is modified by other means than a guest store
+void tlb_flush();
+// should be called when some page stops being a plain page, see paddr_plain_page()
+void tlb_flush_write();
+#else
+static inline void tlb_flush() {}
+static inline void tlb_flush_write() {}
+#endif
+
 #endif
@@ -0,0 +1,49 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __NEMU_INSTANCE_H__
+#define __NEMU_INSTANCE_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Many guests in one process, exported by the shared object built with
+ * CONFIG_TARGET_SHARE. Each instance has its own CPU, pmem, state and
+ * statistics. The instances share the machine of NEMU, so only one of
+ * them runs at a time: the calls may come from any thread, and a call
+ * waits until the running one returns. The pages of an image loaded by
+ * nemu_load() are shared by all the instances until they are written.
+ */
+
+typedef struct NEMUInstance NEMUInstance;
+
+typedef struct {
+  uint64_t nr_inst; // guest instructions executed
+  uint64_t time_us; // host time spent in nemu_run()
+  bool ended;       // the guest has stopped for good
+  bool good_trap;   // ... at a good trap
+  uint32_t halt_ret;
+} NEMUStat;
+
+// a new instance holding the built-in image, at the reset vector
+NEMUInstance* nemu_create();
+// map the image at the reset vector, return its size
+long nemu_load(NEMUInstance *nemu, const char *img_file);
+// run at most `n' instructions, return false once the guest has ended
+bool nemu_run(NEMUInstance *nemu, uint64_t n);
+void nemu_stat(NEMUInstance *nemu, NEMUStat *stat);
+void nemu_destroy(NEMUInstance *nemu);
+
+#endif
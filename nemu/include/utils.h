@@ -32,7 +32,12 @@ extern NEMUState nemu_state;
 
 // ----------- timer -----------
 
+// the host time in us
 uint64_t get_time();
+// the time of the guest in us, it advances 2^icount_shift ns
+// per instruction with --icount, or follows the host time
+extern int icount_shift;
+uint64_t get_guest_time();
 
 // ----------- log -----------
 
@@ -56,14 +61,13 @@ uint64_t get_time();
 
 #define ANSI_FMT(str, fmt) fmt str ANSI_NONE
 
+void log_printf(const char *fmt, ...);
+void log_flush();
+
 #define log_write(...) IFDEF(CONFIG_TARGET_NATIVE_ELF, \
   do { \
-    extern FILE* log_fp; \
     extern bool log_enable(); \
-    if (log_enable() && log_fp != NULL) { \
-      fprintf(log_fp, __VA_ARGS__); \
-      fflush(log_fp); \
-    } \
+    if (log_enable()) log_printf(__VA_ARGS__); \
   } while (0) \
 )
 
@@ -73,11 +77,16 @@ uint64_t get_time();
     log_write(__VA_ARGS__); \
   } while (0)
 
-void iringbuf_write(const char *log);
-void iringbuf_display();
-
 void init_ftrace(const char *elf_file);
 void ftrace_write(paddr_t pc, paddr_t target, bool is_call);
+// "???" for an address out of any function
+const char* ftrace_symbol(paddr_t addr);
+bool ftrace_symbol_range(const char *name, paddr_t *start, paddr_t *end);
+
+void init_profile(const char *file);
+void profile_inst(vaddr_t pc);
+void profile_call(paddr_t pc, paddr_t target, bool is_call);
+void profile_report();
 
 void etrace_write(word_t NO, vaddr_t epc, vaddr_t target);
 
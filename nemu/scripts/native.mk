@@ -18,6 +18,22 @@ include $(NEMU_HOME)/scripts/build.mk
 
 include $(NEMU_HOME)/tools/difftest.mk
 
+# Check the INSTPAT lists of the decoder for overlapping patterns before compiling it
+INSTPAT_CHECK_PATH = $(NEMU_HOME)/tools/instpat-check
+INSTPAT_CHECK = $(INSTPAT_CHECK_PATH)/build/instpat-check
+INSTPAT_SRC = src/isa/$(GUEST_ISA)/inst.c
+
+$(INSTPAT_CHECK): $(INSTPAT_CHECK_PATH)/instpat-check.c
+	@$(MAKE) -s -C $(INSTPAT_CHECK_PATH)
+
+$(OBJ_DIR)/%.check: %.c $(INSTPAT_CHECK)
+	@echo + CHECK $<
+	@mkdir -p $(dir $@)
+	@$(INSTPAT_CHECK) $<
+	@touch $@
+
+$(OBJ_DIR)/$(INSTPAT_SRC:.c=.o): $(OBJ_DIR)/$(INSTPAT_SRC:.c=.check)
+
 compile_git:
 	$(call git_commit, "compile NEMU")
 $(BINARY):: compile_git
@@ -16,6 +16,12 @@
 #include <cpu/cpu.h>
 #include <cpu/decode.h>
 #include <cpu/difftest.h>
+#include <cpu/dcache.h>
+#include <cpu/event.h>
+#include <cpu/itrace.h>
+#include <cpu/snapshot.h>
+#include <cpu/record.h>
+#include <cpu/mpe.h>
 #include <locale.h>
 #include "../monitor/sdb/sdb.h"
 
@@ -26,59 +32,97 @@
  */
 #define MAX_INST_TO_PRINT 10
 
-CPU_state cpu = {};
-uint64_t g_nr_guest_inst = 0;
-static uint64_t g_timer = 0; // unit: us
+HART_LOCAL CPU_state cpu = {};
+HART_LOCAL uint64_t g_nr_guest_inst = 0;
+uint64_t g_timer = 0; // unit: us
 static bool g_print_step = false;
 
-void device_update();
-
 static void trace_and_difftest(Decode *_this, vaddr_t dnpc) {
 #ifdef CONFIG_ITRACE_COND
-  if (ITRACE_COND) { log_write("%s\n", _this->logbuf); }
+  if (ITRACE_COND) { itrace_write(&_this->trace); }
+#endif
+#ifdef CONFIG_ITRACE
+  if (g_print_step) {
+    char line[128];
+    itrace_format(line, sizeof(line), &_this->trace);
+    puts(line);
+  }
 #endif
-  if (g_print_step) { IFDEF(CONFIG_ITRACE, puts(_this->logbuf)); }
-  IFDEF(CONFIG_IRINGBUF, iringbuf_write(_this->logbuf));
+  IFDEF(CONFIG_IRINGBUF, iringbuf_write(&_this->trace));
   IFDEF(CONFIG_DIFFTEST, difftest_step(_this->pc, dnpc));
   
-  WP *wp = scan_watchpoint();
-  if (wp != NULL) {
+  if (watchpoint_pending() && scan_watchpoint() != NULL) {
     nemu_state.state = NEMU_STOP;
   }
 }
 
 static void exec_once(Decode *s, vaddr_t pc) {
+  IFDEF(CONFIG_PROFILE, profile_inst(pc));
   s->pc = pc;
   s->snpc = pc;
+#ifdef CONFIG_ITRACE
+  __typeof__(cpu.gpr) gpr;
+  memcpy(&gpr, &cpu.gpr, sizeof(gpr));
+#endif
   isa_exec_once(s);
   cpu.pc = s->dnpc;
 #ifdef CONFIG_ITRACE
-  char *p = s->logbuf;
-  p += snprintf(p, sizeof(s->logbuf), FMT_WORD ":", s->pc);
-  int ilen = s->snpc - s->pc;
-  int i;
-  uint8_t *inst = (uint8_t *)&s->isa.inst;
-#ifdef CONFIG_ISA_x86
-  for (i = 0; i < ilen; i ++) {
-#else
-  for (i = ilen - 1; i >= 0; i --) {
-#endif
-    p += snprintf(p, 4, " %02x", inst[i]);
+  // only the raw instruction is kept, it is disassembled when printed
+  ItraceRecord *r = &s->trace;
+  r->pc = s->pc;
+  r->len = s->snpc - s->pc;
+  memcpy(r->inst, &s->isa.inst, (r->len < sizeof(r->inst) ? r->len : sizeof(r->inst)));
+  r->reg = ITRACE_NO_REG;
+  for (int i = 0; i < ARRLEN(gpr); i ++) {
+    if (memcmp(&gpr[i], &cpu.gpr[i], sizeof(gpr[i])) != 0) {
+      r->reg = i;
+      r->val = 0;
+      memcpy(&r->val, &cpu.gpr[i], sizeof(cpu.gpr[i]));
+      break;
+    }
   }
-  int ilen_max = MUXDEF(CONFIG_ISA_x86, 8, 4);
-  int space_len = ilen_max - ilen;
-  if (space_len < 0) space_len = 0;
-  space_len = space_len * 3 + 1;
-  memset(p, ' ', space_len);
-  p += space_len;
+#endif
+}
 
-  void disassemble(char *str, int size, uint64_t pc, uint8_t *code, int nbyte);
-  disassemble(p, s->logbuf + sizeof(s->logbuf) - p,
-      MUXDEF(CONFIG_ISA_x86, s->snpc, s->pc), (uint8_t *)&s->isa.inst, ilen);
+#ifdef CONFIG_ENGINE_BLOCK
+void block_exec(uint64_t n);
+extern uint64_t block_nr_build, block_nr_exec, block_nr_chain;
+#endif
+#ifdef CONFIG_JIT
+extern uint64_t jit_nr_compile, jit_nr_flush, jit_nr_link;
+#endif
+#ifdef CONFIG_DIFFTEST_PIPELINE
+extern uint64_t difftest_nr_stall;
+uint64_t difftest_nr_record();
+#elif defined(CONFIG_DIFFTEST)
+extern uint64_t difftest_nr_batch, difftest_nr_bisect;
 #endif
+#ifdef CONFIG_DIFFTEST
+extern uint64_t difftest_nr_mem_check, difftest_nr_mem_page;
+#endif
+#ifdef CONFIG_VGA_SHOW_SCREEN
+extern uint64_t vga_nr_present, vga_nr_skip, vga_upload_bytes;
+#endif
+
+static inline void take_intr() {
+  word_t intr = isa_query_intr();
+  if (intr != INTR_EMPTY) {
+    IFDEF(CONFIG_SNAPSHOT, snapshot_record_intr(intr));
+    IFDEF(CONFIG_TARGET_NATIVE_ELF, if (record_on) record_intr(intr));
+    cpu.pc = isa_raise_intr(intr, cpu.pc);
+  }
 }
 
 static void execute(uint64_t n) {
+#if defined(CONFIG_ENGINE_BLOCK) && !defined(CONFIG_ITRACE) && !defined(CONFIG_MTRACE) && \
+    !defined(CONFIG_FTRACE) && !defined(CONFIG_DIFFTEST) && !defined(CONFIG_PROFILE)
+  // the block engine skips the per-instruction work in trace_and_difftest(),
+  // it only checks the watchpoints depending on memory
+  if (nr_wp_step == 0) {
+    block_exec(n);
+    return;
+  }
+#endif
   Decode s;
   for (;n > 0; n --) {
     exec_once(&s, cpu.pc);//执行一条指令
@@ -90,13 +134,59 @@ static void execute(uint64_t n) {
 
 
     if (nemu_state.state != NEMU_RUNNING) break;//将state改成stop就能实现暂停执行，本质上是打破了 CPU 的取指-执行循环。
-    IFDEF(CONFIG_DEVICE, device_update());
-    word_t intr = isa_query_intr();
-    if (intr != INTR_EMPTY) {
+    // devices and interrupts are only checked when an event is due
+    if (unlikely(g_nr_guest_inst >= event_deadline)) {
+      // the other harts access the devices from their own threads
+      IFDEF(CONFIG_HAS_MPE, device_lock());
+      event_run();
+      IFDEF(CONFIG_HAS_MPE, device_unlock());
+      take_intr();
+    }
+#ifdef CONFIG_HAS_MPE
+    if (unlikely(hart_req_pending())) {
+      mpe_serve();
+      take_intr();
+    }
+#endif
+  }
+}
+
+#ifdef CONFIG_HAS_MPE
+// the other harts leave the monitor and the events to hart 0
+void cpu_exec_hart() {
+  Decode s;
+  while (true) {
+    exec_once(&s, cpu.pc);
+    g_nr_guest_inst ++;
+    if (unlikely(hart_req_pending())) {
+      mpe_serve();
+      take_intr();
+    }
+  }
+}
+#endif
+
+#ifdef CONFIG_TARGET_NATIVE_ELF
+// hold back the events and take the recorded interrupts at
+// the same instruction counts, see record.c
+static void execute_replay(uint64_t n) {
+  event_deadline = UINT64_MAX;
+  while (n > 0 && nemu_state.state == NEMU_RUNNING) {
+    word_t intr;
+    uint64_t next = record_next_intr(&intr);
+    if (next <= g_nr_guest_inst) {
+      record_pop_intr();
+      // the recording ends here
+      if (intr == INTR_EMPTY) { nemu_state.state = NEMU_QUIT; break; }
       cpu.pc = isa_raise_intr(intr, cpu.pc);
+      continue;
     }
+    uint64_t nr_inst = g_nr_guest_inst;
+    execute(n < next - nr_inst ? n : next - nr_inst);
+    n -= g_nr_guest_inst - nr_inst;
   }
 }
+#endif
 
 static void statistic() {
   IFNDEF(CONFIG_TARGET_AM, setlocale(LC_NUMERIC, ""));
@@ -105,15 +195,66 @@ static void statistic() {
   Log("total guest instructions = " NUMBERIC_FMT, g_nr_guest_inst);
   if (g_timer > 0) Log("simulation frequency = " NUMBERIC_FMT " inst/s", g_nr_guest_inst * 1000000 / g_timer);
   else Log("Finish running in less than 1 us and can not calculate the simulation frequency");
+#ifdef CONFIG_DCACHE
+  Log("decode cache hit = " NUMBERIC_FMT ", miss = " NUMBERIC_FMT ", invalidated = " NUMBERIC_FMT,
+      dcache_hit, dcache_miss, dcache_nr_invalidate);
+#endif
+#ifdef CONFIG_TLB
+  Log("TLB hit = " NUMBERIC_FMT ", miss = " NUMBERIC_FMT ", flushed = " NUMBERIC_FMT,
+      tlb_hit, tlb_miss, tlb_nr_flush);
+#endif
+#ifdef CONFIG_ENGINE_BLOCK
+  Log("blocks built = " NUMBERIC_FMT ", executed = " NUMBERIC_FMT ", chained = " NUMBERIC_FMT,
+      block_nr_build, block_nr_exec, block_nr_chain);
+#endif
+#ifdef CONFIG_JIT
+  Log("blocks translated = " NUMBERIC_FMT ", linked = " NUMBERIC_FMT ", code cache flushed = " NUMBERIC_FMT,
+      jit_nr_compile, jit_nr_link, jit_nr_flush);
+#endif
+#ifdef CONFIG_DIFFTEST_PIPELINE
+  Log("difftest instructions checked = " NUMBERIC_FMT ", DUT stalls = " NUMBERIC_FMT,
+      difftest_nr_record(), difftest_nr_stall);
+#elif defined(CONFIG_DIFFTEST)
+  Log("difftest batches compared = " NUMBERIC_FMT ", run again one by one = " NUMBERIC_FMT,
+      difftest_nr_batch, difftest_nr_bisect);
+#endif
+#ifdef CONFIG_DIFFTEST
+  Log("difftest memory checks = " NUMBERIC_FMT ", pages compared = " NUMBERIC_FMT,
+      difftest_nr_mem_check, difftest_nr_mem_page);
+#endif
+#ifdef CONFIG_HAS_MPE
+  Log("guest instructions of the other harts = " NUMBERIC_FMT, mpe_nr_inst());
+#endif
+#ifdef CONFIG_PROFILE
+  profile_report();
+#endif
+#ifdef CONFIG_VGA_SHOW_SCREEN
+  Log("screen updates presented = " NUMBERIC_FMT ", skipped = " NUMBERIC_FMT ", uploaded = " NUMBERIC_FMT " bytes",
+      vga_nr_present, vga_nr_skip, vga_upload_bytes);
+  if (g_timer > 0) Log("screen upload rate = " NUMBERIC_FMT " bytes/s", vga_upload_bytes * 1000000 / g_timer);
+#endif
 }
 
 void assert_fail_msg() {
   isa_reg_display();
   iringbuf_display();
+  IFDEF(CONFIG_ITRACE, itrace_flush());
+  IFDEF(CONFIG_TARGET_NATIVE_ELF, record_flush());
   statistic();
+  IFNDEF(CONFIG_TARGET_AM, log_flush());
   fflush(stdout);
 }
 
+#ifdef CONFIG_SNAPSHOT
+// replay `n' instructions from a checkpoint, the caller holds back
+// the events and takes the recorded interrupts
+void cpu_exec_replay(uint64_t n) {
+  g_print_step = false;
+  nemu_state.state = NEMU_RUNNING;
+  execute(n);
+}
+#endif
+
 /* Simulate how the CPU works. */
 void cpu_exec(uint64_t n) {
   g_print_step = (n < MAX_INST_TO_PRINT);
@@ -126,7 +267,15 @@ void cpu_exec(uint64_t n) {
 
   uint64_t timer_start = get_time();
 
+  IFDEF(CONFIG_HAS_MPE, mpe_resume());
+#ifdef CONFIG_TARGET_NATIVE_ELF
+  if (unlikely(record_replaying)) execute_replay(n);
+  else
+#endif
   execute(n);
+  IFDEF(CONFIG_HAS_MPE, mpe_pause());
+  difftest_sync();
+  IFDEF(CONFIG_ITRACE, itrace_flush());
 
   uint64_t timer_end = get_time();
   g_timer += timer_end - timer_start;
@@ -0,0 +1,97 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#include <cpu/dcache.h>
+#include <memory/paddr.h>
+
+#ifdef CONFIG_DCACHE
+
+static_assert((CONFIG_DCACHE_SIZE & (CONFIG_DCACHE_SIZE - 1)) == 0,
+    "CONFIG_DCACHE_SIZE should be a power of 2");
+
+#define MAX_INST_LEN MUXDEF(CONFIG_ISA_x86, 16, 4)
+
+DCacheEntry dcache[CONFIG_DCACHE_SIZE] = {};
+// pages holding at least one cached instruction, writes to them
+// should check whether some entries become stale
+uint8_t dcache_code_page[CONFIG_MSIZE >> PAGE_SHIFT] = {};
+uint64_t dcache_hit = 0, dcache_miss = 0, dcache_nr_invalidate = 0;
+uint64_t dcache_version = 0;
+
+#define CODE_LINE_SHIFT 6
+// 64-byte lines holding code registered by dcache_mark_code()
+static uint8_t dcache_code_line[CONFIG_MSIZE >> CODE_LINE_SHIFT] = {};
+
+static inline uint32_t code_line(paddr_t addr) {
+  return (addr - CONFIG_MBASE) >> CODE_LINE_SHIFT;
+}
+
+static void mark_page(paddr_t addr, int len) {
+  uint8_t *p0 = &dcache_code_page[pmem_page(addr)];
+  uint8_t *p1 = &dcache_code_page[pmem_last_page(addr, len)];
+  if (unlikely((*p0 & *p1) == 0)) {
+    // stores to a new code page should go through paddr_write()
+    *p0 = *p1 = 1;
+    tlb_flush_write();
+  }
+}
+
+void dcache_insert(Decode *s, const void *handler) {
+  // the guest pc is used as the physical address since no
+  // translation is performed by vaddr_ifetch()
+  if (!in_pmem(s->pc) || !in_pmem(s->snpc - 1)) return;
+
+  DCacheEntry *e = dcache_slot(s->pc);
+  e->pc = s->pc;
+  e->snpc = s->snpc;
+  e->handler = handler;
+  e->isa = s->isa;
+  mark_page(s->pc, s->snpc - s->pc);
+}
+
+void dcache_mark_code(paddr_t addr, int len) {
+  mark_page(addr, len);
+  uint32_t last = code_line(addr + len - 1);
+  for (uint32_t i = code_line(addr); i <= last; i ++) dcache_code_line[i] = 1;
+}
+
+void dcache_invalidate(paddr_t addr, int len) {
+  if (dcache_code_line[code_line(addr)] |
+      dcache_code_line[code_line(in_pmem(addr + len - 1) ? addr + len - 1 : addr)]) {
+    dcache_version ++;
+  }
+  // any instruction overlapping [addr, addr + len) starts
+  // at most MAX_INST_LEN - 1 bytes before `addr`
+  vaddr_t pc = addr - (MAX_INST_LEN - 1);
+  for (; pc != addr + len; pc ++) {
+    DCacheEntry *e = dcache_slot(pc);
+    if (e->handler != NULL && e->pc == pc && e->snpc > addr) {
+      e->handler = NULL;
+      dcache_nr_invalidate ++;
+    }
+  }
+}
+
+void dcache_flush() {
+  for (int i = 0; i < CONFIG_DCACHE_SIZE; i ++) {
+    dcache[i].handler = NULL;
+  }
+  memset(dcache_code_page, 0, sizeof(dcache_code_page));
+  memset(dcache_code_line, 0, sizeof(dcache_code_line));
+  dcache_version ++;
+}
+
+#endif
@@ -0,0 +1,101 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <cpu/decode.h>
+
+struct InstPat {
+  uint64_t key, mask; // in the bit positions of the instruction
+  const void *target;
+  const char *pattern, *name;
+  int line;
+};
+
+void instpat_add(InstPatTable *t, uint64_t key, uint64_t mask, uint64_t shift,
+    const void *target, const char *pattern, const char *name, int line) {
+  t->pat = realloc(t->pat, (t->nr_pat + 1) * sizeof(t->pat[0]));
+  assert(t->pat);
+  // `shift' of an all-'?' pattern is its whole length
+  t->pat[t->nr_pat ++] = (struct InstPat) {
+    .key  = (shift < 64 ? key  << shift : 0),
+    .mask = (shift < 64 ? mask << shift : 0),
+    .target = target, .pattern = pattern, .name = name, .line = line };
+}
+
+static inline bool pat_overlap(struct InstPat *a, struct InstPat *b) {
+  return ((a->key ^ b->key) & a->mask & b->mask) == 0;
+}
+
+// every instruction matching `b' also matches `a'
+static inline bool pat_cover(struct InstPat *a, struct InstPat *b) {
+  return pat_overlap(a, b) && (a->mask & ~b->mask) == 0;
+}
+
+static void check_overlap(InstPatTable *t) {
+  for (int j = 0; j < t->nr_pat; j ++) {
+    struct InstPat *b = &t->pat[j];
+    for (int i = 0; i < j; i ++) {
+      struct InstPat *a = &t->pat[i];
+      if (!pat_overlap(a, b)) continue;
+      // an earlier pattern may only pick a special case of a later one
+      if (pat_cover(b, a) && !pat_cover(a, b)) continue;
+      panic("line %d: pattern \"%s\" (%s) %s \"%s\" (%s) at line %d",
+          b->line, b->pattern, b->name,
+          pat_cover(a, b) ? "is shadowed by" : "overlaps with",
+          a->pattern, a->name, a->line);
+    }
+  }
+}
+
+// fill the entries of a bucket to `e' if it is not NULL, return the number of them
+static int fill_bucket(InstPatTable *t, uint64_t idx, InstPatEntry *e, const void *end) {
+  uint64_t index_mask = (uint64_t)(t->nr_bucket - 1) << t->lo;
+  uint64_t bits = idx << t->lo;
+  int n = 0;
+  for (int i = 0; i < t->nr_pat; i ++) {
+    struct InstPat *p = &t->pat[i];
+    if (((p->key ^ bits) & p->mask & index_mask) != 0) continue;
+    // the bits in the index field are matched by choosing the bucket
+    uint64_t mask = p->mask & ~index_mask;
+    if (e != NULL) e[n] = (InstPatEntry) { .key = p->key & mask, .mask = mask, .target = p->target };
+    n ++;
+    if (mask == 0) return n;
+  }
+  // no pattern matches the rest of the bucket
+  if (e != NULL) e[n] = (InstPatEntry) { .key = 0, .mask = 0, .target = end };
+  return n + 1;
+}
+
+void instpat_build(InstPatTable *t, const void *end) {
+  check_overlap(t);
+
+  int width = t->hi - t->lo + 1;
+  Assert(width > 0 && width <= 16, "invalid index field [%d:%d]", t->hi, t->lo);
+  t->nr_bucket = 1 << width;
+
+  int nr_entry = 0;
+  for (int i = 0; i < t->nr_bucket; i ++) {
+    nr_entry += fill_bucket(t, i, NULL, end);
+  }
+  t->entry = malloc(sizeof(t->entry[0]) * nr_entry);
+  t->bucket = malloc(sizeof(t->bucket[0]) * t->nr_bucket);
+  assert(t->entry && t->bucket);
+
+  InstPatEntry *e = t->entry;
+  for (int i = 0; i < t->nr_bucket; i ++) {
+    t->bucket[i] = e;
+    e += fill_bucket(t, i, e, end);
+  }
+  t->built = true;
+}
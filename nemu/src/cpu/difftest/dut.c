@@ -17,7 +17,10 @@
 
 #include <isa.h>
 #include <cpu/cpu.h>
+#include <cpu/dcache.h>
+#include <memory/host.h>
 #include <memory/paddr.h>
+#include <memory/vaddr.h>
 #include <utils.h>
 #include <difftest-def.h>
 
@@ -28,9 +31,227 @@ void (*ref_difftest_raise_intr)(uint64_t NO) = NULL;
 
 #ifdef CONFIG_DIFFTEST
 
+// pages saved for going back to the start of the batch, none of them
+// is saved with DIFFTEST_PIPELINE, where every store is logged
+uint8_t difftest_saved_page[CONFIG_MSIZE >> PAGE_SHIFT] = {};
+
+/* The registers alone miss a wrong store until the stored value is
+ * loaded again. The pages written by the DUT are collected, and every
+ * DIFFTEST_MEM_INTERVAL instructions, when the REF has run the same
+ * instructions, they are copied from the REF and compared with the DUT.
+ */
+static uint8_t dirty_page[CONFIG_MSIZE >> PAGE_SHIFT] = {};
+static uint32_t dirty_list[CONFIG_MSIZE >> PAGE_SHIFT];
+static uint32_t nr_dirty = 0;
+static uint64_t mem_check_inst = 0; // g_nr_guest_inst at the last check
+uint64_t difftest_nr_mem_check = 0, difftest_nr_mem_page = 0;
+
+extern HART_LOCAL uint64_t g_nr_guest_inst;
+
+void difftest_mark_dirty(paddr_t addr, int len) {
+  uint32_t idx[2] = { pmem_page(addr), pmem_last_page(addr, len) };
+  for (int i = 0; i < 2; i ++) {
+    if (dirty_page[idx[i]]) continue;
+    dirty_page[idx[i]] = 1;
+    dirty_list[nr_dirty ++] = idx[i];
+  }
+}
+
+bool difftest_mem_due() {
+  return CONFIG_DIFFTEST_MEM_INTERVAL > 0 && nr_dirty > 0 &&
+    g_nr_guest_inst - mem_check_inst >= CONFIG_DIFFTEST_MEM_INTERVAL;
+}
+
+// compare the dirty pages with the REF, which should have run the same
+// instructions as the DUT, the last one of them is at `pc';
+// the check is done at most once per interval unless `force' is set
+void difftest_check_mem(vaddr_t pc, bool force) {
+  if (CONFIG_DIFFTEST_MEM_INTERVAL == 0 || nr_dirty == 0) return;
+  if (!force && !difftest_mem_due()) return;
+  static uint8_t buf[PAGE_SIZE];
+  uint64_t nr_inst = g_nr_guest_inst - mem_check_inst;
+  difftest_nr_mem_check ++;
+  difftest_nr_mem_page += nr_dirty;
+  mem_check_inst = g_nr_guest_inst;
+  uint32_t n = nr_dirty;
+  nr_dirty = 0;
+  for (uint32_t i = 0; i < n; i ++) {
+    dirty_page[dirty_list[i]] = 0;
+  }
+  for (uint32_t i = 0; i < n; i ++) {
+    paddr_t page = CONFIG_MBASE + ((paddr_t)dirty_list[i] << PAGE_SHIFT);
+    uint8_t *dut = guest_to_host(page);
+    ref_difftest_memcpy(page, buf, PAGE_SIZE, DIFFTEST_TO_DUT);
+    if (memcmp(buf, dut, PAGE_SIZE) == 0) continue;
+    int off = 0;
+    while (buf[off] == dut[off]) off ++;
+    off &= ~(int)(sizeof(word_t) - 1);
+    Log("Memory differs at paddr = " FMT_PADDR ", right = " FMT_WORD ", wrong = " FMT_WORD
+        ", written by one of the %" PRIu64 " instructions up to pc = " FMT_WORD,
+        page + off, host_read(buf + off, sizeof(word_t)), host_read(dut + off, sizeof(word_t)),
+        nr_inst, pc);
+    nemu_state.state = NEMU_ABORT;
+    nemu_state.halt_pc = pc;
+    return;
+  }
+}
+
+#ifndef CONFIG_DIFFTEST_PIPELINE
+/* DUT and REF run a batch of up to `batch' instructions before their
+ * registers are compared. At the start of each batch the DUT takes a
+ * checkpoint: its registers, and the content of every page of pmem
+ * before the first write to it. When the registers differ at the end of
+ * a batch, both sides go back to the checkpoint and run the batch again
+ * one instruction at a time, so the first wrong instruction is found.
+ * The batch size is doubled after each batch without a difference, and
+ * drops to 1 after one with a difference.
+ */
+#define MAX_UNDO_PAGE 128
+
 static bool is_skip_ref = false;
 static int skip_dut_nr_inst = 0;
 
+static uint64_t batch = 1;
+static uint64_t nr_pending = 0;  // instructions run by the DUT but not by the REF
+static uint64_t bisect_left = 0; // instructions to run again one by one
+static bool need_bisect = false;
+// the DUT state before the last instruction, needed if the batch
+// ends during an instruction which calls difftest_skip_*()
+static CPU_state last_cpu;
+static vaddr_t last_pc = 0;
+
+static CPU_state ckpt_cpu;
+static uint64_t ckpt_nr_inst = 0;
+static struct {
+  uint32_t idx;
+  uint8_t data[PAGE_SIZE];
+} undo[MAX_UNDO_PAGE];
+static int nr_undo = 0;
+
+/* A device access ends a batch, after the device is run. If the batch
+ * has a difference, the instruction accessing the device runs again
+ * after the others are run one by one. The values it read are kept and
+ * given to it again, and its writes do not reach the device again.
+ */
+#define MAX_DEV_READ 64
+static word_t dev_read[MAX_DEV_READ];
+static int nr_dev_read = 0, dev_read_pos = 0;
+static bool dev_replay = false; // set until that instruction runs again
+bool difftest_dev_replaying = false;
+
+uint64_t difftest_nr_batch = 0, difftest_nr_bisect = 0;
+
+static void checkpoint() {
+  for (int i = 0; i < nr_undo; i ++) {
+    difftest_saved_page[undo[i].idx] = 0;
+  }
+  // the saved pages have been plain
+  if (nr_undo > 0) tlb_flush_write();
+  nr_undo = 0;
+  nr_pending = 0;
+  ckpt_cpu = cpu;
+  ckpt_nr_inst = g_nr_guest_inst;
+}
+
+void difftest_record_read(word_t val) {
+  // the rest can not be replayed, which is reported if it is needed
+  if (nr_dev_read < MAX_DEV_READ) dev_read[nr_dev_read ++] = val;
+}
+
+word_t difftest_replay_read() {
+  Assert(dev_read_pos < nr_dev_read, "the device reads to replay are used up");
+  return dev_read[dev_read_pos ++];
+}
+
+// called by paddr_write() before every store to pmem
+void difftest_check_write(paddr_t addr, int len) {
+  difftest_mark_dirty(addr, len);
+  if (batch == 1) return; // a difference is reported at once
+  uint32_t idx[2] = { pmem_page(addr), pmem_last_page(addr, len) };
+  for (int i = 0; i < 2; i ++) {
+    if (difftest_saved_page[idx[i]]) continue;
+    Assert(nr_undo < MAX_UNDO_PAGE, "too many pages written in a difftest batch");
+    undo[nr_undo].idx = idx[i];
+    memcpy(undo[nr_undo].data, guest_to_host(CONFIG_MBASE + ((paddr_t)idx[i] << PAGE_SHIFT)), PAGE_SIZE);
+    nr_undo ++;
+    difftest_saved_page[idx[i]] = 1;
+  }
+}
+
+static void checkregs(CPU_state *ref, vaddr_t pc) {
+  if (!isa_difftest_checkregs(ref, pc)) {
+    nemu_state.state = NEMU_ABORT;
+    nemu_state.halt_pc = pc;
+    isa_reg_display();
+  }
+}
+
+// let the REF run the pending instructions and compare it with `dut',
+// which is the DUT state after the instruction at `pc'; the DUT stops
+// at `dut' if the difference is found in a batch of one instruction
+static void sync_ref(CPU_state *dut, vaddr_t pc) {
+  if (nr_pending == 0) return;
+  ref_difftest_exec(nr_pending);
+  difftest_nr_batch ++;
+
+  CPU_state ref_r;
+  ref_difftest_regcpy(&ref_r, DIFFTEST_TO_DUT);
+  if (isa_difftest_cmpregs(&ref_r, dut)) return;
+  cpu = *dut;
+  if (nr_pending > 1) {
+    need_bisect = true;
+    return;
+  }
+  if (bisect_left > 0) Log("The first different instruction is at pc = " FMT_WORD, pc);
+  checkregs(&ref_r, pc);
+}
+
+// go back to the checkpoint and run the batch again one instruction at a time,
+// `dev' is set if the batch is ended by the current instruction accessing a device
+static void bisect(bool dev) {
+  Log("Registers differ at the end of a batch of %" PRIu64 " instructions, "
+      "running it again one by one from pc = " FMT_WORD, nr_pending, ckpt_cpu.pc);
+  for (int i = 0; i < nr_undo; i ++) {
+    paddr_t addr = CONFIG_MBASE + ((paddr_t)undo[i].idx << PAGE_SHIFT);
+    memcpy(guest_to_host(addr), undo[i].data, PAGE_SIZE);
+    ref_difftest_memcpy(addr, undo[i].data, PAGE_SIZE, DIFFTEST_TO_REF);
+  }
+  dcache_flush();
+  cpu = ckpt_cpu;
+  g_nr_guest_inst = ckpt_nr_inst;
+  ref_difftest_regcpy(&cpu, DIFFTEST_TO_REF);
+
+  nemu_state.state = NEMU_RUNNING;
+  bisect_left = nr_pending;
+  nr_pending = 0;
+  batch = 1;
+  need_bisect = false;
+  is_skip_ref = false;
+  skip_dut_nr_inst = 0;
+  difftest_nr_bisect ++;
+  last_cpu = cpu;
+  dev_replay = dev;
+}
+
+static void next_batch(vaddr_t pc) {
+  checkpoint();
+  difftest_check_mem(pc, false);
+  if (bisect_left > 0) {
+    if (-- bisect_left == 0) {
+      Log("No difference is found when running the batch again, the REF may be nondeterministic");
+      // the next instruction accessed the device at the end of the batch
+      if (dev_replay) {
+        difftest_dev_replaying = true;
+        dev_read_pos = 0;
+      }
+    }
+  } else if (batch < CONFIG_DIFFTEST_BATCH) {
+    batch *= 2;
+  }
+  last_cpu = cpu;
+  last_pc = pc;
+}
+
 // this is used to let ref skip instructions which
 // can not produce consistent behavior with NEMU
 void difftest_skip_ref() {
@@ -52,12 +273,15 @@ void difftest_skip_ref() {
 //   Let REF run `nr_ref` instructions first.
 //   We expect that DUT will catch up with REF within `nr_dut` instructions.
 void difftest_skip_dut(int nr_ref, int nr_dut) {
+  // the REF should finish the instructions before this one first
+  sync_ref(&last_cpu, last_pc);
   skip_dut_nr_inst += nr_dut;
 
   while (nr_ref -- > 0) {
     ref_difftest_exec(1);
   }
 }
+#endif
 
 void init_difftest(char *ref_so_file, long img_size, int port) {
   assert(ref_so_file != NULL);
@@ -82,31 +306,57 @@ void init_difftest(char *ref_so_file, long img_size, int port) {
   assert(ref_difftest_init);
 
   Log("Differential testing: %s", ANSI_FMT("ON", ANSI_FG_GREEN));
-  Log("The result of every instruction will be compared with %s. "
-      "This will help you a lot for debugging, but also significantly reduce the performance. "
+#ifdef CONFIG_DIFFTEST_PIPELINE
+  Log("The result of every instruction will be compared with %s in another thread. "
+      "This will help you a lot for debugging, but also reduce the performance. "
       "If it is not necessary, you can turn it off in menuconfig.", ref_so_file);
+#else
+  Log("The result of every %d instructions at most will be compared with %s, "
+      "and a batch with a difference is run again to find the first wrong instruction. "
+      "This will help you a lot for debugging, but also reduce the performance. "
+      "If it is not necessary, you can turn it off in menuconfig.", CONFIG_DIFFTEST_BATCH, ref_so_file);
+#endif
 
   ref_difftest_init(port);
-  ref_difftest_memcpy(RESET_VECTOR, guest_to_host(RESET_VECTOR), img_size, DIFFTEST_TO_REF);
+  if (CONFIG_DIFFTEST_MEM_INTERVAL > 0) {
+    // the pages outside the image are compared too
+    ref_difftest_memcpy(CONFIG_MBASE, guest_to_host(CONFIG_MBASE), pmem_size, DIFFTEST_TO_REF);
+  } else {
+    ref_difftest_memcpy(RESET_VECTOR, guest_to_host(RESET_VECTOR), img_size, DIFFTEST_TO_REF);
+  }
   ref_difftest_regcpy(&cpu, DIFFTEST_TO_REF);
+#ifdef CONFIG_DIFFTEST_PIPELINE
+  void difftest_pipeline_start();
+  difftest_pipeline_start();
+#else
+  checkpoint();
+  last_cpu = cpu;
+  last_pc = cpu.pc;
+#endif
 }
 
-static void checkregs(CPU_state *ref, vaddr_t pc) {
-  if (!isa_difftest_checkregs(ref, pc)) {
-    nemu_state.state = NEMU_ABORT;
-    nemu_state.halt_pc = pc;
-    isa_reg_display();
-  }
-}
+#ifndef CONFIG_DIFFTEST_PIPELINE
 
-void difftest_step(vaddr_t pc, vaddr_t npc) {
+static void step(vaddr_t pc, vaddr_t npc) {
   CPU_state ref_r;
 
+  if (difftest_dev_replaying) {
+    difftest_dev_replaying = false;
+    dev_replay = false;
+  }
+
+  if (need_bisect) {
+    // set by difftest_skip_dut() during this instruction
+    bisect(true);
+    return;
+  }
+
   if (skip_dut_nr_inst > 0) {
     ref_difftest_regcpy(&ref_r, DIFFTEST_TO_DUT);
     if (ref_r.pc == npc) {
       skip_dut_nr_inst = 0;
       checkregs(&ref_r, npc);
+      next_batch(pc);
       return;
     }
     skip_dut_nr_inst --;
@@ -116,17 +366,48 @@ void difftest_step(vaddr_t pc, vaddr_t npc) {
   }
 
   if (is_skip_ref) {
-    // to skip the checking of an instruction, just copy the reg state to reference design
-    ref_difftest_regcpy(&cpu, DIFFTEST_TO_REF);
+    // the REF runs the instructions before this one, then
+    // copies the reg state after this one from the DUT
     is_skip_ref = false;
+    sync_ref(&last_cpu, last_pc);
+    if (need_bisect) { bisect(true); return; }
+    if (nemu_state.state == NEMU_ABORT) return;
+    ref_difftest_regcpy(&cpu, DIFFTEST_TO_REF);
+    next_batch(pc);
     return;
   }
 
-  ref_difftest_exec(1);
-  ref_difftest_regcpy(&ref_r, DIFFTEST_TO_DUT);
+  nr_pending ++;
+  // an instruction writes at most 2 pages
+  if (nr_pending < batch && nr_undo + 2 <= MAX_UNDO_PAGE) {
+    last_cpu = cpu;
+    last_pc = pc;
+    return;
+  }
+  sync_ref(&cpu, pc);
+  if (need_bisect) { bisect(false); return; }
+  if (nemu_state.state == NEMU_ABORT) return;
+  next_batch(pc);
+}
 
-  checkregs(&ref_r, pc);
+void difftest_step(vaddr_t pc, vaddr_t npc) {
+  step(pc, npc);
+  if (!dev_replay) nr_dev_read = 0;
 }
+
+// compare the instructions pending when cpu_exec() returns, a batch
+// with a difference is run again one by one in the next cpu_exec()
+void difftest_sync() {
+  if (nemu_state.state == NEMU_ABORT) return;
+  if (nr_pending > 0) {
+    sync_ref(&cpu, last_pc);
+    if (need_bisect) { bisect(false); return; }
+    if (nemu_state.state == NEMU_ABORT) return;
+    next_batch(last_pc);
+  }
+  if (nemu_state.state == NEMU_END) difftest_check_mem(last_pc, true);
+}
+#endif
 #else
 void init_difftest(char *ref_so_file, long img_size, int port) { }
 #endif
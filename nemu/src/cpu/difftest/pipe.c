@@ -0,0 +1,265 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <isa.h>
+#include <cpu/cpu.h>
+#include <cpu/dcache.h>
+#include <cpu/difftest.h>
+#include <memory/host.h>
+#include <memory/paddr.h>
+
+#ifdef CONFIG_DIFFTEST_PIPELINE
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <time.h>
+
+/* The DUT pushes a record for each instruction into a single-producer
+ * single-consumer ring, and a checker thread runs the REF for each
+ * record and compares the registers. A record keeps the whole DUT state
+ * after the instruction, since it is not known which registers the
+ * instruction writes. The old values of the stores are kept in another
+ * ring, so that when the checker finds a difference, the DUT undoes the
+ * stores of the records after that one and stops exactly there. The DUT
+ * only waits for the checker when a ring is full.
+ */
+#define NR_RECORD 4096
+#define NR_STORE  (4 * NR_RECORD)
+
+typedef struct {
+  CPU_state cpu; // the DUT state after the instruction
+  uint64_t nr_inst;
+  vaddr_t pc;
+  uint32_t store_start; // the first entry in `store' of the instruction
+  bool skip_ref;
+  int nr_ref, nr_dut;   // arguments of difftest_skip_dut()
+} Record;
+
+typedef struct {
+  paddr_t addr;
+  int len;
+  word_t old;
+} StoreLog;
+
+enum { CHECK_OK, CHECK_DIFF, CHECK_CATCH_UP };
+
+static Record record[NR_RECORD];
+static StoreLog store[NR_STORE];
+// free-running indices, `head' is written by the DUT and `tail' by the checker
+static _Atomic uint64_t head = 0, tail = 0;
+static atomic_bool failed = false;
+static uint64_t fail_idx = 0;
+static int fail_kind = CHECK_OK;
+static CPU_state fail_ref;
+
+// owned by the DUT
+static uint32_t store_head = 0, cur_store_start = 0;
+static bool store_lost = false;
+static bool cur_skip_ref = false;
+static int cur_nr_ref = 0, cur_nr_dut = 0;
+uint64_t difftest_nr_stall = 0;
+
+extern HART_LOCAL uint64_t g_nr_guest_inst;
+void difftest_mark_dirty(paddr_t addr, int len);
+bool difftest_mem_due();
+void difftest_check_mem(vaddr_t pc, bool force);
+
+// ---------- checker thread ----------
+
+static int skip_dut_nr_inst = 0;
+
+static int check_record(Record *r) {
+  // If such an instruction is one of the instruction packing in QEMU,
+  // we end the process of catching up with QEMU's pc, see dut.c
+  if (r->skip_ref) skip_dut_nr_inst = 0;
+  if (r->nr_ref > 0 || r->nr_dut > 0) {
+    skip_dut_nr_inst += r->nr_dut;
+    for (int i = 0; i < r->nr_ref; i ++) ref_difftest_exec(1);
+  }
+
+  if (skip_dut_nr_inst > 0) {
+    ref_difftest_regcpy(&fail_ref, DIFFTEST_TO_DUT);
+    if (fail_ref.pc == r->cpu.pc) {
+      skip_dut_nr_inst = 0;
+      return isa_difftest_cmpregs(&fail_ref, &r->cpu) ? CHECK_OK : CHECK_DIFF;
+    }
+    skip_dut_nr_inst --;
+    return skip_dut_nr_inst == 0 ? CHECK_CATCH_UP : CHECK_OK;
+  }
+
+  if (r->skip_ref) {
+    ref_difftest_regcpy(&r->cpu, DIFFTEST_TO_REF);
+    return CHECK_OK;
+  }
+
+  ref_difftest_exec(1);
+  ref_difftest_regcpy(&fail_ref, DIFFTEST_TO_DUT);
+  return isa_difftest_cmpregs(&fail_ref, &r->cpu) ? CHECK_OK : CHECK_DIFF;
+}
+
+static void* checker(void *arg) {
+  uint64_t t = atomic_load_explicit(&tail, memory_order_relaxed);
+  int idle = 0;
+  while (true) {
+    if (t == atomic_load_explicit(&head, memory_order_acquire)) {
+      // sleep when the DUT stops, e.g. at the sdb prompt
+      if (++ idle < 1024) sched_yield();
+      else nanosleep(&(struct timespec){ .tv_nsec = 100000 }, NULL);
+      continue;
+    }
+    idle = 0;
+    int kind = check_record(&record[t % NR_RECORD]);
+    if (kind != CHECK_OK) {
+      fail_idx = t;
+      fail_kind = kind;
+      atomic_store_explicit(&failed, true, memory_order_release);
+      return NULL;
+    }
+    t ++;
+    atomic_store_explicit(&tail, t, memory_order_release);
+  }
+}
+
+// ---------- DUT ----------
+
+static inline bool check_failed() {
+  return atomic_load_explicit(&failed, memory_order_acquire);
+}
+
+static inline uint64_t checked() {
+  return atomic_load_explicit(&tail, memory_order_acquire);
+}
+
+// return false if the checker has found a difference
+static bool stall() {
+  if (check_failed()) return false;
+  sched_yield();
+  return true;
+}
+
+// put the DUT back to the state after the record with a difference
+static void halt() {
+  Record *r = &record[fail_idx % NR_RECORD];
+  uint64_t h = atomic_load_explicit(&head, memory_order_relaxed);
+  uint32_t end = (fail_idx + 1 == h ? cur_store_start : record[(fail_idx + 1) % NR_RECORD].store_start);
+  while (store_head != end) {
+    store_head --;
+    StoreLog *l = &store[store_head % NR_STORE];
+    host_write(guest_to_host(l->addr), l->len, l->old);
+  }
+  if (store_lost) Log("Some stores of the last instruction can not be undone");
+  dcache_flush();
+  cpu = r->cpu;
+  g_nr_guest_inst = r->nr_inst;
+  if (fail_kind == CHECK_CATCH_UP) {
+    panic("can not catch up with ref.pc = " FMT_WORD " at pc = " FMT_WORD, fail_ref.pc, r->pc);
+  }
+  isa_difftest_checkregs(&fail_ref, r->pc);
+  nemu_state.state = NEMU_ABORT;
+  nemu_state.halt_pc = r->pc;
+  isa_reg_display();
+}
+
+static uint32_t oldest_store() {
+  uint64_t t = checked();
+  uint64_t h = atomic_load_explicit(&head, memory_order_relaxed);
+  return (t == h ? cur_store_start : record[t % NR_RECORD].store_start);
+}
+
+// called by paddr_write() before every store to pmem
+void difftest_check_write(paddr_t addr, int len) {
+  difftest_mark_dirty(addr, len);
+  if (store_head - oldest_store() >= NR_STORE) {
+    difftest_nr_stall ++;
+    while (store_head - oldest_store() >= NR_STORE) {
+      // the DUT halts at the next difftest_step()
+      if (!stall()) { store_lost = true; return; }
+    }
+  }
+  StoreLog *l = &store[store_head % NR_STORE];
+  l->addr = addr;
+  l->len = len;
+  l->old = host_read(guest_to_host(addr), len);
+  store_head ++;
+}
+
+// wait for the checker to catch up with the DUT,
+// return false if it has found a difference
+static bool drain() {
+  uint64_t h = atomic_load_explicit(&head, memory_order_relaxed);
+  while (checked() != h) {
+    if (!stall()) break;
+  }
+  if (check_failed()) { halt(); return false; }
+  return true;
+}
+
+void difftest_skip_ref() {
+  cur_skip_ref = true;
+  cur_nr_ref = cur_nr_dut = 0;
+}
+
+void difftest_skip_dut(int nr_ref, int nr_dut) {
+  cur_nr_ref += nr_ref;
+  cur_nr_dut += nr_dut;
+}
+
+void difftest_step(vaddr_t pc, vaddr_t npc) {
+  uint64_t h = atomic_load_explicit(&head, memory_order_relaxed);
+  if (h - checked() >= NR_RECORD) {
+    difftest_nr_stall ++;
+    while (h - checked() >= NR_RECORD) {
+      if (!stall()) break;
+    }
+  }
+  if (unlikely(check_failed())) { halt(); return; }
+
+  Record *r = &record[h % NR_RECORD];
+  r->cpu = cpu;
+  r->nr_inst = g_nr_guest_inst;
+  r->pc = pc;
+  r->store_start = cur_store_start;
+  r->skip_ref = cur_skip_ref;
+  r->nr_ref = cur_nr_ref;
+  r->nr_dut = cur_nr_dut;
+  atomic_store_explicit(&head, h + 1, memory_order_release);
+
+  cur_store_start = store_head;
+  cur_skip_ref = false;
+  cur_nr_ref = cur_nr_dut = 0;
+
+  // the checker is idle after drain(), so the REF can be used here
+  if (unlikely(difftest_mem_due()) && drain()) difftest_check_mem(pc, true);
+}
+
+void difftest_sync() {
+  if (nemu_state.state == NEMU_ABORT) return;
+  if (drain() && nemu_state.state == NEMU_END) {
+    uint64_t h = atomic_load_explicit(&head, memory_order_relaxed);
+    difftest_check_mem(record[(h - 1) % NR_RECORD].pc, true);
+  }
+}
+
+uint64_t difftest_nr_record() {
+  return checked();
+}
+
+void difftest_pipeline_start() {
+  pthread_t thread;
+  Assert(pthread_create(&thread, NULL, checker, NULL) == 0, "fail to create the difftest checker");
+  pthread_detach(thread);
+}
+#endif
@@ -35,8 +35,8 @@ __EXPORT void difftest_raise_intr(word_t NO) {
 }
 
 __EXPORT void difftest_init(int port) {
-  void init_mem();
-  init_mem();
+  void init_mem(bool fill_random);
+  init_mem(true);
   /* Perform ISA dependent initialization. */
   init_isa();
 }
@@ -0,0 +1,143 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <cpu/event.h>
+#include <cpu/mpe.h>
+#include <utils.h>
+
+#define MAX_EVENT 8
+// bounds of the distance between two checks of a periodic event
+#define MIN_DELAY 64
+#define MAX_DELAY (1ull << 24)
+
+typedef struct {
+  const char *name;
+  event_handler_t handler;
+  uint64_t deadline; // in guest instructions
+  uint64_t period;   // in us of the guest time, 0 for a one-shot event
+  uint64_t last;     // the guest time when the event was last run
+} Event;
+
+static Event events[MAX_EVENT] = {};
+static int nr_event = 0;
+uint64_t event_deadline = UINT64_MAX;
+
+extern HART_LOCAL uint64_t g_nr_guest_inst;
+
+// the guest speed, measured between two checks of periodic events,
+// to turn host time into instructions
+static uint64_t inst_per_sec = 1000000;
+static uint64_t rate_inst = 0, rate_time = 0;
+
+static void update_rate(uint64_t now) {
+  if (icount_shift >= 0 || now - rate_time < 1000) return;
+  inst_per_sec = (g_nr_guest_inst - rate_inst) * 1000000 / (now - rate_time);
+  rate_inst = g_nr_guest_inst;
+  rate_time = now;
+}
+
+static uint64_t us_to_inst(uint64_t us) {
+  // exactly the instructions to reach the time with --icount
+  if (icount_shift >= 0) return ((us * 1000) + (1ull << icount_shift) - 1) >> icount_shift;
+  uint64_t n = us * inst_per_sec / 1000000;
+  return (n < MIN_DELAY ? MIN_DELAY : (n > MAX_DELAY ? MAX_DELAY : n));
+}
+
+static void update_deadline() {
+  uint64_t deadline = UINT64_MAX;
+  for (int i = 0; i < nr_event; i ++) {
+    if (events[i].deadline < deadline) deadline = events[i].deadline;
+  }
+  event_deadline = deadline;
+}
+
+int event_add(const char *name, event_handler_t handler) {
+  assert(nr_event < MAX_EVENT);
+  events[nr_event] = (Event) { .name = name, .handler = handler, .deadline = UINT64_MAX };
+  return nr_event ++;
+}
+
+int event_add_periodic(const char *name, event_handler_t handler, uint64_t period_us) {
+  assert(period_us > 0);
+  int id = event_add(name, handler);
+  Event *e = &events[id];
+  e->period = period_us;
+  e->last = get_guest_time();
+  if (rate_time == 0) rate_time = e->last;
+  e->deadline = g_nr_guest_inst + us_to_inst(period_us);
+  update_deadline();
+  return id;
+}
+
+void event_schedule(int id, uint64_t delay) {
+  assert(id >= 0 && id < nr_event);
+  uint64_t deadline = g_nr_guest_inst + delay;
+  if (deadline < events[id].deadline) events[id].deadline = deadline;
+  if (deadline < event_deadline) event_deadline = deadline;
+}
+
+#ifdef CONFIG_HAS_MPE
+// only hart 0 runs the events, every hart checks its own requests
+void event_check_intr() {
+  atomic_fetch_or_explicit(&hart_req[hart_id].req, HART_REQ_CHECK, memory_order_relaxed);
+}
+#else
+// nothing to do, the CPU loop checks for interrupts after running the events
+static void intr_check() { }
+static int intr_event = -1;
+
+void event_check_intr() {
+  if (intr_event == -1) intr_event = event_add("intr", intr_check);
+  event_schedule(intr_event, 0);
+}
+#endif
+
+void event_run() {
+  uint64_t now = 0;
+  bool has_now = false;
+  for (int i = 0; i < nr_event; i ++) {
+    Event *e = &events[i];
+    if (e->deadline > g_nr_guest_inst) continue;
+    // the handler may schedule the event again
+    e->deadline = UINT64_MAX;
+    if (e->period == 0) {
+      e->handler();
+      continue;
+    }
+
+    if (!has_now) {
+      now = get_guest_time();
+      update_rate(now);
+      has_now = true;
+    }
+    if (now - e->last >= e->period) {
+      e->last = now;
+      e->handler();
+    }
+    e->deadline = g_nr_guest_inst + us_to_inst(e->last + e->period - now);
+  }
+  update_deadline();
+}
+
+void event_reset() {
+  for (int i = 0; i < nr_event; i ++) {
+    Event *e = &events[i];
+    if (e->period != 0) e->deadline = g_nr_guest_inst + us_to_inst(e->period);
+    else if (e->deadline != UINT64_MAX) e->deadline = g_nr_guest_inst;
+  }
+  rate_inst = g_nr_guest_inst;
+  rate_time = get_guest_time();
+  update_deadline();
+}
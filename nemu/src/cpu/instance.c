@@ -0,0 +1,149 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <isa.h>
+#include <cpu/cpu.h>
+#include <cpu/dcache.h>
+#include <cpu/event.h>
+#include <memory/paddr.h>
+#include <difftest-def.h>
+#include <nemu-instance.h>
+
+#ifdef CONFIG_TARGET_SHARE
+#include <pthread.h>
+#include <sys/mman.h>
+
+/* The machine state of an instance is kept in the globals of NEMU while
+ * it is the current one, and here otherwise. Switching to another
+ * instance swaps the state and the pmem pointer, the caches derived
+ * from pmem are flushed.
+ */
+struct NEMUInstance {
+  CPU_state cpu;
+  NEMUState state;
+  uint64_t nr_inst, time_us;
+  uint8_t *pmem; // NULL while it is the current one
+#ifdef CONFIG_MEM_RANDOM
+  uint8_t fill_byte;
+  uint8_t fresh_page[CONFIG_MSIZE >> PAGE_SHIFT];
+#endif
+};
+
+extern HART_LOCAL uint64_t g_nr_guest_inst;
+extern uint64_t g_timer;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static NEMUInstance *current = NULL;
+
+static inline bool ended(const NEMUState *s) {
+  return s->state != NEMU_RUNNING && s->state != NEMU_STOP;
+}
+
+static void save(NEMUInstance *nemu) {
+  nemu->cpu = cpu;
+  nemu->state = nemu_state;
+  nemu->nr_inst = g_nr_guest_inst;
+  nemu->time_us = g_timer;
+  nemu->pmem = pmem_switch(NULL);
+#ifdef CONFIG_MEM_RANDOM
+  nemu->fill_byte = pmem_fill_byte;
+  memcpy(nemu->fresh_page, pmem_fresh_page, pmem_size >> PAGE_SHIFT);
+#endif
+}
+
+static void load(NEMUInstance *nemu) {
+  cpu = nemu->cpu;
+  nemu_state = nemu->state;
+  g_nr_guest_inst = nemu->nr_inst;
+  g_timer = nemu->time_us;
+  pmem_switch(nemu->pmem);
+  nemu->pmem = NULL;
+#ifdef CONFIG_MEM_RANDOM
+  pmem_fill_byte = nemu->fill_byte;
+  memcpy(pmem_fresh_page, nemu->fresh_page, pmem_size >> PAGE_SHIFT);
+#endif
+  dcache_flush();
+  // the deadlines were set for the instruction count of another instance
+  event_reset();
+  event_check_intr();
+}
+
+// called with `lock' held
+static void switch_to(NEMUInstance *nemu) {
+  if (current == nemu) return;
+  if (current != NULL) save(current);
+  if (nemu != NULL) load(nemu);
+  current = nemu;
+}
+
+__EXPORT NEMUInstance* nemu_create() {
+  void init_mem(bool fill_random);
+  NEMUInstance *nemu = calloc(1, sizeof(*nemu));
+  assert(nemu);
+  pthread_mutex_lock(&lock);
+  switch_to(NULL);
+  init_mem(true);
+  init_isa();
+  nemu_state = (NEMUState) { .state = NEMU_STOP };
+  g_nr_guest_inst = 0;
+  g_timer = 0;
+  dcache_flush();
+  event_reset();
+  current = nemu;
+  pthread_mutex_unlock(&lock);
+  return nemu;
+}
+
+__EXPORT long nemu_load(NEMUInstance *nemu, const char *img_file) {
+  pthread_mutex_lock(&lock);
+  switch_to(nemu);
+  long size = pmem_map_img(img_file);
+  dcache_flush();
+  pthread_mutex_unlock(&lock);
+  return size;
+}
+
+__EXPORT bool nemu_run(NEMUInstance *nemu, uint64_t n) {
+  pthread_mutex_lock(&lock);
+  switch_to(nemu);
+  if (!ended(&nemu_state)) cpu_exec(n);
+  bool running = !ended(&nemu_state);
+  pthread_mutex_unlock(&lock);
+  return running;
+}
+
+__EXPORT void nemu_stat(NEMUInstance *nemu, NEMUStat *stat) {
+  pthread_mutex_lock(&lock);
+  bool cur = (nemu == current);
+  NEMUState *s = (cur ? &nemu_state : &nemu->state);
+  stat->nr_inst = (cur ? g_nr_guest_inst : nemu->nr_inst);
+  stat->time_us = (cur ? g_timer : nemu->time_us);
+  stat->ended = ended(s);
+  stat->good_trap = (s->state == NEMU_END && s->halt_ret == 0);
+  stat->halt_ret = s->halt_ret;
+  pthread_mutex_unlock(&lock);
+}
+
+__EXPORT void nemu_destroy(NEMUInstance *nemu) {
+  pthread_mutex_lock(&lock);
+  if (nemu == current) {
+    nemu->pmem = pmem_switch(NULL);
+    current = NULL;
+  }
+  munmap(nemu->pmem, pmem_size);
+  pthread_mutex_unlock(&lock);
+  free(nemu);
+}
+#endif
@@ -0,0 +1,167 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <isa.h>
+#include <cpu/record.h>
+
+bool record_on = false;
+bool record_replaying = false;
+
+#ifdef CONFIG_TARGET_NATIVE_ELF
+
+/* The file starts with the magic and the random seed, followed by
+ * entries of two LEB128 numbers: the instructions executed since the
+ * last entry shifted left by 2 with the type in the low bits, and the
+ * value. An END entry is written when NEMU exits or panics.
+ */
+#define RECORD_MAGIC "NEMUREC1"
+#define RECORD_BUF_SIZE (1 << 20)
+
+enum { REC_READ, REC_INTR, REC_END };
+
+extern HART_LOCAL uint64_t g_nr_guest_inst;
+
+static FILE *rec_fp = NULL;
+static uint64_t rec_last = 0;
+
+// the reads and the interrupts are replayed with their own position in the file
+typedef struct {
+  FILE *fp;
+  int types;        // a bit for each type of entries to replay
+  bool valid;
+  int type;
+  uint64_t nr_inst; // of the current entry
+  uint64_t val;
+} Reader;
+
+static Reader read_rd = { .types = 1 << REC_READ };
+static Reader intr_rd = { .types = (1 << REC_INTR) | (1 << REC_END) };
+
+static void put_num(uint64_t v) {
+  while (v >= 0x80) {
+    putc((v & 0x7f) | 0x80, rec_fp);
+    v >>= 7;
+  }
+  putc(v, rec_fp);
+}
+
+static bool get_num(FILE *fp, uint64_t *v) {
+  *v = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    int c = getc(fp);
+    if (c == EOF) return false;
+    *v |= (uint64_t)(c & 0x7f) << shift;
+    if (!(c & 0x80)) return true;
+  }
+  return false;
+}
+
+static void put_entry(int type, uint64_t val) {
+  Assert(g_nr_guest_inst >= rec_last, "can not record after going back");
+  put_num(((g_nr_guest_inst - rec_last) << 2) | type);
+  put_num(val);
+  rec_last = g_nr_guest_inst;
+}
+
+// move to the next entry of the types of `r'
+static void reader_next(Reader *r) {
+  uint64_t head, val;
+  while (get_num(r->fp, &head) && get_num(r->fp, &val)) {
+    r->nr_inst += head >> 2;
+    int type = head & 0x3;
+    if (r->types & (1 << type)) {
+      r->type = type;
+      r->val = val;
+      r->valid = true;
+      return;
+    }
+  }
+  r->valid = false;
+}
+
+static unsigned reader_open(Reader *r, const char *file) {
+  r->fp = fopen(file, "rb");
+  Assert(r->fp, "Can not open '%s'", file);
+  setvbuf(r->fp, NULL, _IOFBF, RECORD_BUF_SIZE);
+  char magic[sizeof(RECORD_MAGIC) - 1];
+  uint64_t seed;
+  Assert(fread(magic, sizeof(magic), 1, r->fp) == 1 &&
+      memcmp(magic, RECORD_MAGIC, sizeof(magic)) == 0 && get_num(r->fp, &seed),
+      "'%s' is not a recording of NEMU", file);
+  reader_next(r);
+  return seed;
+}
+
+void record_flush() {
+  if (rec_fp == NULL) return;
+  record_on = false;
+  // no END entry after going back, which is the panic of put_entry()
+  if (g_nr_guest_inst >= rec_last) put_entry(REC_END, 0);
+  fclose(rec_fp);
+  rec_fp = NULL;
+}
+
+void record_read(word_t val) {
+  put_entry(REC_READ, val);
+}
+
+word_t record_replay_read() {
+  Assert(read_rd.valid, "the device reads to replay are used up at pc = " FMT_WORD, cpu.pc);
+  word_t val = read_rd.val;
+  reader_next(&read_rd);
+  return val;
+}
+
+void record_intr(word_t intr) {
+  put_entry(REC_INTR, intr);
+}
+
+uint64_t record_next_intr(word_t *intr) {
+  if (!intr_rd.valid) return UINT64_MAX;
+  *intr = (intr_rd.type == REC_END ? INTR_EMPTY : intr_rd.val);
+  return intr_rd.nr_inst;
+}
+
+void record_pop_intr() {
+  reader_next(&intr_rd);
+}
+
+void init_record(const char *record_file, const char *replay_file) {
+  Assert(record_file == NULL || replay_file == NULL, "--record and --replay can not be used together");
+#ifdef CONFIG_HAS_MPE
+  // the harts run in any order on their own threads
+  Assert(record_file == NULL && replay_file == NULL, "--record and --replay do not support multiple harts");
+#endif
+  if (record_file != NULL) {
+    rec_fp = fopen(record_file, "wb");
+    Assert(rec_fp, "Can not open '%s'", record_file);
+    setvbuf(rec_fp, NULL, _IOFBF, RECORD_BUF_SIZE);
+    // the replay should see the same random memory
+    unsigned seed = rand();
+    srand(seed);
+    fwrite(RECORD_MAGIC, sizeof(RECORD_MAGIC) - 1, 1, rec_fp);
+    put_num(seed);
+    atexit(record_flush);
+    record_on = true;
+    Log("Record the device input to %s", record_file);
+  }
+  if (replay_file != NULL) {
+    srand(reader_open(&read_rd, replay_file));
+    reader_open(&intr_rd, replay_file);
+    record_replaying = true;
+    Log("Replay the device input from %s", replay_file);
+  }
+}
+#endif
@@ -0,0 +1,427 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <isa.h>
+#include <cpu/cpu.h>
+#include <cpu/dcache.h>
+#include <cpu/event.h>
+#include <cpu/snapshot.h>
+#include <memory/paddr.h>
+#include "../monitor/sdb/sdb.h"
+
+#define MAX_STATE 32
+
+static struct { void *p; size_t size; } state[MAX_STATE] = {};
+static int nr_state = 0;
+static size_t state_size = 0;
+
+extern HART_LOCAL uint64_t g_nr_guest_inst;
+
+void snapshot_add_state(void *p, size_t size) {
+  assert(nr_state < MAX_STATE);
+  state[nr_state].p = p;
+  state[nr_state].size = size;
+  nr_state ++;
+  state_size += size;
+}
+
+static void save_state(uint8_t *p) {
+  for (int i = 0; i < nr_state; i ++) {
+    memcpy(p, state[i].p, state[i].size);
+    p += state[i].size;
+  }
+}
+
+static void load_state(const uint8_t *p) {
+  for (int i = 0; i < nr_state; i ++) {
+    memcpy(state[i].p, p, state[i].size);
+    p += state[i].size;
+  }
+}
+
+#ifndef CONFIG_TARGET_AM
+#include <fcntl.h>
+#include <unistd.h>
+
+#define SNAPSHOT_VERSION 2
+
+/* Layout of a snapshot file: the header, the CPU, the device states,
+ * the fresh page flags of MEM_RANDOM, then pmem from `pmem_offset',
+ * which is page aligned so that it can be mapped directly. Pages of
+ * zeros and fresh pages are not written, they are holes.
+ */
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  char isa[16];
+  uint64_t mbase, msize;
+  uint64_t cpu_size, state_size;
+  uint64_t nr_inst;
+  uint64_t fresh_size; // 0 without MEM_RANDOM
+  uint8_t fill_byte;
+  uint64_t pmem_offset;
+} SnapshotHeader;
+
+static void init_header(SnapshotHeader *h) {
+  memset(h, 0, sizeof(*h));
+  memcpy(h->magic, "NEMUSNAP", 8);
+  h->version = SNAPSHOT_VERSION;
+  strncpy(h->isa, str(__GUEST_ISA__), sizeof(h->isa) - 1);
+  h->mbase = CONFIG_MBASE;
+  h->msize = pmem_size;
+  h->cpu_size = sizeof(CPU_state);
+  h->state_size = state_size;
+  h->fresh_size = MUXDEF(CONFIG_MEM_RANDOM, pmem_size >> PAGE_SHIFT, 0);
+  h->pmem_offset = ROUNDUP(sizeof(*h) + sizeof(CPU_state) + state_size + h->fresh_size, PAGE_SIZE);
+}
+
+static void write_all(int fd, const void *buf, size_t size, off_t offset) {
+  Assert(pwrite(fd, buf, size, offset) == size, "fail to write the snapshot file");
+}
+
+static void read_all(int fd, void *buf, size_t size, off_t offset) {
+  Assert(pread(fd, buf, size, offset) == size, "the snapshot file is truncated");
+}
+
+void snapshot_save_file(const char *file) {
+  int fd = open(file, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  Assert(fd >= 0, "Can not open '%s'", file);
+
+  SnapshotHeader h;
+  init_header(&h);
+  h.nr_inst = g_nr_guest_inst;
+  IFDEF(CONFIG_MEM_RANDOM, h.fill_byte = pmem_fill_byte);
+  uint8_t *dev = malloc(state_size);
+  assert(dev);
+  save_state(dev);
+  write_all(fd, &h, sizeof(h), 0);
+  write_all(fd, &cpu, sizeof(cpu), sizeof(h));
+  write_all(fd, dev, state_size, sizeof(h) + sizeof(cpu));
+  free(dev);
+  IFDEF(CONFIG_MEM_RANDOM, write_all(fd, pmem_fresh_page, h.fresh_size,
+      sizeof(h) + sizeof(cpu) + state_size));
+
+  static const uint8_t zero[PAGE_SIZE] = {};
+  uint8_t *pmem = guest_to_host(CONFIG_MBASE);
+  uint64_t nr_page = 0;
+  for (uint64_t off = 0; off < pmem_size; off += PAGE_SIZE) {
+    IFDEF(CONFIG_MEM_RANDOM, if (pmem_fresh_page[off >> PAGE_SHIFT]) continue);
+    if (memcmp(pmem + off, zero, PAGE_SIZE) == 0) continue;
+    write_all(fd, pmem + off, PAGE_SIZE, h.pmem_offset + off);
+    nr_page ++;
+  }
+  Assert(ftruncate(fd, h.pmem_offset + pmem_size) == 0, "fail to write the snapshot file");
+  close(fd);
+  Log("Snapshot is saved to %s, %" PRIu64 " instructions executed, %" PRIu64 " non-zero pages",
+      file, g_nr_guest_inst, nr_page);
+}
+
+void snapshot_load_file(const char *file) {
+  int fd = open(file, O_RDONLY);
+  Assert(fd >= 0, "Can not open '%s'", file);
+
+  SnapshotHeader h, expect;
+  init_header(&expect);
+  read_all(fd, &h, sizeof(h), 0);
+  Assert(memcmp(h.magic, expect.magic, 8) == 0 && h.version == expect.version,
+      "'%s' is not a snapshot file of this version", file);
+  Assert(strcmp(h.isa, expect.isa) == 0 && h.mbase == expect.mbase && h.msize == expect.msize &&
+      h.cpu_size == expect.cpu_size && h.state_size == expect.state_size &&
+      h.fresh_size == expect.fresh_size,
+      "the snapshot '%s' is taken by a NEMU with another configuration", file);
+
+  uint8_t *dev = malloc(state_size);
+  assert(dev);
+  read_all(fd, &cpu, sizeof(cpu), sizeof(h));
+  read_all(fd, dev, state_size, sizeof(h) + sizeof(cpu));
+  load_state(dev);
+  free(dev);
+#ifdef CONFIG_MEM_RANDOM
+  // the fresh pages are holes in the file, fill them on the first access
+  // again as the run taking the snapshot would do
+  read_all(fd, pmem_fresh_page, h.fresh_size, sizeof(h) + sizeof(cpu) + state_size);
+  pmem_fill_byte = h.fill_byte;
+#endif
+  g_nr_guest_inst = h.nr_inst;
+  pmem_map_file(fd, h.pmem_offset);
+  close(fd);
+
+  dcache_flush();
+  event_reset();
+  Log("Snapshot %s is loaded, %" PRIu64 " instructions executed, pc = " FMT_WORD,
+      file, g_nr_guest_inst, cpu.pc);
+}
+#endif
+
+#ifdef CONFIG_SNAPSHOT
+
+// drop the oldest checkpoints when the saved pages take more than this
+#define MAX_PAGE_BYTES (512ull * 1024 * 1024)
+#define NO_HIT UINT64_MAX
+
+typedef struct {
+  uint32_t idx;  // page number in pmem
+  uint8_t *data; // the page before its first write after the checkpoint
+} SavedPage;
+
+typedef struct {
+  uint64_t nr_inst;
+  CPU_state cpu;
+  NEMUState state;
+  uint8_t *dev;
+  SavedPage *page;
+  int nr_page, max_page;
+  uint64_t read_pos, intr_pos;
+} Checkpoint;
+
+// entries are numbered from the start of the execution, `first' is the
+// number of e[0], entries before the oldest checkpoint are dropped
+typedef struct {
+  struct { uint64_t nr_inst; word_t val; } *e;
+  uint64_t first, end, cap;
+  uint64_t pos; // the next entry to replay
+} ReplayLog;
+
+bool snapshot_on = false;
+bool snapshot_replaying = false;
+uint8_t snapshot_cow_page[CONFIG_MSIZE >> PAGE_SHIFT] = {};
+
+static Checkpoint ckpt[CONFIG_SNAPSHOT_NUM] = {};
+static int ckpt_first = 0, nr_ckpt = 0;
+static uint64_t page_bytes = 0;
+static ReplayLog read_log = {}, intr_log = {};
+static int event_id = -1;
+
+void cpu_exec_replay(uint64_t n);
+
+static inline Checkpoint* ck(int i) {
+  return &ckpt[(ckpt_first + i) % CONFIG_SNAPSHOT_NUM];
+}
+
+static void log_push(ReplayLog *log, word_t val) {
+  if (log->end - log->first == log->cap) {
+    log->cap = (log->cap == 0 ? 1024 : log->cap * 2);
+    log->e = realloc(log->e, log->cap * sizeof(log->e[0]));
+    assert(log->e);
+  }
+  log->e[log->end - log->first].nr_inst = g_nr_guest_inst;
+  log->e[log->end - log->first].val = val;
+  log->end ++;
+  log->pos = log->end;
+}
+
+static void log_drop_before(ReplayLog *log, uint64_t first) {
+  memmove(log->e, log->e + (first - log->first), (log->end - first) * sizeof(log->e[0]));
+  log->first = first;
+}
+
+static void free_pages(Checkpoint *c) {
+  for (int i = 0; i < c->nr_page; i ++) free(c->page[i].data);
+  page_bytes -= (uint64_t)c->nr_page * PAGE_SIZE;
+  c->nr_page = 0;
+}
+
+static void drop_oldest() {
+  Checkpoint *c = ck(0);
+  free_pages(c);
+  ckpt_first = (ckpt_first + 1) % CONFIG_SNAPSHOT_NUM;
+  nr_ckpt --;
+  log_drop_before(&read_log, ck(0)->read_pos);
+  log_drop_before(&intr_log, ck(0)->intr_pos);
+}
+
+static void save_one_page(uint32_t idx) {
+  Checkpoint *c = ck(nr_ckpt - 1);
+  if (c->nr_page == c->max_page) {
+    c->max_page = (c->max_page == 0 ? 64 : c->max_page * 2);
+    c->page = realloc(c->page, c->max_page * sizeof(c->page[0]));
+    assert(c->page);
+  }
+  uint8_t *data = malloc(PAGE_SIZE);
+  assert(data);
+  memcpy(data, guest_to_host(CONFIG_MBASE + ((paddr_t)idx << PAGE_SHIFT)), PAGE_SIZE);
+  c->page[c->nr_page ++] = (SavedPage){ .idx = idx, .data = data };
+  page_bytes += PAGE_SIZE;
+  snapshot_cow_page[idx] = 0;
+}
+
+void snapshot_save_page(paddr_t addr, int len) {
+  uint32_t idx0 = pmem_page(addr);
+  uint32_t idx1 = pmem_last_page(addr, len);
+  if (snapshot_cow_page[idx0]) save_one_page(idx0);
+  if (snapshot_cow_page[idx1]) save_one_page(idx1);
+}
+
+// start a new epoch, pages are copied again before their first write
+static void reset_cow() {
+  memset(snapshot_cow_page, 1, sizeof(snapshot_cow_page));
+  tlb_flush_write();
+}
+
+static void take_checkpoint() {
+  if (nr_ckpt == CONFIG_SNAPSHOT_NUM) drop_oldest();
+  while (nr_ckpt > 1 && page_bytes > MAX_PAGE_BYTES) drop_oldest();
+
+  Checkpoint *c = ck(nr_ckpt ++);
+  c->nr_inst = g_nr_guest_inst;
+  c->cpu = cpu;
+  c->state = nemu_state;
+  c->read_pos = read_log.end;
+  c->intr_pos = intr_log.end;
+  if (c->dev == NULL) { c->dev = malloc(state_size); assert(c->dev); }
+  save_state(c->dev);
+  reset_cow();
+
+  event_schedule(event_id, CONFIG_SNAPSHOT_INTERVAL);
+}
+
+// bring the machine back to checkpoint `i', later checkpoints are dropped
+static void restore(int i) {
+  for (int j = nr_ckpt - 1; j >= i; j --) {
+    Checkpoint *c = ck(j);
+    // the oldest copy of a page is the one at checkpoint `i'
+    for (int k = c->nr_page - 1; k >= 0; k --) {
+      memcpy(guest_to_host(CONFIG_MBASE + ((paddr_t)c->page[k].idx << PAGE_SHIFT)),
+          c->page[k].data, PAGE_SIZE);
+    }
+    free_pages(c);
+  }
+  nr_ckpt = i + 1;
+
+  Checkpoint *c = ck(i);
+  g_nr_guest_inst = c->nr_inst;
+  cpu = c->cpu;
+  nemu_state = c->state;
+  load_state(c->dev);
+  read_log.pos = c->read_pos;
+  intr_log.pos = c->intr_pos;
+  reset_cow();
+  tlb_flush();
+  dcache_flush();
+}
+
+/* Run until `g_nr_guest_inst' reaches `target' with the devices held
+ * back, and the recorded interrupts taken at the same instruction counts.
+ * Return the last instruction count before `limit' where a watchpoint
+ * stops the execution, or NO_HIT.
+ */
+static uint64_t replay(uint64_t target, uint64_t limit) {
+  uint64_t hit = NO_HIT;
+  snapshot_replaying = true;
+  event_deadline = UINT64_MAX;
+  while (true) {
+    for (; intr_log.pos < intr_log.end; intr_log.pos ++) {
+      uint64_t nr_inst = intr_log.e[intr_log.pos - intr_log.first].nr_inst;
+      if (nr_inst != g_nr_guest_inst) break;
+      cpu.pc = isa_raise_intr(intr_log.e[intr_log.pos - intr_log.first].val, cpu.pc);
+    }
+    if (g_nr_guest_inst >= target) break;
+
+    uint64_t stop = target;
+    if (intr_log.pos < intr_log.end) {
+      uint64_t nr_inst = intr_log.e[intr_log.pos - intr_log.first].nr_inst;
+      if (nr_inst < stop) stop = nr_inst;
+    }
+    cpu_exec_replay(stop - g_nr_guest_inst);
+    if (nemu_state.state == NEMU_STOP && g_nr_guest_inst < limit) hit = g_nr_guest_inst;
+    else if (nemu_state.state != NEMU_RUNNING && nemu_state.state != NEMU_STOP) break;
+  }
+  return hit;
+}
+
+// go live again from the current position
+static void finish() {
+  snapshot_replaying = false;
+  // what was recorded after this point is another future now
+  read_log.end = read_log.pos;
+  intr_log.end = intr_log.pos;
+  if (nemu_state.state == NEMU_RUNNING) nemu_state.state = NEMU_STOP;
+  watchpoint_reset();
+  event_reset();
+  printf("Now at pc = " FMT_WORD ", %" PRIu64 " instructions executed\n",
+      cpu.pc, g_nr_guest_inst);
+}
+
+void snapshot_step_back(uint64_t n) {
+  if (!snapshot_on || nr_ckpt == 0) { printf("No checkpoint is taken\n"); return; }
+  uint64_t now = g_nr_guest_inst;
+  uint64_t target = (n > now ? 0 : now - n);
+  int i = nr_ckpt - 1;
+  while (i > 0 && ck(i)->nr_inst > target) i --;
+  if (ck(i)->nr_inst > target) {
+    printf("Can not go back further than the oldest checkpoint\n");
+    target = ck(i)->nr_inst;
+  }
+  restore(i);
+  watchpoint_set_quiet(true);
+  replay(target, target);
+  watchpoint_set_quiet(false);
+  finish();
+}
+
+void snapshot_reverse_continue() {
+  if (!snapshot_on || nr_ckpt == 0) { printf("No checkpoint is taken\n"); return; }
+  uint64_t now = g_nr_guest_inst;
+  int i = nr_ckpt - 1;
+  while (i > 0 && ck(i)->nr_inst >= now) i --;
+  uint64_t end = now;
+  for (; i >= 0; i --) {
+    // look for the last watchpoint hit between checkpoint `i' and `end'
+    uint64_t next_end = ck(i)->nr_inst;
+    restore(i);
+    watchpoint_reset();
+    watchpoint_set_quiet(true);
+    uint64_t hit = (end > next_end ? replay(end, now) : NO_HIT);
+    watchpoint_set_quiet(false);
+    if (hit != NO_HIT) {
+      restore(i);
+      watchpoint_reset();
+      watchpoint_set_quiet(true);
+      replay(hit, hit);
+      watchpoint_set_quiet(false);
+      printf("Watchpoint hit, going back to the last change\n");
+      finish();
+      return;
+    }
+    end = next_end;
+    if (i == 0) break;
+  }
+  printf("No watchpoint hit is found, going back to the oldest checkpoint\n");
+  restore(0);
+  finish();
+}
+
+void snapshot_record_read(word_t val) {
+  if (snapshot_on && !snapshot_replaying) log_push(&read_log, val);
+}
+
+word_t snapshot_replay_read() {
+  Assert(read_log.pos < read_log.end, "the device reads to replay are used up");
+  return read_log.e[read_log.pos ++ - read_log.first].val;
+}
+
+void snapshot_record_intr(word_t intr) {
+  if (snapshot_on && !snapshot_replaying) log_push(&intr_log, intr);
+}
+
+void snapshot_start() {
+  snapshot_on = true;
+  event_id = event_add("snapshot", take_checkpoint);
+  take_checkpoint();
+  Log("Checkpoint every %d instructions, %d checkpoints are kept",
+      CONFIG_SNAPSHOT_INTERVAL, CONFIG_SNAPSHOT_NUM);
+}
+
+#endif
@@ -15,8 +15,7 @@
 
 #include <common.h>
 #include <device/alarm.h>
-#include <sys/time.h>
-#include <signal.h>
+#include <cpu/event.h>
 
 #define MAX_HANDLER 8
 
@@ -28,7 +27,7 @@ void add_alarm_handle(alarm_handler_t h) {
   handler[idx ++] = h;
 }
 
-static void alarm_sig_handler(int signum) {
+static void alarm_handler() {
   int i;
   for (i = 0; i < idx; i ++) {
     handler[i]();
@@ -36,16 +35,6 @@ static void alarm_sig_handler(int signum) {
 }
 
 void init_alarm() {
-  struct sigaction s;
-  memset(&s, 0, sizeof(s));
-  s.sa_handler = alarm_sig_handler;
-  int ret = sigaction(SIGVTALRM, &s, NULL);
-  Assert(ret == 0, "Can not set signal handler");
-
-  struct itimerval it = {};
-  it.it_value.tv_sec = 0;
-  it.it_value.tv_usec = 1000000 / TIMER_HZ;
-  it.it_interval = it.it_value;
-  ret = setitimer(ITIMER_VIRTUAL, &it, NULL);
-  Assert(ret == 0, "Can not set timer");
+  // the handlers are run between two instructions
+  event_add_periodic("alarm", alarm_handler, 1000000 / TIMER_HZ);
 }
@@ -141,4 +141,6 @@ void init_audio() {
   add_mmio_map("audio-sbuf", CONFIG_SB_ADDR, sbuf, CONFIG_SB_SIZE, NULL);
   audio_base[reg_sbuf_size] = CONFIG_SB_SIZE;
   audio_base[reg_count] = 0;
+  snapshot_add_state(&sbuf_rpos, sizeof(sbuf_rpos));
+  snapshot_add_state(&sbuf_wpos, sizeof(sbuf_wpos));
 }
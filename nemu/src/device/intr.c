@@ -14,6 +14,15 @@
 ***************************************************************************************/
 
 #include <isa.h>
+#include <cpu/event.h>
+#include <cpu/mpe.h>
 
 void dev_raise_intr() {
+#ifdef CONFIG_HAS_MPE
+  // every hart has its own line and takes the interrupt with its own flags
+  mpe_raise_intr();
+#else
+  cpu.INTR = true;
+  event_check_intr();
+#endif
 }
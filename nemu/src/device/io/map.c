@@ -17,6 +17,8 @@
 #include <memory/host.h>
 #include <memory/vaddr.h>
 #include <device/map.h>
+#include <cpu/record.h>
+#include <cpu/mpe.h>
 
 #define IO_SPACE_MAX (32 * 1024 * 1024)
 
@@ -29,6 +31,7 @@ uint8_t* new_space(int size) {
   size = (size + (PAGE_SIZE - 1)) & ~PAGE_MASK;//把 size 向上取整到 PAGE_SIZE 的整数倍
   p_space += size;
   assert(p_space - io_space < IO_SPACE_MAX);
+  snapshot_add_state(p, size);
   return p;
 }
 
@@ -46,6 +49,15 @@ static void invoke_callback(io_callback_t c, paddr_t offset, int len, bool is_wr
   if (c != NULL) { c(offset, len, is_write); }
 }
 
+#ifdef CONFIG_HAS_MPE
+#include <pthread.h>
+// the devices and their callbacks are not thread-safe
+static pthread_mutex_t device_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+void device_lock() { pthread_mutex_lock(&device_mutex); }
+void device_unlock() { pthread_mutex_unlock(&device_mutex); }
+#endif
+
 void init_map() {
   io_space = malloc(IO_SPACE_MAX);
   assert(io_space);
@@ -56,8 +68,25 @@ word_t map_read(paddr_t addr, int len, IOMap *map) {
   assert(len >= 1 && len <= 8);
   check_bound(map, addr);
   paddr_t offset = addr - map->low;
+#ifdef CONFIG_SNAPSHOT
+  // the device is not run when replaying, the value read before is used
+  if (map->callback != NULL && snapshot_replaying) return snapshot_replay_read();
+#endif
+#ifdef CONFIG_TARGET_NATIVE_ELF
+  if (map->callback != NULL && unlikely(record_replaying)) return record_replay_read();
+#endif
+#if defined(CONFIG_DIFFTEST) && !defined(CONFIG_DIFFTEST_PIPELINE)
+  if (map->callback != NULL && unlikely(difftest_dev_replaying)) return difftest_replay_read();
+#endif
+  IFDEF(CONFIG_HAS_MPE, device_lock());
   invoke_callback(map->callback, offset, len, false); // prepare data to read
   word_t ret = host_read(map->space + offset, len);
+  IFDEF(CONFIG_HAS_MPE, device_unlock());
+#if defined(CONFIG_DIFFTEST) && !defined(CONFIG_DIFFTEST_PIPELINE)
+  if (map->callback != NULL) difftest_record_read(ret);
+#endif
+  IFDEF(CONFIG_SNAPSHOT, if (map->callback != NULL) snapshot_record_read(ret));
+  IFDEF(CONFIG_TARGET_NATIVE_ELF, if (map->callback != NULL && unlikely(record_on)) record_read(ret));
   return ret;
 }
 
@@ -65,6 +94,19 @@ void map_write(paddr_t addr, int len, word_t data, IOMap *map) {
   assert(len >= 1 && len <= 8);
   check_bound(map, addr);
   paddr_t offset = addr - map->low;
+#ifdef CONFIG_HAS_MPE
+  // a hart never replays, see the Kconfig of HAS_MPE and init_record()
+  device_lock();
+  host_write(map->space + offset, len, data);
+  invoke_callback(map->callback, offset, len, true);
+  device_unlock();
+  return;
+#endif
   host_write(map->space + offset, len, data);
+  IFDEF(CONFIG_SNAPSHOT, if (snapshot_replaying) return);
+  IFDEF(CONFIG_TARGET_NATIVE_ELF, if (unlikely(record_replaying)) return);
+#if defined(CONFIG_DIFFTEST) && !defined(CONFIG_DIFFTEST_PIPELINE)
+  if (unlikely(difftest_dev_replaying)) return;
+#endif
   invoke_callback(map->callback, offset, len, true);
 }
@@ -14,16 +14,33 @@
 ***************************************************************************************/
 
 #include <device/map.h>
+#include <device/mmio.h>
+#include <memory/host.h>
 #include <memory/paddr.h>
+#include <memory/vaddr.h>
 
 #define NR_MAP 16
+#define NR_PAGE (1ull << (32 - PAGE_SHIFT))
+#define PAGE_SHARED 0xff
 
 static IOMap maps[NR_MAP] = {};
 static int nr_map = 0;
+// index + 1 of the map covering each page of the 32-bit address space,
+// 0 for none, PAGE_SHARED if several maps share the page
+static uint8_t page_map[NR_PAGE] = {};
 
 static IOMap* fetch_mmio_map(paddr_t addr) {
-  int mapid = find_mapid_by_addr(maps, nr_map, addr);
-  return (mapid == -1 ? NULL : &maps[mapid]);
+  uint64_t page = (uint64_t)addr >> PAGE_SHIFT;
+  int id = (page < NR_PAGE ? page_map[page] : 0);
+  if (unlikely(id == PAGE_SHARED)) {
+    int mapid = find_mapid_by_addr(maps, nr_map, addr);
+    return (mapid == -1 ? NULL : &maps[mapid]);
+  }
+  if (id == 0) return NULL;
+  IOMap *map = &maps[id - 1];
+  if (!map_inside(map, addr)) return NULL;
+  difftest_skip_ref();
+  return map;
 }
 
 static void report_mmio_overlap(const char *name1, paddr_t l1, paddr_t r1,
@@ -45,6 +62,11 @@ void add_mmio_map(const char *name, paddr_t addr, void *space, uint32_t len, io_
     }
   }
 
+  assert((uint64_t)right < (NR_PAGE << PAGE_SHIFT));
+  for (uint64_t p = left >> PAGE_SHIFT; p <= right >> PAGE_SHIFT; p ++) {
+    page_map[p] = (page_map[p] == 0 ? nr_map + 1 : PAGE_SHARED);
+  }
+
   maps[nr_map] = (IOMap){ .name = name, .low = addr, .high = addr + len - 1,
     .space = space, .callback = callback };
   Log("Add mmio map '%s' at [" FMT_PADDR ", " FMT_PADDR "]",
@@ -54,10 +76,35 @@ void add_mmio_map(const char *name, paddr_t addr, void *space, uint32_t len, io_
 }
 
 /* bus interface */
+// a region without callback is plain memory, access it directly
 word_t mmio_read(paddr_t addr, int len) {
-  return map_read(addr, len, fetch_mmio_map(addr));
+  IOMap *map = fetch_mmio_map(addr);
+  if (likely(map != NULL && map->callback == NULL)) {
+    return host_read((uint8_t *)map->space + (addr - map->low), len);
+  }
+  return map_read(addr, len, map);
 }
 
 void mmio_write(paddr_t addr, int len, word_t data) {
-  map_write(addr, len, data, fetch_mmio_map(addr));
+  IOMap *map = fetch_mmio_map(addr);
+  if (likely(map != NULL && map->callback == NULL)) {
+    host_write((uint8_t *)map->space + (addr - map->low), len, data);
+    return;
+  }
+  map_write(addr, len, data, map);
+}
+
+uint8_t* mmio_host_page(paddr_t addr) {
+#ifdef CONFIG_DIFFTEST
+  // every access to devices should be reported to the REF
+  return NULL;
+#else
+  uint64_t page = (uint64_t)addr >> PAGE_SHIFT;
+  int id = (page < NR_PAGE ? page_map[page] : 0);
+  if (id == 0 || id == PAGE_SHARED) return NULL;
+  IOMap *map = &maps[id - 1];
+  paddr_t base = addr & ~(paddr_t)PAGE_MASK;
+  if (map->callback != NULL || base < map->low || base + PAGE_MASK > map->high) return NULL;
+  return (uint8_t *)map->space + (addr - map->low);
+#endif
 }
@@ -20,11 +20,29 @@
 #define NR_MAP 16
 static IOMap maps[NR_MAP] = {};
 static int nr_map = 0;
+// index + 1 of the map covering each port, 0 for none
+static uint8_t port_map[PORT_IO_SPACE_MAX] = {};
+
+static IOMap* fetch_pio_map(ioaddr_t addr) {
+  assert(addr < PORT_IO_SPACE_MAX && port_map[addr] != 0);
+  difftest_skip_ref();
+  return &maps[port_map[addr] - 1];
+}
 
 /* device interface */
 void add_pio_map(const char *name, ioaddr_t addr, void *space, uint32_t len, io_callback_t callback) {
   assert(nr_map < NR_MAP);
   assert(addr + len <= PORT_IO_SPACE_MAX);
+  for (int i = 0; i < len; i ++) {
+    int id = port_map[addr + i];
+    if (id != 0) {
+      panic("port-io region %s@[" FMT_PADDR ", " FMT_PADDR "] is overlapped with %s@["
+          FMT_PADDR ", " FMT_PADDR "]", name, (paddr_t)addr, (paddr_t)(addr + len - 1),
+          maps[id - 1].name, maps[id - 1].low, maps[id - 1].high);
+    }
+    port_map[addr + i] = nr_map + 1;
+  }
+
   maps[nr_map] = (IOMap){ .name = name, .low = addr, .high = addr + len - 1,
     .space = space, .callback = callback };
   Log("Add port-io map '%s' at [" FMT_PADDR ", " FMT_PADDR "]",
@@ -36,14 +54,10 @@ void add_pio_map(const char *name, ioaddr_t addr, void *space, uint32_t len, io_
 /* CPU interface */
 uint32_t pio_read(ioaddr_t addr, int len) {
   assert(addr + len - 1 < PORT_IO_SPACE_MAX);
-  int mapid = find_mapid_by_addr(maps, nr_map, addr);
-  assert(mapid != -1);
-  return map_read(addr, len, &maps[mapid]);
+  return map_read(addr, len, fetch_pio_map(addr));
 }
 
 void pio_write(ioaddr_t addr, int len, uint32_t data) {
   assert(addr + len - 1 < PORT_IO_SPACE_MAX);
-  int mapid = find_mapid_by_addr(maps, nr_map, addr);
-  assert(mapid != -1);
-  map_write(addr, len, data, &maps[mapid]);
+  map_write(addr, len, data, fetch_pio_map(addr));
 }
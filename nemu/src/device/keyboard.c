@@ -97,4 +97,9 @@ void init_i8042() {
   add_mmio_map("keyboard", CONFIG_I8042_DATA_MMIO, i8042_data_port_base, 4, i8042_data_io_handler);
 #endif
   IFNDEF(CONFIG_TARGET_AM, init_keymap());
+#ifndef CONFIG_TARGET_AM
+  snapshot_add_state(key_queue, sizeof(key_queue));
+  snapshot_add_state(&key_f, sizeof(key_f));
+  snapshot_add_state(&key_r, sizeof(key_r));
+#endif
 }
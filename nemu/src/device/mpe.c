@@ -0,0 +1,156 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <isa.h>
+#include <cpu/mpe.h>
+#include <device/map.h>
+#include <memory/paddr.h>
+#include <memory/vaddr.h>
+#include <pthread.h>
+
+/* The hart controller. The guest reads its hart id and the number of
+ * harts, and starts another hart by writing its sp, pc and id. Each
+ * hart started gets a host thread running cpu_exec_hart(), which parks
+ * whenever hart 0 leaves cpu_exec(), e.g. at a breakpoint of sdb.
+ */
+
+enum { reg_id, reg_count, reg_sp, reg_pc, reg_start, nr_reg };
+
+static uint32_t *mpe_base = NULL;
+
+extern HART_LOCAL uint64_t g_nr_guest_inst;
+
+HartReq hart_req[CONFIG_NR_HART] = {};
+HART_LOCAL int hart_id = 0;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+// protected by `lock'
+static bool started[CONFIG_NR_HART] = { true };
+static CPU_state start_state[CONFIG_NR_HART];
+static uint64_t nr_inst[CONFIG_NR_HART] = {};
+static bool running = false; // hart 0 is in cpu_exec()
+static int nr_busy = 0;      // the other harts not parked
+
+static void request(int id, uint32_t req) {
+  atomic_fetch_or_explicit(&hart_req[id].req, req, memory_order_release);
+}
+
+// called with `lock' held
+static void park() {
+  nr_inst[hart_id] = g_nr_guest_inst;
+  nr_busy --;
+  pthread_cond_broadcast(&cond);
+  while (!running) pthread_cond_wait(&cond, &lock);
+  nr_busy ++;
+}
+
+static void* hart_main(void *arg) {
+  hart_id = (intptr_t)arg;
+  pthread_mutex_lock(&lock);
+  cpu = start_state[hart_id];
+  // the TLB of a new thread is all zero, which is a valid entry
+  tlb_flush();
+  park();
+  pthread_mutex_unlock(&lock);
+  cpu_exec_hart();
+  return NULL;
+}
+
+static void hart_start(int id) {
+  pthread_mutex_lock(&lock);
+  Assert(id > 0 && id < CONFIG_NR_HART, "invalid hart %d to start", id);
+  Assert(!started[id], "hart %d is already started", id);
+  // a new hart shares the system state with the one starting it
+  start_state[id] = cpu;
+  isa_hart_start(&start_state[id], mpe_base[reg_pc], mpe_base[reg_sp]);
+  // fill the fresh pages of MEM_RANDOM once, instead of on the first
+  // access of any hart
+  pmem_prepare(PMEM_LEFT, pmem_size);
+  started[id] = true;
+  nr_busy ++;
+  pthread_t thread;
+  Assert(pthread_create(&thread, NULL, hart_main, (void *)(intptr_t)id) == 0,
+      "fail to create the thread of hart %d", id);
+  pthread_detach(thread);
+  pthread_mutex_unlock(&lock);
+}
+
+void mpe_serve() {
+  uint32_t req;
+  // also serve the requests made while the hart is parked
+  while ((req = atomic_exchange_explicit(&hart_req[hart_id].req, 0, memory_order_acquire)) != 0) {
+    if (req & HART_REQ_INTR) cpu.INTR = true;
+    if (req & HART_REQ_TLB_FLUSH) tlb_flush();
+    if (req & HART_REQ_PAUSE) {
+      pthread_mutex_lock(&lock);
+      park();
+      pthread_mutex_unlock(&lock);
+    }
+  }
+}
+
+void mpe_resume() {
+  pthread_mutex_lock(&lock);
+  running = true;
+  pthread_cond_broadcast(&cond);
+  pthread_mutex_unlock(&lock);
+}
+
+void mpe_pause() {
+  pthread_mutex_lock(&lock);
+  running = false;
+  for (int i = 1; i < CONFIG_NR_HART; i ++) {
+    if (started[i]) request(i, HART_REQ_PAUSE);
+  }
+  while (nr_busy > 0) pthread_cond_wait(&cond, &lock);
+  pthread_mutex_unlock(&lock);
+}
+
+// also called by the timer in a signal handler, so it takes no lock
+void mpe_raise_intr() {
+  for (int i = 0; i < CONFIG_NR_HART; i ++) request(i, HART_REQ_INTR);
+}
+
+void mpe_tlb_flush() {
+  tlb_flush();
+  for (int i = 0; i < CONFIG_NR_HART; i ++) {
+    if (i != hart_id) request(i, HART_REQ_TLB_FLUSH);
+  }
+}
+
+uint64_t mpe_nr_inst() {
+  pthread_mutex_lock(&lock);
+  uint64_t n = 0;
+  for (int i = 1; i < CONFIG_NR_HART; i ++) n += nr_inst[i];
+  pthread_mutex_unlock(&lock);
+  return n;
+}
+
+static void mpe_io_handler(uint32_t offset, int len, bool is_write) {
+  assert(len == 4 && offset % 4 == 0);
+  if (!is_write && offset == reg_id * 4) mpe_base[reg_id] = hart_id;
+  if (is_write && offset == reg_start * 4) hart_start(mpe_base[reg_start]);
+}
+
+void init_mpe() {
+  mpe_base = (uint32_t *)new_space(sizeof(uint32_t) * nr_reg);
+  mpe_base[reg_count] = CONFIG_NR_HART;
+#ifdef CONFIG_HAS_PORT_IO
+  add_pio_map ("mpe", CONFIG_MPE_CTL_PORT, mpe_base, sizeof(uint32_t) * nr_reg, mpe_io_handler);
+#else
+  add_mmio_map("mpe", CONFIG_MPE_CTL_MMIO, mpe_base, sizeof(uint32_t) * nr_reg, mpe_io_handler);
+#endif
+}
@@ -125,6 +125,11 @@ static void sdcard_io_handler(uint32_t offset, int len, bool is_write) {
 void init_sdcard() {
   base = (uint32_t *)new_space(0x80);
   add_mmio_map("sdhci", CONFIG_SDCARD_CTL_MMIO, base, 0x80, sdcard_io_handler);
+  snapshot_add_state(&blkcnt, sizeof(blkcnt));
+  snapshot_add_state(&blk_addr, sizeof(blk_addr));
+  snapshot_add_state(&addr, sizeof(addr));
+  snapshot_add_state(&write_cmd, sizeof(write_cmd));
+  snapshot_add_state(&read_ext_csd, sizeof(read_ext_csd));
 
   Assert(C_SIZE < (1 << 12), "shoule be fit in 12 bits");
 
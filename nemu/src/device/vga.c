@@ -15,6 +15,7 @@
 
 #include <common.h>
 #include <device/map.h>
+#include <cpu/record.h>
 
 #define SCREEN_W (MUXDEF(CONFIG_VGA_SIZE_800x600, 800, 400))
 #define SCREEN_H (MUXDEF(CONFIG_VGA_SIZE_800x600, 600, 300))
@@ -56,8 +57,12 @@ static void init_screen() {
   SDL_RenderPresent(renderer);
 }
 
-static inline void update_screen() {
-  SDL_UpdateTexture(texture, NULL, vmem, SCREEN_W * sizeof(uint32_t));
+static void upload_rows(int y, int h) {
+  SDL_Rect rect = { .x = 0, .y = y, .w = SCREEN_W, .h = h };
+  SDL_UpdateTexture(texture, &rect, (uint32_t *)vmem + y * SCREEN_W, SCREEN_W * sizeof(uint32_t));
+}
+
+static void present() {
   SDL_RenderClear(renderer);
   SDL_RenderCopy(renderer, texture, NULL, NULL);
   SDL_RenderPresent(renderer);
@@ -65,10 +70,51 @@ static inline void update_screen() {
 #else
 static void init_screen() {}
 
-static inline void update_screen() {
-  io_write(AM_GPU_FBDRAW, 0, 0, vmem, screen_width(), screen_height(), true);
+static void upload_rows(int y, int h) {
+  io_write(AM_GPU_FBDRAW, 0, y, (uint32_t *)vmem + y * screen_width(), screen_width(), h, false);
+}
+
+static void present() {
+  io_write(AM_GPU_FBDRAW, 0, 0, NULL, 0, 0, true);
 }
 #endif
+
+/* Stores to vmem go directly to host memory (they may even hit the TLB),
+ * so the rows changed since the last update are found by comparing vmem
+ * with a copy of what was uploaded. This costs a few memcmp() per sync,
+ * much less than uploading and presenting the whole frame.
+ */
+static uint32_t *shown = NULL;
+static bool shown_valid = false;
+uint64_t vga_nr_present = 0, vga_nr_skip = 0, vga_upload_bytes = 0;
+
+static inline bool row_dirty(int y) {
+  size_t pitch = screen_width() * sizeof(uint32_t);
+  return memcmp((uint8_t *)vmem + y * pitch, (uint8_t *)shown + y * pitch, pitch) != 0;
+}
+
+static void update_screen() {
+  // no window to update when replaying the input, see init_vga()
+  if (record_replaying) return;
+  int w = screen_width(), h = screen_height();
+  bool updated = false;
+  int y = 0;
+  while (y < h) {
+    if (shown_valid && !row_dirty(y)) { y ++; continue; }
+    // upload a band of consecutive dirty rows
+    int y0 = y ++;
+    while (y < h && (!shown_valid || row_dirty(y))) y ++;
+    size_t off = y0 * w, nr = (y - y0) * w;
+    memcpy(shown + off, (uint32_t *)vmem + off, nr * sizeof(uint32_t));
+    upload_rows(y0, y - y0);
+    vga_upload_bytes += nr * sizeof(uint32_t);
+    updated = true;
+  }
+  shown_valid = true;
+
+  if (updated) { present(); vga_nr_present ++; }
+  else vga_nr_skip ++;
+}
 #endif
 
 void vga_update_screen() {
@@ -92,6 +138,8 @@ void init_vga() {
 
   vmem = new_space(screen_size());
   add_mmio_map("vmem", CONFIG_FB_ADDR, vmem, screen_size(), NULL);
-  IFDEF(CONFIG_VGA_SHOW_SCREEN, init_screen());
+  // no window when replaying the input
+  IFDEF(CONFIG_VGA_SHOW_SCREEN, if (!record_replaying) init_screen());
   IFDEF(CONFIG_VGA_SHOW_SCREEN, memset(vmem, 0, screen_size()));
+  IFDEF(CONFIG_VGA_SHOW_SCREEN, shown = malloc(screen_size()); assert(shown));
 }
@@ -0,0 +1,75 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __ENGINE_BLOCK_H__
+#define __ENGINE_BLOCK_H__
+
+#include <cpu/cpu.h>
+#include <cpu/decode.h>
+#include <cpu/dcache.h>
+
+#define MAX_BLOCK_OP 32
+
+/* A block is the sequence of instructions executed from `pc' until
+ * the first one changing the control flow. Each op refers to the decode
+ * cache entry of its instruction, so that a write to the guest code,
+ * which invalidates the entry, also makes the block stale. A conditional
+ * branch not taken when the block was built stays inside the block, it
+ * leaves the block early if it is taken later.
+ */
+typedef struct {
+  vaddr_t pc;
+  DCacheEntry *e;
+} BlockOp;
+
+typedef struct Block {
+  vaddr_t pc;
+  int nr_op;
+  bool valid;
+  // successors chained by their start pc, they are checked
+  // before going through `block_cache'
+  struct Block *next[2];
+#ifdef CONFIG_JIT
+  uint32_t nr_exec;
+  uint32_t code_gen; // `code' is only usable in the same generation
+  void *code;
+#endif
+  BlockOp op[MAX_BLOCK_OP];
+} Block;
+
+static inline bool op_valid(BlockOp *op) {
+  return op->e->handler != NULL && op->e->pc == op->pc;
+}
+
+// execute a valid op, return true if the control leaves the block
+static inline bool op_exec(BlockOp *op, Decode *s) {
+  DCacheEntry *e = op->e;
+  s->pc = op->pc;
+  s->snpc = e->snpc;
+  s->isa = e->isa;
+  isa_exec_cached(s, e->handler);
+  cpu.pc = s->dnpc;
+  return nemu_state.state != NEMU_RUNNING || s->dnpc != s->snpc;
+}
+
+// the valid block starting at `pc', NULL if there is none
+Block* block_find(vaddr_t pc);
+
+#ifdef CONFIG_JIT
+// return the number of instructions executed, -1 if the block is not translated
+int64_t jit_run(Block *b, uint64_t n);
+#endif
+
+#endif
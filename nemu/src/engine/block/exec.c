@@ -0,0 +1,142 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include "block.h"
+#include <cpu/event.h>
+#include <cpu/snapshot.h>
+#include <cpu/record.h>
+#include "../../monitor/sdb/sdb.h"
+
+#define NR_BLOCK 4096
+
+static Block block_cache[NR_BLOCK] = {};
+uint64_t block_nr_build = 0, block_nr_exec = 0, block_nr_chain = 0;
+
+extern HART_LOCAL uint64_t g_nr_guest_inst;
+
+static inline Block* block_slot(vaddr_t pc) {
+  return &block_cache[(pc ^ (pc >> 12)) & (NR_BLOCK - 1)];
+}
+
+Block* block_find(vaddr_t pc) {
+  Block *b = block_slot(pc);
+  return (b->valid && b->pc == pc) ? b : NULL;
+}
+
+// run instructions with the interpreter and record them in a new block
+static uint64_t block_build(Block *b, Decode *s, uint64_t n) {
+  b->pc = cpu.pc;
+  b->nr_op = 0;
+  b->valid = false;
+  b->next[0] = b->next[1] = NULL;
+  IFDEF(CONFIG_JIT, b->nr_exec = 0; b->code = NULL);
+  block_nr_build ++;
+
+  uint64_t i = 0;
+  while (i < n) {
+    s->pc = s->snpc = cpu.pc;
+    isa_exec_once(s);
+    cpu.pc = s->dnpc;
+    i ++;
+
+    BlockOp *op = &b->op[b->nr_op];
+    op->pc = s->pc;
+    op->e = dcache_slot(s->pc);
+    if (!op_valid(op)) break;
+    b->nr_op ++;
+
+    if (nemu_state.state != NEMU_RUNNING || s->dnpc != s->snpc ||
+        b->nr_op == MAX_BLOCK_OP || paddr_watch_hit) break;
+  }
+  b->valid = (b->nr_op > 0);
+  return i;
+}
+
+static uint64_t block_run(Block *b, Decode *s, uint64_t n) {
+#ifdef CONFIG_JIT
+  // stores in the translated code do not check the watched memory
+  if (n >= b->nr_op && !has_watchpoint()) {
+    int64_t nr_exec = jit_run(b, n);
+    if (nr_exec >= 0) return nr_exec;
+  }
+#endif
+  BlockOp *op = b->op, *end = b->op + (n < b->nr_op ? n : b->nr_op);
+  for (; op < end; op ++) {
+    if (unlikely(!op_valid(op))) {
+      // the code is modified, build the block again next time
+      b->valid = false;
+      break;
+    }
+    if (op_exec(op, s) || unlikely(paddr_watch_hit)) { op ++; break; }
+  }
+  return op - b->op;
+}
+
+static inline Block* block_next(Block *b) {
+  vaddr_t pc = cpu.pc;
+  if (b != NULL) {
+    for (int i = 0; i < 2; i ++) {
+      Block *next = b->next[i];
+      if (next != NULL && next->valid && next->pc == pc) {
+        block_nr_chain ++;
+        return next;
+      }
+    }
+  }
+
+  Block *next = block_slot(pc);
+  if (!next->valid || next->pc != pc) return NULL;
+  if (b != NULL) {
+    // the fall through successor goes to next[0],
+    // while a taken branch or a jump goes to next[1]
+    BlockOp *last = &b->op[b->nr_op - 1];
+    b->next[last->e->snpc == pc ? 0 : 1] = next;
+  }
+  return next;
+}
+
+void block_exec(uint64_t n) {
+  Decode s;
+  Block *b = NULL;
+  while (n > 0) {
+    uint64_t nr_exec;
+    Block *next = block_next(b);
+    if (next == NULL) {
+      next = block_slot(cpu.pc);
+      nr_exec = block_build(next, &s, n);
+    } else {
+      block_nr_exec ++;
+      nr_exec = block_run(next, &s, n);
+    }
+    b = (next->valid ? next : NULL);
+    g_nr_guest_inst += nr_exec;
+    n -= nr_exec;
+
+    if (unlikely(paddr_watch_hit) && scan_watchpoint() != NULL) {
+      nemu_state.state = NEMU_STOP;
+    }
+    if (nemu_state.state != NEMU_RUNNING) break;
+    if (unlikely(g_nr_guest_inst >= event_deadline)) {
+      event_run();
+      word_t intr = isa_query_intr();
+      if (intr != INTR_EMPTY) {
+        IFDEF(CONFIG_SNAPSHOT, snapshot_record_intr(intr));
+        IFDEF(CONFIG_TARGET_NATIVE_ELF, if (record_on) record_intr(intr));
+        cpu.pc = isa_raise_intr(intr, cpu.pc);
+        b = NULL;
+      }
+    }
+  }
+}
@@ -0,0 +1,1079 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include "block.h"
+#include "../../isa/x86/local-include/reg.h"
+#include <cpu/event.h>
+#include <cpu/snapshot.h>
+#include <memory/paddr.h>
+#include <memory/vaddr.h>
+#include <stddef.h>
+#include <sys/mman.h>
+
+#ifdef CONFIG_JIT
+
+#ifndef __x86_64__
+#error "the JIT only generates x86-64 code"
+#endif
+
+#define CODE_CACHE_SIZE (32 * 1024 * 1024)
+#define MAX_OP_CODE 768
+#define MAX_BLOCK_CODE (4096 + MAX_BLOCK_OP * (MAX_OP_CODE + sizeof(DCacheEntry)))
+#define JIT_THRESHOLD 16
+
+/* Hot blocks are translated into host code.
+ *
+ * Guest registers are kept in host registers within a block: a register
+ * is loaded from `cpu' when it is first used, and the modified ones are
+ * written back before leaving the block or calling C code. Arithmetic
+ * instructions producing the flags are translated with the host ones,
+ * which set the host flags as the guest does, so that a following jcc
+ * reads them directly. The lazy flags record in `cpu.lazy' is only
+ * written if something may read it before the next instruction
+ * overwriting it, see plan_block().
+ *
+ * Memory accesses go to pmem directly if the address is in pmem, the
+ * page has been filled with MEM_RANDOM and, for stores, the page holds
+ * no cached instruction and needs no copy for a checkpoint. Otherwise they call vaddr_read()/vaddr_write()
+ * in a slow path placed after the code of the block. The instructions
+ * not translated call the interpreter body through jit_exec_op().
+ *
+ * A block leaving to a known pc jumps directly to the code of the next
+ * block once it is translated. The chained execution stops when the
+ * budget in rbp, i.e. the instructions allowed to run before returning
+ * to block_exec(), gets lower than MAX_BLOCK_OP. Each block checks at
+ * its entry whether the guest code may have been modified since it was
+ * last compared with the copy kept in `JitCode'.
+ *
+ * Register usage in the generated code:
+ *   rbx: &cpu
+ *   rbp: the budget left
+ *   r12: host address of CONFIG_MBASE
+ *   r13: dcache_code_page
+ *   r8-r11, r14, r15, rsi, rdi: eax, ecx, edx, ebx, esp, ebp, esi, edi
+ *   rax, rcx, rdx: scratch
+ */
+
+enum { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+enum { CC_B = 0x2, CC_Z = 0x4, CC_NZ = 0x5, CC_A = 0x7, CC_L = 0xc };
+
+static const int home[8] = { R8, R9, R10, R11, R14, R15, RSI, RDI };
+// guest registers whose home is not preserved across a call
+#define CALLER_SAVED (~((1 << R_ESP) | (1 << R_EBP)) & 0xff)
+
+#define GPR(i)      (offsetof(CPU_state, gpr[i]._32))
+#define PC_OFF      (offsetof(CPU_state, pc))
+#define EFLAGS_OFF  (offsetof(CPU_state, eflags.val))
+#define LAZY_OFF(f) (offsetof(CPU_state, lazy.f))
+
+typedef struct {
+  uint64_t version; // `dcache_version' when `guest' was last compared with pmem
+  vaddr_t pc;
+  uint32_t len;
+  uint8_t *guest;   // copy of the guest code translated
+  uint8_t *entry;
+} JitCode;
+
+static uint8_t *code_cache = NULL, *code_ptr = NULL;
+static uint8_t *enter = NULL, *epilogue = NULL, *miss = NULL;
+static uint64_t *jit_version = NULL; // `dcache_version' of this run, read by the blocks
+static uint32_t code_gen = 1;
+static Decode s;
+uint64_t jit_nr_compile = 0, jit_nr_flush = 0, jit_nr_link = 0;
+
+// the rel32 field of the last exit which found no chained block, and the pc it leaves to
+static uint8_t *miss_site = NULL;
+static vaddr_t miss_pc = 0;
+static uint32_t miss_gen = 0;
+
+// instructions executed before this run, and the budget of this run
+static uint64_t jit_inst_base = 0;
+static int64_t jit_budget = 0;
+
+extern HART_LOCAL uint64_t g_nr_guest_inst;
+
+static inline void emit8(uint8_t x) { *code_ptr ++ = x; }
+static inline void emit32(uint32_t x) { memcpy(code_ptr, &x, 4); code_ptr += 4; }
+static inline void emit64(uint64_t x) { memcpy(code_ptr, &x, 8); code_ptr += 8; }
+
+// REX prefix and opcode, `op' above 0xff is a two-byte opcode starting with 0x0f,
+// `w' selects the 64-bit operand size, -1 for `index' or `base' means none
+static void emit_opcode(int w, int op, int reg, int index, int base, bool byte_reg) {
+  index = (index == -1 ? 0 : index);
+  base = (base == -1 ? 0 : base);
+  uint8_t rex = 0x40 | (w << 3) | ((reg & 8) >> 1) | ((index & 8) >> 2) | ((base & 8) >> 3);
+  if (rex != 0x40 || byte_reg) emit8(rex);
+  if (op > 0xff) emit8(op >> 8);
+  emit8(op);
+}
+
+// op reg, rm where rm is a register
+static void emit_r(int w, int op, int reg, int rm) {
+  emit_opcode(w, op, reg, -1, rm, false);
+  emit8(0xc0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+// op reg, [base + (index << scale) + disp]
+static void emit_m(int w, int op, int reg, int base, int index, int scale, int32_t disp) {
+  emit_opcode(w, op, reg, index, base, false);
+  int sib_index = (index == -1 ? RSP : index) & 7;
+  if (base == -1) {
+    emit8(0x04 | ((reg & 7) << 3));
+    emit8((scale << 6) | (sib_index << 3) | RBP);
+    emit32(disp);
+    return;
+  }
+  int mod = (disp == 0 && (base & 7) != RBP) ? 0 : (disp == (int8_t)disp ? 1 : 2);
+  if (index == -1 && (base & 7) != RSP) {
+    emit8((mod << 6) | ((reg & 7) << 3) | (base & 7));
+  } else {
+    emit8((mod << 6) | ((reg & 7) << 3) | 4);
+    emit8((scale << 6) | (sib_index << 3) | (base & 7));
+  }
+  if (mod == 1) emit8(disp);
+  else if (mod == 2) emit32(disp);
+}
+
+// op reg, [rip + target - end of instruction], without an immediate
+static void emit_rip(int w, int op, int reg, void *target) {
+  emit_opcode(w, op, reg, -1, -1, false);
+  emit8(0x05 | ((reg & 7) << 3));
+  emit32((uint8_t *)target - (code_ptr + 4));
+}
+
+static inline void emit_mov_rr(int dst, int src) { if (dst != src) emit_r(0, 0x89, src, dst); }
+static inline void emit_mov_imm(int reg, uint32_t imm) { emit_opcode(0, 0xb8 + (reg & 7), 0, -1, reg, false); emit32(imm); }
+static inline void emit_mov_imm64(int reg, uint64_t imm) { emit_opcode(1, 0xb8 + (reg & 7), 0, -1, reg, false); emit64(imm); }
+static inline void emit_load_cpu(int reg, int off) { emit_m(0, 0x8b, reg, RBX, -1, 0, off); }
+static inline void emit_store_cpu(int off, int reg) { emit_m(0, 0x89, reg, RBX, -1, 0, off); }
+static inline void emit_store_cpu_imm(int off, uint32_t imm) { emit_m(0, 0xc7, 0, RBX, -1, 0, off); emit32(imm); }
+
+static void emit_alu_imm(int w, int ext, int reg, uint32_t imm) {
+  if ((int32_t)imm == (int8_t)imm) { emit_r(w, 0x83, ext, reg); emit8(imm); }
+  else { emit_r(w, 0x81, ext, reg); emit32(imm); }
+}
+
+static inline void emit_shift_imm(int ext, int reg, uint8_t imm) { emit_r(0, 0xc1, ext, reg); emit8(imm); }
+
+static void emit_call(const void *fn) {
+  emit_mov_imm64(RAX, (uintptr_t)fn);
+  emit_r(0, 0xff, 2, RAX); // call rax
+}
+
+// return the address of the rel32 field to patch
+static uint8_t* emit_jcc(int cc) {
+  emit8(0x0f); emit8(0x80 | cc);
+  emit32(0);
+  return code_ptr - 4;
+}
+
+static uint8_t* emit_jmp() {
+  emit8(0xe9);
+  emit32(0);
+  return code_ptr - 4;
+}
+
+static inline void patch(uint8_t *rel, uint8_t *target) {
+  int32_t off = target - (rel + 4);
+  memcpy(rel, &off, 4);
+}
+
+// --- guest registers ---
+
+// guest registers held in their home, and those modified there
+static uint8_t loaded = 0, dirty = 0;
+
+static int gpr_use(int idx) {
+  if (!(loaded & (1 << idx))) {
+    emit_load_cpu(home[idx], GPR(idx));
+    loaded |= 1 << idx;
+  }
+  return home[idx];
+}
+
+static int gpr_def(int idx) {
+  loaded |= 1 << idx;
+  dirty |= 1 << idx;
+  return home[idx];
+}
+
+static void emit_spill(uint8_t mask) {
+  for (int i = 0; i < 8; i ++) {
+    if (mask & (1 << i)) emit_store_cpu(GPR(i), home[i]);
+  }
+}
+
+static void emit_reload(uint8_t mask) {
+  for (int i = 0; i < 8; i ++) {
+    if (mask & (1 << i)) emit_load_cpu(home[i], GPR(i));
+  }
+}
+
+// --- exits and slow paths ---
+
+// code placed after the main path of the block
+enum { STUB_LOAD, STUB_STORE, STUB_LEAVE, STUB_BRANCH, STUB_STALE };
+
+typedef struct {
+  int type;
+  uint8_t *from[5];   // rel32 fields jumping to the stub
+  int nr_from;
+  uint8_t *resume;    // where the main path continues after a slow path
+  int idx, width;     // the op, and the width of the memory access
+  vaddr_t pc, next;   // pc of the op, and where to continue when leaving
+  uint8_t loaded, dirty;
+} Stub;
+
+static Stub stub[2 * MAX_BLOCK_OP + 1];
+static int nr_stub = 0;
+
+static Stub* new_stub(int type, int idx, vaddr_t pc, vaddr_t next) {
+  Stub *st = &stub[nr_stub ++];
+  st->type = type;
+  st->nr_from = 0;
+  st->idx = idx;
+  st->pc = pc;
+  st->next = next;
+  st->loaded = loaded;
+  st->dirty = dirty;
+  return st;
+}
+
+// leave after executing `nr' instructions of the block, continuing at `pc',
+// which jumps to the block at `pc' once its code is known
+static void emit_exit_chain(int nr, vaddr_t pc, uint8_t mask) {
+  emit_spill(mask);
+  emit_store_cpu_imm(PC_OFF, pc);
+  emit_alu_imm(1, 5, RBP, nr);                 // sub rbp, nr
+  emit_alu_imm(1, 7, RBP, MAX_BLOCK_OP);       // cmp rbp, MAX_BLOCK_OP
+  patch(emit_jcc(CC_L), epilogue);
+  uint8_t *site = emit_jmp();
+  patch(site, code_ptr);
+  emit_rip(1, 0x8d, RAX, site);                // lea rax, [rip + site]
+  patch(emit_jmp(), miss);
+}
+
+// leave with the pc already in `cpu.pc', which is not chained
+static void emit_exit(int nr) {
+  emit_alu_imm(1, 5, RBP, nr);
+  patch(emit_jmp(), epilogue);
+}
+
+// the code of the block at `pc', NULL if it is not translated
+static void* jit_lookup(vaddr_t pc) {
+  Block *b = block_find(pc);
+  if (b == NULL || b->code == NULL || b->code_gen != code_gen) return NULL;
+  return ((JitCode *)b->code)->entry;
+}
+
+// leave with the pc already in `cpu.pc', which jumps to the block
+// at the pc if it is translated, for returns and indirect jumps
+static void emit_exit_lookup(int nr) {
+  emit_alu_imm(1, 5, RBP, nr);
+  emit_alu_imm(1, 7, RBP, MAX_BLOCK_OP);
+  patch(emit_jcc(CC_L), epilogue);
+  emit_load_cpu(RDI, PC_OFF);
+  emit_call(jit_lookup);
+  emit_r(1, 0x85, RAX, RAX);                   // test rax, rax
+  patch(emit_jcc(CC_Z), epilogue);
+  emit_r(0, 0xff, 4, RAX);                     // jmp rax
+}
+
+// the instructions executed by now are `jit_budget - left'
+static inline void jit_sync_inst(int64_t left) {
+  g_nr_guest_inst = jit_inst_base + (jit_budget - left);
+}
+
+// an event is due after the instruction being executed, return to block_exec()
+static inline bool jit_event_due() {
+  return g_nr_guest_inst + 1 >= event_deadline;
+}
+
+static word_t jit_load(vaddr_t addr, int len, int64_t left) {
+  jit_sync_inst(left);
+  word_t data = vaddr_read(addr, len);
+  g_nr_guest_inst = jit_inst_base;
+  return data;
+}
+
+// return true if the block should be left after the store
+static int jit_store(vaddr_t addr, int len, word_t data, int64_t left) {
+  uint64_t version = dcache_version;
+  jit_sync_inst(left);
+  vaddr_write(addr, len, data);
+  bool leave = dcache_version != version || jit_event_due();
+  g_nr_guest_inst = jit_inst_base;
+  return leave;
+}
+
+// execute an instruction not translated, return true if the block should be left
+static int jit_exec_op(const DCacheEntry *e, int64_t left) {
+  uint64_t version = dcache_version;
+  jit_sync_inst(left);
+  cpu.pc = s.pc = e->pc;
+  s.snpc = e->snpc;
+  s.isa = e->isa;
+  isa_exec_cached(&s, e->handler);
+  cpu.pc = s.dnpc;
+  bool leave = nemu_state.state != NEMU_RUNNING || s.dnpc != s.snpc ||
+    dcache_version != version || jit_event_due();
+  g_nr_guest_inst = jit_inst_base;
+  return leave;
+}
+
+// the other arrays indexed by the page are addressed relative to r13
+static inline int32_t page_off(const uint8_t *page) {
+  int64_t off = page - dcache_code_page;
+  Assert(off == (int32_t)off, "the page array is too far from dcache_code_page");
+  return off;
+}
+
+// the pmem offset of the `width'-byte access at eax is in rcx, jump to
+// the stub if the access should go through vaddr_read()/vaddr_write(),
+// `scratch' is clobbered
+static void emit_pmem_check(Stub *st, int width, bool store, int scratch) {
+  emit_mov_rr(RCX, RAX);
+  if (CONFIG_MBASE != 0) emit_alu_imm(0, 5, RCX, CONFIG_MBASE);
+  emit_alu_imm(0, 7, RCX, pmem_size - width);
+  st->from[st->nr_from ++] = emit_jcc(CC_A);
+  if (!store && !MUXDEF(CONFIG_MEM_RANDOM, true, false)) return;
+  if (width > 1) {
+    // the check below only looks at the page of the first byte
+    emit_mov_rr(scratch, RCX);
+    emit_alu_imm(0, 4, scratch, PAGE_MASK);
+    emit_alu_imm(0, 7, scratch, PAGE_SIZE - width);
+    st->from[st->nr_from ++] = emit_jcc(CC_A);
+  }
+  emit_mov_rr(scratch, RCX);
+  emit_shift_imm(5, scratch, PAGE_SHIFT);
+  if (store) {
+    emit_m(0, 0x80, 7, R13, scratch, 0, 0); emit8(0); // cmp byte [r13 + scratch], 0
+    st->from[st->nr_from ++] = emit_jcc(CC_NZ);
+#ifdef CONFIG_SNAPSHOT
+    // the page is copied for the last checkpoint before its first write
+    emit_m(0, 0x80, 7, R13, scratch, 0, page_off(snapshot_cow_page)); emit8(0);
+    st->from[st->nr_from ++] = emit_jcc(CC_NZ);
+#endif
+  }
+#ifdef CONFIG_MEM_RANDOM
+  emit_m(0, 0x80, 7, R13, scratch, 0, page_off(pmem_fresh_page)); emit8(0);
+  st->from[st->nr_from ++] = emit_jcc(CC_NZ);
+#endif
+}
+
+// ecx = M[eax] zero-extended, eax is kept
+static void emit_load(int idx, vaddr_t pc, int width) {
+  Stub *st = new_stub(STUB_LOAD, idx, pc, 0);
+  st->width = width;
+  emit_pmem_check(st, width, false, RDX);
+  switch (width) {
+    case 1: emit_m(0, 0x0fb6, RCX, R12, RCX, 0, 0); break;
+    case 2: emit_m(0, 0x0fb7, RCX, R12, RCX, 0, 0); break;
+    default: emit_m(0, 0x8b, RCX, R12, RCX, 0, 0); break;
+  }
+  st->resume = code_ptr;
+}
+
+// M[eax] = edx, leave to `next' if the store modifies the guest code
+static void emit_store(int idx, vaddr_t pc, vaddr_t next, int width) {
+  Stub *st = new_stub(STUB_STORE, idx, pc, next);
+  st->width = width;
+  emit_pmem_check(st, width, true, RAX);
+  switch (width) {
+    case 1: emit_m(0, 0x88, RDX, R12, RCX, 0, 0); break;
+    default: emit_m(0, 0x89, RDX, R12, RCX, 0, 0); break;
+  }
+  st->resume = code_ptr;
+}
+
+static void emit_stub(Stub *st) {
+  for (int i = 0; i < st->nr_from; i ++) patch(st->from[i], code_ptr);
+  switch (st->type) {
+    case STUB_LOAD:
+      emit_spill(st->dirty);
+      emit_store_cpu_imm(PC_OFF, st->pc);
+      emit8(0x50); emit8(0x50);                       // push rax; push rax
+      emit_m(0, 0x8d, RDI, RCX, -1, 0, CONFIG_MBASE); // lea edi, [rcx + MBASE]
+      emit_mov_imm(RSI, st->width);
+      emit_m(1, 0x8d, RDX, RBP, -1, 0, -st->idx);     // lea rdx, [rbp - idx]
+      emit_call(jit_load);
+      emit_mov_rr(RCX, RAX);
+      emit8(0x58); emit8(0x58);                       // pop rax; pop rax
+      emit_reload(st->loaded & CALLER_SAVED);
+      patch(emit_jmp(), st->resume);
+      break;
+    case STUB_STORE: {
+      emit_spill(st->dirty);
+      emit_store_cpu_imm(PC_OFF, st->pc);
+      emit_m(0, 0x8d, RDI, RCX, -1, 0, CONFIG_MBASE);
+      emit_mov_imm(RSI, st->width);
+      emit_m(1, 0x8d, RCX, RBP, -1, 0, -st->idx);     // lea rcx, [rbp - idx]
+      emit_call(jit_store);
+      emit_r(0, 0x85, RAX, RAX);
+      uint8_t *cont = emit_jcc(CC_Z);
+      emit_store_cpu_imm(PC_OFF, st->next);
+      emit_exit(st->idx + 1);
+      patch(cont, code_ptr);
+      emit_reload(st->loaded & CALLER_SAVED);
+      patch(emit_jmp(), st->resume);
+      break;
+    }
+    case STUB_LEAVE: emit_exit(st->idx + 1); break;
+    case STUB_BRANCH: emit_exit_chain(st->idx + 1, st->next, st->dirty); break;
+    case STUB_STALE:
+      emit_store_cpu_imm(PC_OFF, st->pc);
+      patch(emit_jmp(), epilogue);
+      break;
+  }
+}
+
+// --- planning ---
+
+/* Each op is classified by how it affects the lazy flags record:
+ *   OP_WRITE: overwrites the whole record without reading it
+ *   OP_PASS:  neither reads nor writes it, and never leaves the block
+ *   OP_SHIFT: a shift only translated if the flags it sets are dead
+ *   OP_READ:  anything else, including the ops which may leave the block
+ */
+enum { OP_WRITE, OP_PASS, OP_SHIFT, OP_READ };
+// how the host flags relate to the guest ones during translation
+enum { FLAGS_DEAD, FLAGS_LIVE, FLAGS_LIVE_NO_CF };
+// how inc and dec get the CF they keep, and how a jcc gets the flags
+enum { CF_ZERO, CF_EFLAGS, CF_HOST, CF_CALL, JCC_HOST, JCC_RECORD };
+
+typedef struct {
+  bool native;
+  int cls;
+  int mode;
+  int lazy; // the kind of the record before the op, -1 if unknown
+} Plan;
+
+static Plan plan[MAX_BLOCK_OP];
+static bool dead_after[MAX_BLOCK_OP];
+
+enum { ALU_ADD = 0, ALU_OR = 1, ALU_AND = 4, ALU_SUB = 5, ALU_XOR = 6, ALU_CMP = 7, ALU_TEST = 8 };
+
+// return the ALU operation of a 32-bit arithmetic op, -1 if it is not
+static int alu_op(x86_ISADecodeInfo *isa) {
+  uint8_t opcode = isa->opcode;
+  if (isa->esc) return -1;
+  if (opcode < 0x40 && (opcode & 7) % 2 == 1 && (opcode & 7) != 7) {
+    int op = opcode >> 3;
+    return (op == 2 || op == 3) ? -1 : op; // adc and sbb read CF
+  }
+  switch (opcode) {
+    case 0x81: case 0x83: return (isa->gp_idx == 2 || isa->gp_idx == 3) ? -1 : isa->gp_idx;
+    case 0x85: case 0xa9: return ALU_TEST;
+  }
+  return -1;
+}
+
+static int alu_lazy(int op) {
+  return op == ALU_ADD ? LAZY_ADD : (op == ALU_SUB || op == ALU_CMP) ? LAZY_SUB : LAZY_LOGIC;
+}
+
+// return 1 for inc, -1 for dec on a register, 0 otherwise
+static int incdec_op(x86_ISADecodeInfo *isa) {
+  if (isa->esc) return 0;
+  if (isa->opcode >= 0x40 && isa->opcode <= 0x4f) return isa->opcode < 0x48 ? 1 : -1;
+  if (isa->opcode == 0xff && isa->rd != -1 && isa->gp_idx <= 1) return isa->gp_idx == 0 ? 1 : -1;
+  return 0;
+}
+
+static int incdec_reg(x86_ISADecodeInfo *isa) {
+  return isa->opcode == 0xff ? isa->rd : isa->opcode & 7;
+}
+
+static bool is_shift(x86_ISADecodeInfo *isa) {
+  return !isa->esc && (isa->opcode == 0xc1 || isa->opcode == 0xd1) && isa->rd != -1 &&
+    (isa->gp_idx == 4 || isa->gp_idx == 5 || isa->gp_idx == 7);
+}
+
+static bool is_jcc(x86_ISADecodeInfo *isa) {
+  return isa->esc ? (isa->opcode & 0xf0) == 0x80 : (isa->opcode & 0xf0) == 0x70;
+}
+
+static bool jcc_reads_cf(int cc) {
+  return cc == 0x2 || cc == 0x3 || cc == 0x6 || cc == 0x7;
+}
+
+// ops translated without reading or writing the flags, return whether they may leave the block
+static bool plain_native(x86_ISADecodeInfo *isa, bool *leave) {
+  uint8_t opcode = isa->opcode;
+  *leave = false;
+  if (isa->esc) {
+    switch (opcode) {
+      case 0xb6: case 0xbe: return isa->rs == -1 || isa->rs < 4; // movzx/movsx r32, r/m8
+      case 0xb7: case 0xbf: return true;                          // movzx/movsx r32, r/m16
+    }
+    return false;
+  }
+  switch (opcode) {
+    case 0x90: case 0x8d: case 0xb8 ... 0xbf: case 0x99: return true;
+    case 0x8b: case 0xa1: case 0x58 ... 0x5f: case 0xc9: return true;
+    case 0x89: case 0xc7: *leave = (isa->rd == -1); return true;
+    case 0x88: *leave = true; return isa->rd == -1 && isa->rs < 4;
+    case 0xc6: *leave = true; return isa->rd == -1;
+    case 0xa3: case 0x50 ... 0x57: case 0x68: *leave = true; return true;
+    case 0xe8: case 0xe9: case 0xeb: case 0xc3: *leave = true; return true;
+    case 0xff: *leave = true; return isa->gp_idx == 4 || isa->gp_idx == 6;
+  }
+  return false;
+}
+
+static bool plain_uses_memory(x86_ISADecodeInfo *isa) {
+  uint8_t opcode = isa->opcode;
+  if (opcode == 0x8d || opcode == 0xb8 || opcode == 0x90) return false;
+  if (isa->esc || opcode == 0x8b || opcode == 0x89 || opcode == 0xc7) return isa->rd == -1 || isa->rs == -1;
+  return !(opcode >= 0xb8 && opcode <= 0xbf) && opcode != 0x99;
+}
+
+static void plan_block(Block *b) {
+  int flags = FLAGS_DEAD, lazy = -1;
+  for (int i = 0; i < b->nr_op; i ++) {
+    x86_ISADecodeInfo *isa = &b->op[i].e->isa;
+    Plan *p = &plan[i];
+    p->native = false;
+    p->cls = OP_READ;
+    p->lazy = lazy;
+    if (isa->is_operand_size_16 || isa->has_rep) goto interp;
+
+    int op = alu_op(isa), incdec = incdec_op(isa);
+    bool leave;
+    if (op != -1) {
+      p->native = true;
+      p->cls = OP_WRITE;
+      bool rmw = (isa->rd == -1 && op != ALU_CMP && op != ALU_TEST && isa->opcode != 0x03 + (op << 3));
+      flags = rmw ? FLAGS_DEAD : FLAGS_LIVE;
+      lazy = alu_lazy(op);
+    } else if (incdec != 0) {
+      if (lazy == LAZY_LOGIC) p->mode = CF_ZERO;
+      else if (lazy == LAZY_INC || lazy == LAZY_DEC) p->mode = CF_EFLAGS;
+      else if ((lazy == LAZY_ADD || lazy == LAZY_SUB) && flags == FLAGS_LIVE) p->mode = CF_HOST;
+      else p->mode = CF_CALL;
+      p->native = true;
+      // CF is taken from the host flags set by the previous op, or from the record
+      p->cls = (p->mode == CF_HOST || p->mode == CF_CALL ? OP_READ : OP_WRITE);
+      flags = ((p->mode == CF_EFLAGS && flags != FLAGS_LIVE) || p->mode == CF_CALL) ?
+        FLAGS_LIVE_NO_CF : FLAGS_LIVE;
+      lazy = (incdec > 0 ? LAZY_INC : LAZY_DEC);
+    } else if (is_shift(isa)) {
+      // decided once the flags after it are known to be dead
+      p->cls = OP_SHIFT;
+      flags = FLAGS_DEAD;
+      lazy = -1;
+    } else if (is_jcc(isa)) {
+      int cc = isa->opcode & 0xf;
+      if (!isa->esc && (cc == 0xa || cc == 0xb)) goto interp; // jp/jnp panic in the interpreter
+      if (flags == FLAGS_LIVE || (flags == FLAGS_LIVE_NO_CF && !jcc_reads_cf(cc))) p->mode = JCC_HOST;
+      else if (lazy == LAZY_ADD || lazy == LAZY_SUB || lazy == LAZY_LOGIC) { p->mode = JCC_RECORD; flags = FLAGS_LIVE; }
+      else goto interp;
+      p->native = true;
+    } else if (plain_native(isa, &leave)) {
+      p->native = true;
+      p->cls = (leave ? OP_READ : OP_PASS);
+      if (plain_uses_memory(isa) || isa->opcode == 0x99) flags = FLAGS_DEAD;
+    } else {
+      goto interp;
+    }
+    continue;
+interp:
+    p->native = false;
+    p->cls = OP_READ;
+    flags = FLAGS_DEAD;
+    lazy = -1;
+  }
+
+  // the record is read after the block
+  dead_after[b->nr_op - 1] = false;
+  for (int i = b->nr_op - 2; i >= 0; i --) {
+    switch (plan[i + 1].cls) {
+      case OP_WRITE: dead_after[i] = true; break;
+      case OP_PASS: case OP_SHIFT: dead_after[i] = dead_after[i + 1]; break;
+      default: dead_after[i] = false; break;
+    }
+  }
+  for (int i = 0; i < b->nr_op; i ++) {
+    if (plan[i].cls == OP_SHIFT) plan[i].native = dead_after[i];
+  }
+}
+
+// --- translation ---
+
+// eax = disp + base + (index << scale)
+static void emit_ea(x86_ISADecodeInfo *isa, int dst) {
+  int base = (isa->base == -1 ? -1 : gpr_use(isa->base));
+  int index = (isa->index == -1 ? -1 : gpr_use(isa->index));
+  if (base == -1 && index == -1) emit_mov_imm(dst, isa->disp);
+  else emit_m(0, 0x8d, dst, base, index, isa->scale, isa->disp);
+}
+
+static void emit_record(int lazy, int dest, bool src_imm, uint32_t src, int res) {
+  emit_store_cpu_imm(LAZY_OFF(op), lazy);
+  emit_store_cpu_imm(LAZY_OFF(width), 4);
+  if (lazy != LAZY_LOGIC) {
+    emit_store_cpu(LAZY_OFF(dest), dest);
+    if (src_imm) emit_store_cpu_imm(LAZY_OFF(src), src);
+    else emit_store_cpu(LAZY_OFF(src), src);
+  }
+  emit_store_cpu(LAZY_OFF(res), res);
+}
+
+// host op dst, src or dst, imm for an ALU operation
+static void emit_alu(int op, int dst, bool src_imm, uint32_t src) {
+  if (op == ALU_TEST) {
+    if (src_imm) { emit_r(0, 0xf7, 0, dst); emit32(src); }
+    else emit_r(0, 0x85, src, dst);
+  } else {
+    if (src_imm) emit_alu_imm(0, op, dst, src);
+    else emit_r(0, (op << 3) | 1, src, dst);
+  }
+}
+
+static void emit_alu_op(int i, BlockOp *op, int alu) {
+  x86_ISADecodeInfo *isa = &op->e->isa;
+  bool writes = (alu != ALU_CMP && alu != ALU_TEST);
+  // the record needs the result of cmp and test
+  int calc = (alu == ALU_CMP ? ALU_SUB : alu == ALU_TEST ? ALU_AND : alu);
+  bool src_imm = (isa->opcode == 0x81 || isa->opcode == 0x83 || isa->opcode == 0xa9 ||
+      (isa->opcode < 0x40 && (isa->opcode & 7) == 5));
+  int lazy = alu_lazy(alu);
+  int rd = isa->rd, rs = isa->rs;
+
+  if (rd != -1 && (src_imm || rs != -1)) {
+    int src = (src_imm ? isa->imm : gpr_use(rs));
+    int d = gpr_use(rd);
+    if (dead_after[i]) {
+      emit_alu(alu, d, src_imm, src);
+      if (writes) gpr_def(rd);
+      return;
+    }
+    emit_mov_rr(RAX, d);
+    emit_alu(calc, RAX, src_imm, src);
+    emit_record(lazy, d, src_imm, src, RAX);
+    if (writes) emit_mov_rr(gpr_def(rd), RAX);
+    return;
+  }
+
+  emit_ea(isa, RAX);
+  emit_load(i, op->pc, 4);
+  if (rd != -1) {
+    // op r32, m32
+    int d = gpr_use(rd);
+    if (dead_after[i]) {
+      emit_alu(alu, d, false, RCX);
+      if (writes) gpr_def(rd);
+      return;
+    }
+    emit_mov_rr(RAX, d);
+    emit_alu(calc, RAX, false, RCX);
+    emit_record(lazy, d, false, RCX, RAX);
+    if (writes) emit_mov_rr(gpr_def(rd), RAX);
+    return;
+  }
+
+  // op m32, r32/imm
+  int src = (src_imm ? isa->imm : gpr_use(rs));
+  emit_mov_rr(RDX, RCX);
+  emit_alu(calc, RDX, src_imm, src);
+  // the record should be there if the store leaves the block
+  if (writes || !dead_after[i]) emit_record(lazy, RCX, src_imm, src, RDX);
+  if (writes) emit_store(i, op->pc, op->e->snpc, 4);
+}
+
+static void jit_keep_cf() {
+  cpu.eflags.CF = eflags_CF();
+}
+
+// call a function not reading the guest registers
+static void emit_call_fn(const void *fn) {
+  emit_spill(dirty & CALLER_SAVED);
+  emit_call(fn);
+  loaded &= ~CALLER_SAVED;
+  dirty &= ~CALLER_SAVED;
+}
+
+static void emit_incdec_op(int i, BlockOp *op, int incdec) {
+  x86_ISADecodeInfo *isa = &op->e->isa;
+  int reg = incdec_reg(isa);
+  switch (plan[i].mode) {
+    case CF_ZERO: emit_m(0, 0x83, 4, RBX, -1, 0, EFLAGS_OFF); emit8(0xfe); break; // and [eflags], ~1
+    case CF_HOST:
+      emit_r(0, 0x0f92, 0, RAX);                            // setb al
+      emit_r(0, 0x0fb6, RAX, RAX);                          // movzx eax, al
+      emit_m(0, 0x83, 4, RBX, -1, 0, EFLAGS_OFF); emit8(0xfe);
+      emit_m(0, 0x09, RAX, RBX, -1, 0, EFLAGS_OFF);         // or [eflags], eax
+      emit_r(0, 0x0fba, 4, RAX); emit8(0);                  // bt eax, 0
+      break;
+    case CF_CALL: emit_call_fn(jit_keep_cf); break;
+  }
+  int ext = (incdec > 0 ? 0 : 1);
+  int d = gpr_use(reg);
+  if (dead_after[i]) {
+    emit_r(0, 0xff, ext, d);
+    gpr_def(reg);
+    return;
+  }
+  emit_mov_rr(RAX, d);
+  emit_r(0, 0xff, ext, RAX);
+  emit_record(incdec > 0 ? LAZY_INC : LAZY_DEC, d, true, 1, RAX);
+  emit_mov_rr(gpr_def(reg), RAX);
+}
+
+static void emit_shift_op(BlockOp *op) {
+  x86_ISADecodeInfo *isa = &op->e->isa;
+  int d = gpr_use(isa->rd);
+  uint8_t count = (isa->opcode == 0xd1 ? 1 : isa->imm) & 0x1f;
+  if (count != 0) emit_shift_imm(isa->gp_idx, d, count);
+  gpr_def(isa->rd);
+}
+
+static void emit_jcc_op(int i, BlockOp *op, bool last) {
+  x86_ISADecodeInfo *isa = &op->e->isa;
+  vaddr_t snpc = op->e->snpc;
+  vaddr_t target = snpc + (isa->esc ? (int32_t)isa->imm : (int8_t)isa->imm);
+  if (plan[i].mode == JCC_RECORD) {
+    switch (plan[i].lazy) {
+      case LAZY_LOGIC:
+        emit_load_cpu(RAX, LAZY_OFF(res));
+        emit_r(0, 0x85, RAX, RAX);
+        break;
+      case LAZY_ADD:
+        emit_load_cpu(RAX, LAZY_OFF(dest));
+        emit_m(0, 0x03, RAX, RBX, -1, 0, LAZY_OFF(src));
+        break;
+      case LAZY_SUB:
+        emit_load_cpu(RAX, LAZY_OFF(dest));
+        emit_m(0, 0x3b, RAX, RBX, -1, 0, LAZY_OFF(src));
+        break;
+    }
+  }
+  Stub *st = new_stub(STUB_BRANCH, i, op->pc, target);
+  st->from[st->nr_from ++] = emit_jcc(isa->opcode & 0xf);
+  if (last) emit_exit_chain(i + 1, snpc, dirty);
+}
+
+// translate an op without flags, return false if it leaves the block
+static bool emit_plain_op(int i, BlockOp *op) {
+  x86_ISADecodeInfo *isa = &op->e->isa;
+  vaddr_t pc = op->pc, snpc = op->e->snpc;
+  uint8_t opcode = isa->opcode;
+  int rd = isa->rd, rs = isa->rs;
+
+  if (isa->esc) {
+    // movzx/movsx
+    int width = (opcode & 1) ? 2 : 1;
+    int src;
+    if (rs != -1) src = gpr_use(rs);
+    else { emit_ea(isa, RAX); emit_load(i, pc, width); src = RCX; }
+    int d = home[rd];
+    if (opcode >= 0xbe) emit_r(0, width == 1 ? 0x0fbe : 0x0fbf, d, src);
+    else if (rs != -1) emit_r(0, width == 1 ? 0x0fb6 : 0x0fb7, d, src);
+    else emit_mov_rr(d, RCX);
+    gpr_def(rd);
+    return true;
+  }
+
+  switch (opcode) {
+    case 0x90: return true;
+    case 0xb8 ... 0xbf: emit_mov_imm(gpr_def(rd), isa->imm); return true;
+    case 0x8d: {
+      int base = (isa->base == -1 ? -1 : gpr_use(isa->base));
+      int index = (isa->index == -1 ? -1 : gpr_use(isa->index));
+      int d = gpr_def(rd);
+      if (base == -1 && index == -1) emit_mov_imm(d, isa->disp);
+      else emit_m(0, 0x8d, d, base, index, isa->scale, isa->disp);
+      return true;
+    }
+    case 0x99: // cltd
+      emit_mov_rr(gpr_def(R_EDX), gpr_use(R_EAX));
+      emit_shift_imm(7, home[R_EDX], 31);
+      return true;
+    case 0x89:
+      if (rd != -1) { int src = gpr_use(rs); emit_mov_rr(gpr_def(rd), src); return true; }
+      emit_ea(isa, RAX);
+      emit_mov_rr(RDX, gpr_use(rs));
+      emit_store(i, pc, snpc, 4);
+      return true;
+    case 0x88:
+      emit_ea(isa, RAX);
+      emit_mov_rr(RDX, gpr_use(rs));
+      emit_store(i, pc, snpc, 1);
+      return true;
+    case 0x8b:
+      if (rs != -1) { int src = gpr_use(rs); emit_mov_rr(gpr_def(rd), src); return true; }
+      emit_ea(isa, RAX);
+      emit_load(i, pc, 4);
+      emit_mov_rr(gpr_def(rd), RCX);
+      return true;
+    case 0xa1:
+      emit_mov_imm(RAX, isa->disp);
+      emit_load(i, pc, 4);
+      emit_mov_rr(gpr_def(R_EAX), RCX);
+      return true;
+    case 0xa3:
+      emit_mov_rr(RDX, gpr_use(R_EAX));
+      emit_mov_imm(RAX, isa->disp);
+      emit_store(i, pc, snpc, 4);
+      return true;
+    case 0xc7:
+      if (rd != -1) { emit_mov_imm(gpr_def(rd), isa->imm); return true; }
+      emit_ea(isa, RAX);
+      emit_mov_imm(RDX, isa->imm);
+      emit_store(i, pc, snpc, 4);
+      return true;
+    case 0xc6:
+      emit_ea(isa, RAX);
+      emit_mov_imm(RDX, isa->imm & 0xff);
+      emit_store(i, pc, snpc, 1);
+      return true;
+    case 0x50 ... 0x57: case 0x68: {
+      // the same as the interpreter, esp is updated before reading the register
+      int esp = gpr_use(R_ESP);
+      emit_m(0, 0x8d, gpr_def(R_ESP), esp, -1, 0, -4);
+      if (opcode == 0x68) emit_mov_imm(RDX, isa->imm);
+      else emit_mov_rr(RDX, gpr_use(opcode & 7));
+      emit_mov_rr(RAX, esp);
+      emit_store(i, pc, snpc, 4);
+      return true;
+    }
+    case 0x58 ... 0x5f: case 0xc9: {
+      if (opcode == 0xc9) emit_mov_rr(gpr_def(R_ESP), gpr_use(R_EBP));
+      int esp = gpr_use(R_ESP);
+      emit_mov_rr(RAX, esp);
+      emit_load(i, pc, 4);
+      emit_m(0, 0x8d, gpr_def(R_ESP), esp, -1, 0, 4);
+      emit_mov_rr(gpr_def(opcode == 0xc9 ? R_EBP : opcode & 7), RCX);
+      return true;
+    }
+    case 0xe8: {
+      vaddr_t target = snpc + (int32_t)isa->imm;
+      int esp = gpr_use(R_ESP);
+      emit_m(0, 0x8d, gpr_def(R_ESP), esp, -1, 0, -4);
+      emit_mov_imm(RDX, snpc);
+      emit_mov_rr(RAX, esp);
+      emit_store(i, pc, target, 4);
+      emit_exit_chain(i + 1, target, dirty);
+      return false;
+    }
+    case 0xe9: emit_exit_chain(i + 1, snpc + (int32_t)isa->imm, dirty); return false;
+    case 0xeb: emit_exit_chain(i + 1, snpc + (int8_t)isa->imm, dirty); return false;
+    case 0xc3: {
+      int esp = gpr_use(R_ESP);
+      emit_mov_rr(RAX, esp);
+      emit_load(i, pc, 4);
+      emit_m(0, 0x8d, gpr_def(R_ESP), esp, -1, 0, 4);
+      emit_spill(dirty);
+      emit_store_cpu(PC_OFF, RCX);
+      emit_exit_lookup(i + 1);
+      return false;
+    }
+    case 0xff:
+      if (isa->gp_idx == 4) { // jmp r/m32
+        if (rd != -1) emit_mov_rr(RCX, gpr_use(rd));
+        else { emit_ea(isa, RAX); emit_load(i, pc, 4); }
+        emit_spill(dirty);
+        emit_store_cpu(PC_OFF, RCX);
+        emit_exit_lookup(i + 1);
+        return false;
+      }
+      // push r/m32
+      if (rd != -1) {
+        int esp = gpr_use(R_ESP);
+        emit_m(0, 0x8d, gpr_def(R_ESP), esp, -1, 0, -4);
+        emit_mov_rr(RDX, gpr_use(rd));
+      } else {
+        emit_ea(isa, RAX);
+        emit_load(i, pc, 4);
+        int esp = gpr_use(R_ESP);
+        emit_m(0, 0x8d, gpr_def(R_ESP), esp, -1, 0, -4);
+        emit_mov_rr(RDX, RCX);
+      }
+      emit_mov_rr(RAX, home[R_ESP]);
+      emit_store(i, pc, snpc, 4);
+      return true;
+  }
+  panic("op %02x is not translated", opcode);
+}
+
+static void emit_interp_op(int i, BlockOp *op, DCacheEntry *copy) {
+  *copy = *op->e;
+  emit_spill(dirty);
+  emit_mov_imm64(RDI, (uintptr_t)copy);
+  emit_m(1, 0x8d, RSI, RBP, -1, 0, -i); // lea rsi, [rbp - i]
+  emit_call(jit_exec_op);
+  loaded = dirty = 0;
+  emit_r(0, 0x85, RAX, RAX);
+  Stub *st = new_stub(STUB_LEAVE, i, op->pc, 0);
+  st->from[st->nr_from ++] = emit_jcc(CC_NZ);
+}
+
+static void code_cache_flush() {
+  code_ptr = code_cache;
+  jit_version = (uint64_t *)code_ptr;
+  code_ptr += 8;
+
+  // enter(code, budget), shared by all blocks
+  enter = code_ptr;
+  emit8(0x53);                               // push rbx
+  emit8(0x55);                               // push rbp
+  emit8(0x41); emit8(0x54);                  // push r12
+  emit8(0x41); emit8(0x55);                  // push r13
+  emit8(0x41); emit8(0x56);                  // push r14
+  emit8(0x41); emit8(0x57);                  // push r15
+  emit_alu_imm(1, 5, RSP, 8);                // sub rsp, 8
+  emit_mov_imm64(RBX, (uintptr_t)&cpu);
+  emit_mov_imm64(R12, (uintptr_t)guest_to_host(CONFIG_MBASE));
+  emit_mov_imm64(R13, (uintptr_t)dcache_code_page);
+  emit_r(1, 0x89, RSI, RBP);                 // mov rbp, rsi
+  emit_r(0, 0xff, 4, RDI);                   // jmp rdi
+
+  // rax = the rel32 field of the exit
+  miss = code_ptr;
+  emit_mov_imm64(RCX, (uintptr_t)&miss_site);
+  emit_m(1, 0x89, RAX, RCX, -1, 0, 0);       // mov [rcx], rax
+
+  // return the budget left
+  epilogue = code_ptr;
+  emit_r(1, 0x89, RBP, RAX);                 // mov rax, rbp
+  emit_alu_imm(1, 0, RSP, 8);                // add rsp, 8
+  emit8(0x41); emit8(0x5f);                  // pop r15
+  emit8(0x41); emit8(0x5e);                  // pop r14
+  emit8(0x41); emit8(0x5d);                  // pop r13
+  emit8(0x41); emit8(0x5c);                  // pop r12
+  emit8(0x5d);                               // pop rbp
+  emit8(0x5b);                               // pop rbx
+  emit8(0xc3);                               // ret
+
+  code_gen ++;
+  jit_nr_flush ++;
+  miss_site = NULL;
+}
+
+static JitCode* jit_compile(Block *b) {
+  for (int i = 0; i < b->nr_op; i ++) {
+    if (!op_valid(&b->op[i])) return NULL;
+  }
+  if (code_cache == NULL) {
+    code_cache = mmap(NULL, CODE_CACHE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    Assert(code_cache != MAP_FAILED, "fail to allocate the code cache");
+    code_cache_flush();
+  }
+  if (code_ptr + MAX_BLOCK_CODE > code_cache + CODE_CACHE_SIZE) code_cache_flush();
+
+  plan_block(b);
+
+  // the header and the data used by the code
+  code_ptr = (uint8_t *)ROUNDUP((uintptr_t)code_ptr, 8);
+  JitCode *jc = (JitCode *)code_ptr;
+  code_ptr += sizeof(JitCode);
+  DCacheEntry *copy = (DCacheEntry *)code_ptr;
+  for (int i = 0; i < b->nr_op; i ++) {
+    if (!plan[i].native) code_ptr += sizeof(DCacheEntry);
+  }
+  jc->pc = b->pc;
+  jc->len = b->op[b->nr_op - 1].e->snpc - b->pc;
+  jc->guest = code_ptr;
+  memcpy(jc->guest, guest_to_host(b->pc), jc->len);
+  code_ptr += jc->len;
+  dcache_mark_code(jc->pc, jc->len);
+  jc->version = dcache_version;
+  code_ptr = (uint8_t *)ROUNDUP((uintptr_t)code_ptr, 16);
+  jc->entry = code_ptr;
+
+  b->code = jc;
+  b->code_gen = code_gen;
+  jit_nr_compile ++;
+
+  loaded = dirty = 0;
+  nr_stub = 0;
+  // leave if the guest code may have been modified
+  emit_rip(1, 0x8b, RAX, jit_version);       // mov rax, [rip + jit_version]
+  emit_rip(1, 0x3b, RAX, &jc->version);      // cmp rax, [rip + version]
+  Stub *stale = new_stub(STUB_STALE, 0, b->pc, 0);
+  stale->from[stale->nr_from ++] = emit_jcc(CC_NZ);
+
+  bool fall = true;
+  for (int i = 0; i < b->nr_op && fall; i ++) {
+    BlockOp *op = &b->op[i];
+    x86_ISADecodeInfo *isa = &op->e->isa;
+    uint8_t *start = code_ptr;
+    bool last = (i == b->nr_op - 1);
+    int alu, incdec;
+    if (!plan[i].native) emit_interp_op(i, op, copy ++);
+    else if ((alu = alu_op(isa)) != -1) emit_alu_op(i, op, alu);
+    else if ((incdec = incdec_op(isa)) != 0) emit_incdec_op(i, op, incdec);
+    else if (is_shift(isa)) emit_shift_op(op);
+    else if (is_jcc(isa)) { emit_jcc_op(i, op, last); fall = !last; }
+    else fall = emit_plain_op(i, op);
+    if (fall && last) {
+      // the interpreter has set the pc, `snpc' in the entry misses
+      // the bytes fetched while executing some instructions
+      if (plan[i].native) emit_exit_chain(b->nr_op, op->e->snpc, dirty);
+      else emit_exit_lookup(b->nr_op);
+    }
+    Assert(code_ptr - start <= MAX_OP_CODE, "code of op %d is too long", i);
+  }
+  for (int i = 0; i < nr_stub; i ++) emit_stub(&stub[i]);
+  Assert(code_ptr - (uint8_t *)jc <= MAX_BLOCK_CODE, "code of the block is too long");
+  return jc;
+}
+
+int64_t jit_run(Block *b, uint64_t n) {
+  JitCode *jc = b->code;
+  if (jc == NULL || b->code_gen != code_gen) {
+    if (++ b->nr_exec < JIT_THRESHOLD) return -1;
+    jc = jit_compile(b);
+    if (jc == NULL) return -1;
+  }
+  if (jc->version != dcache_version) {
+    if (memcmp(jc->guest, guest_to_host(jc->pc), jc->len) != 0) {
+      // the code is modified, build the block again
+      b->code = NULL;
+      b->valid = false;
+      return 0;
+    }
+    // the pages may be cleared by dcache_flush()
+    dcache_mark_code(jc->pc, jc->len);
+    jc->version = dcache_version;
+  }
+  if (miss_site != NULL) {
+    // the last run left to this block, jump here directly next time
+    if (miss_gen == code_gen && miss_pc == b->pc) {
+      patch(miss_site, jc->entry);
+      jit_nr_link ++;
+    }
+    miss_site = NULL;
+  }
+
+  // stop chaining when an event is due, the first block always runs
+  // to its end as in block_run()
+  uint64_t until_event = (event_deadline > g_nr_guest_inst ? event_deadline - g_nr_guest_inst : 0);
+  uint64_t budget = (n < until_event ? n : until_event);
+  if (budget > INT32_MAX) budget = INT32_MAX;
+  if (budget < b->nr_op) budget = b->nr_op;
+  *jit_version = dcache_version;
+  jit_inst_base = g_nr_guest_inst;
+  jit_budget = budget;
+  int64_t left = ((int64_t (*)(void *, int64_t))enter)(jc->entry, budget);
+  if (miss_site != NULL) {
+    miss_pc = cpu.pc;
+    miss_gen = code_gen;
+  }
+  return (int64_t)budget - left;
+}
+
+#endif
@@ -15,3 +15,6 @@
 
 INC_PATH += $(NEMU_HOME)/src/engine/$(ENGINE)
 DIRS-y += src/engine/$(ENGINE)
+
+# the block engine shares the monitor entry and host calls with the interpreter
+SRCS-$(CONFIG_ENGINE_BLOCK) += src/engine/interpreter/init.c src/engine/interpreter/hostcall.c
@@ -20,6 +20,8 @@ DIRS-BLACKLIST-$(CONFIG_TARGET_AM) += src/monitor/sdb
 
 SHARE = $(if $(CONFIG_TARGET_SHARE),1,0)
 LIBS += $(if $(CONFIG_TARGET_NATIVE_ELF),-lreadline -ldl -pie,)
+LIBS += $(if $(CONFIG_DIFFTEST_PIPELINE)$(CONFIG_LOG_ASYNC)$(CONFIG_HAS_MPE)$(CONFIG_TARGET_SHARE),-lpthread,)
+LIBS += $(if $(CONFIG_LOG_COMPRESS),-lz,)
 
 ifdef mainargs
 ASFLAGS += -DBIN_PATH=\"$(mainargs)\"
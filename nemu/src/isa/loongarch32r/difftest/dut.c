@@ -17,8 +17,22 @@
 #include <cpu/difftest.h>
 #include "../local-include/reg.h"
 
+// the REF only gives the GPRs and pc
+bool isa_difftest_cmpregs(CPU_state *ref_r, CPU_state *dut_r) {
+  for (int i = 0; i < 32; i ++) {
+    if (ref_r->gpr[i] != dut_r->gpr[i]) return false;
+  }
+  return ref_r->pc == dut_r->pc;
+}
+
+// report every register differing from the REF
 bool isa_difftest_checkregs(CPU_state *ref_r, vaddr_t pc) {
-  return false;
+  bool ok = true;
+  for (int i = 0; i < 32; i ++) {
+    ok &= difftest_check_reg(reg_name(i), pc, ref_r->gpr[i], cpu.gpr[i]);
+  }
+  ok &= difftest_check_reg("pc", pc, ref_r->pc, cpu.pc);
+  return ok;
 }
 
 void isa_difftest_attach() {
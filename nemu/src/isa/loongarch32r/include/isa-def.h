@@ -21,6 +21,7 @@
 typedef struct {
   word_t gpr[32];
   vaddr_t pc;
+  bool INTR; // the interrupt line raised by the devices
 } loongarch32r_CPU_state;
 
 // decode
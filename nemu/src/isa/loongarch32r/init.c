@@ -36,6 +36,7 @@ static void restart() {
 
 void init_isa() {
   /* Load built-in image. */
+  pmem_prepare(RESET_VECTOR, sizeof(img));
   memcpy(guest_to_host(RESET_VECTOR), img, sizeof(img));
 
   /* Initialize this virtual computer system. */
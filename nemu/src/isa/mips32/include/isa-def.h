@@ -22,6 +22,7 @@ typedef struct {
   word_t gpr[32];
   word_t pad[5];
   vaddr_t pc;
+  bool INTR; // the interrupt line raised by the devices
 } mips32_CPU_state;
 
 // decode
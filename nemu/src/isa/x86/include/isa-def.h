@@ -72,6 +72,13 @@ typedef struct {
     };
   }eflags;
 
+  // CF, PF, ZF, SF and OF of the last instruction setting them
+  // are computed from `lazy' on demand, see `local-include/reg.h'
+  struct {
+    uint32_t op, width;
+    word_t dest, src, res;
+  } lazy;
+
   struct {
     uint32_t base;
     uint16_t limit;
@@ -79,12 +86,22 @@ typedef struct {
 
   uint16_t cs;
 
+  bool INTR; // the interrupt line raised by the devices
 } x86_CPU_state;
 
 // decode
 typedef struct {
   uint8_t inst[16];
   uint8_t *p_inst;
+  uint8_t opcode;
+  bool is_operand_size_16, has_rep, esc;
+  bool lock; // a locked access to memory, see lock_begin()
+  int8_t rd, rs, gp_idx; // -1 means the operand is in memory
+  // the effective address is disp + base + (index << scale),
+  // it is computed right before executing the instruction
+  int8_t base, index;
+  uint8_t scale;
+  word_t disp, imm;
 } x86_ISADecodeInfo;
 
 enum { R_EAX, R_ECX, R_EDX, R_EBX, R_ESP, R_EBP, R_ESI, R_EDI };
@@ -34,10 +34,19 @@ static void restart() {
   cpu.pc = RESET_VECTOR;
   cpu.cs = 0x8;
   cpu.eflags.val = 0x2;
+  cpu.lazy.op = LAZY_NONE;
   cpu.idtr.base = 0;
   cpu.idtr.limit = 0;
 }
 
+void isa_hart_start(CPU_state *hart, vaddr_t pc, word_t sp) {
+  hart->pc = pc;
+  hart->esp = sp;
+  hart->eflags.val = 0x2;
+  hart->lazy.op = LAZY_NONE;
+  hart->INTR = false;
+}
+
 void init_isa() {
   /* Test the implementation of the `CPU_state' structure. */
   void reg_test();
@@ -46,6 +55,7 @@ void init_isa() {
 #endif
 
   /* Load built-in image. */
+  pmem_prepare(RESET_VECTOR, sizeof(img));
   memcpy(guest_to_host(RESET_VECTOR), img, sizeof(img));
 
   /* Initialize this virtual computer system. */
@@ -17,6 +17,9 @@
 #include <cpu/cpu.h>
 #include <cpu/ifetch.h>
 #include <cpu/decode.h>
+#include <cpu/dcache.h>
+#include <cpu/event.h>
+#include <cpu/mpe.h>
 
 uint32_t pio_read(ioaddr_t addr, int len);
 void pio_write(ioaddr_t addr, int len, uint32_t data);
@@ -78,7 +81,7 @@ static void reg_write(int idx, int width, word_t data) {
   }
 }
 
-static void load_addr(Decode *s, ModR_M *m, word_t *rm_addr) {
+static void load_addr(Decode *s, ModR_M *m) {
   assert(m->mod != 3);
 
   sword_t disp = 0;
@@ -109,31 +112,69 @@ static void load_addr(Decode *s, ModR_M *m, word_t *rm_addr) {
     if (disp_size == 1) { disp = (int8_t)disp; }
   }
 
-  word_t addr = disp;
-  if (base_reg != -1)  addr += reg_l(base_reg);
-  if (index_reg != -1) addr += reg_l(index_reg) << scale;
-  *rm_addr = addr;
+  s->isa.base = base_reg;
+  s->isa.index = index_reg;
+  s->isa.scale = scale;
+  s->isa.disp = disp;
 }
 
-static void decode_rm(Decode *s, int *rm_reg, word_t *rm_addr, int *reg, int width) {
+// compute the effective address with the current register values
+static inline word_t effective_addr(Decode *s) {
+  word_t addr = s->isa.disp;
+  if (s->isa.base != -1)  addr += reg_l(s->isa.base);
+  if (s->isa.index != -1) addr += reg_l(s->isa.index) << s->isa.scale;
+  return addr;
+}
+
+static void decode_rm(Decode *s, int8_t *rm_reg, int8_t *reg, int width) {
   ModR_M m;
   m.val = x86_inst_fetch(s, 1);//读的ModR/M 字节
   if (reg != NULL) *reg = m.reg;//因为Mod_M m是联合体，当给 m.val 赋值的那一刻，m.reg，m.R_M 就已经被填满了
   if (m.mod == 3) *rm_reg = m.R_M;
-  else { load_addr(s, &m, rm_addr); *rm_reg = -1; }
+  else { load_addr(s, &m); *rm_reg = -1; }
 }
 
 #define Rr reg_read
 #define Rw reg_write
+#ifdef CONFIG_HAS_MPE
+/* A locked instruction reads the memory once and writes it back with a
+ * compare-and-swap against the value read. If another hart has written
+ * the memory in between, the write fails and the instruction runs again
+ * from the state saved by lock_begin(), see isa_exec_once().
+ */
+static HART_LOCAL struct {
+  CPU_state cpu;
+  word_t old;
+  bool failed;
+} locked;
+
+static void lock_begin(Decode *s) {
+  s->isa.lock = true;
+  locked.cpu = cpu;
+  locked.failed = false;
+}
+
+static word_t lock_read(vaddr_t addr, int len) {
+  locked.old = vaddr_read(addr, len);
+  return locked.old;
+}
+
+static void lock_write(vaddr_t addr, int len, word_t data) {
+  if (!vaddr_cmpxchg(addr, len, locked.old, data)) locked.failed = true;
+}
+
+#define Mr(a, len) (unlikely(s->isa.lock) ? lock_read(a, len) : vaddr_read(a, len))
+#define Mw(a, len, data) (unlikely(s->isa.lock) ? lock_write(a, len, data) : vaddr_write(a, len, data))
+#else
 #define Mr vaddr_read
 #define Mw vaddr_write
+#endif
 #define RMr(reg, w)  (reg != -1 ? Rr(reg, w) : Mr(addr, w))
 #define RMw(data) do { if (rd != -1) Rw(rd, w, data); else Mw(addr, w, data); } while (0)
 
-#define destr(r)  do { *rd_ = (r); } while (0)
-#define src1r(r)  do { *src1 = Rr(r, w); } while (0)
-#define imm()     do { *imm = x86_inst_fetch(s, w); } while (0)
-#define simm(w)   do { *imm = SEXT(x86_inst_fetch(s, w), w * 8); } while (0)
+#define destr(r)  do { s->isa.rd = (r); } while (0)
+#define imm()     do { s->isa.imm = x86_inst_fetch(s, w); } while (0)
+#define simm(w)   do { s->isa.imm = SEXT(x86_inst_fetch(s, w), w * 8); } while (0)
 #define ddest (rd != -1 ? Rr(rd, w) : Mr(addr, w))//根据目的操作数的mod位是否为3决定读寄存器还是读内存
 #define dsrc1 (rs != -1 ? Rr(rs, w) : Mr(addr, w))//根据源操作数的mod位是否为3决定读寄存器还是读内存
 
@@ -154,88 +195,82 @@ enum {
   TYPE_N, // none
 };
 
+/* The matching body is entered either right after decoding, or directly
+ * through the label recorded in the decode cache. In both cases the
+ * operands are taken from `s->isa', and the values depending on the
+ * machine state are bound right before executing the body.
+ */
 #define INSTPAT_INST(s) opcode
-#define INSTPAT_MATCH(s, name, type, width, ... /* execute body */ ) { \
-  int rd = 0, rs = 0, gp_idx = 0; \
-  word_t src1 = 0, addr = 0, imm = 0; \
-  int w = width == 0 ? (is_operand_size_16 ? 2 : 4) : width; \
-  decode_operand(s, opcode, &rd, &src1, &addr, &rs, &gp_idx, &imm, w, concat(TYPE_, type)); \
+#define INSTPAT_WIDTH(width) (width == 0 ? (is_operand_size_16 ? 2 : 4) : width)
+#define INSTPAT_MATCH(s, name, type, width, ... /* execute body */ ) \
+  INSTPAT_MATCH_ID(__COUNTER__, s, name, type, width, __VA_ARGS__)
+#define INSTPAT_MATCH_ID(id, s, name, type, width, ...) { \
+  if (0) { concat(__instpat_hit_, id): __attribute__((unused)); } \
+  else { \
+    s->isa.opcode = opcode; \
+    s->isa.is_operand_size_16 = is_operand_size_16; \
+    decode_operand(s, INSTPAT_WIDTH(width), concat(TYPE_, type)); \
+    IFDEF(CONFIG_DCACHE, dcache_insert(s, &&concat(__instpat_hit_, id))); \
+  } \
+  __attribute__((unused)) int w = INSTPAT_WIDTH(width); \
+  __attribute__((unused)) int rd = s->isa.rd, rs = s->isa.rs, gp_idx = s->isa.gp_idx; \
+  __attribute__((unused)) word_t addr = effective_addr(s), imm = s->isa.imm, src1 = 0; \
+  bind_operand(s, &src1, &imm, w, concat(TYPE_, type)); \
   s->dnpc = s->snpc; \
   __VA_ARGS__ ; \
 }//action代码会在最后一行代码被执行
 
-static void decode_operand(Decode *s, uint8_t opcode, int *rd_, word_t *src1,
-    word_t *addr, int *rs, int *gp_idx, word_t *imm, int w, int type) {
+static void decode_operand(Decode *s, int w, int type) {
+  uint8_t opcode = s->isa.opcode;
+  s->isa.rd = s->isa.rs = s->isa.gp_idx = 0;
+  s->isa.base = s->isa.index = -1;
+  s->isa.scale = 0;
+  s->isa.disp = s->isa.imm = 0;
   switch (type) {
     case TYPE_I2r:  destr(opcode & 0x7); imm(); break;
     case TYPE_I2a:  destr(R_EAX); imm(); break;
-    case TYPE_G2E:  decode_rm(s, rd_, addr, rs, w); src1r(*rs); break;//reg字段是源寄存器编号,看数据流向可以得出，为0则reg为源。适用范围：ADD, OR, ADC, SBB, AND, SUB, XOR, CMP, MOV。
-    case TYPE_E2G:  decode_rm(s, rs, addr, rd_, w); break;//reg字段是目的寄存器编号，看opcode低位第2位，为1则reg为目的，不适用范围：LEA, PUSH, POP, INC, DEC 等功能单一的指令。
-    case TYPE_I2E:  decode_rm(s, rd_, addr, gp_idx, w); imm(); break;
-    case TYPE_O2a:  destr(R_EAX); *addr = x86_inst_fetch(s, 4); break;
-    case TYPE_a2O:  *rs = R_EAX;  *addr = x86_inst_fetch(s, 4); break;
+    case TYPE_G2E:  decode_rm(s, &s->isa.rd, &s->isa.rs, w); break;//reg字段是源寄存器编号,看数据流向可以得出，为0则reg为源。适用范围：ADD, OR, ADC, SBB, AND, SUB, XOR, CMP, MOV。
+    case TYPE_E2G:  decode_rm(s, &s->isa.rs, &s->isa.rd, w); break;//reg字段是目的寄存器编号，看opcode低位第2位，为1则reg为目的，不适用范围：LEA, PUSH, POP, INC, DEC 等功能单一的指令。
+    case TYPE_I2E:  decode_rm(s, &s->isa.rd, &s->isa.gp_idx, w); imm(); break;
+    case TYPE_O2a:  destr(R_EAX); s->isa.disp = x86_inst_fetch(s, 4); break;
+    case TYPE_a2O:  s->isa.rs = R_EAX; s->isa.disp = x86_inst_fetch(s, 4); break;
     case TYPE_N:    break;
     case TYPE_I:    imm(); break;
     case TYPE_J:    imm(); break;
-    case TYPE_SI2E: decode_rm(s, rd_, addr, gp_idx, w); simm(1);break;
-    case TYPE_E:    decode_rm(s,   rd_, addr, gp_idx, w); *rs = *rd_; break;
-    case TYPE_1_E:  decode_rm(s, rd_, addr, gp_idx, w); *imm = 1; break;
-    case TYPE_cl2E: decode_rm(s, rd_, addr, gp_idx, w); *imm = reg_b(R_CL); break;
-    case TYPE_Ib2E: decode_rm(s, rd_, addr, gp_idx, w); *imm = x86_inst_fetch(s, 1); break;
-    case TYPE_Ib_G2E: decode_rm(s, rd_, addr, rs, w); src1r(*rs); *imm = x86_inst_fetch(s, 1); break;
-    case TYPE_cl_G2E: decode_rm(s, rd_, addr, rs, w); src1r(*rs); *imm = reg_b(R_CL); break;
-    case TYPE_SI_E2G: decode_rm(s, rs, addr, rd_, w); simm(1); break;
-    case TYPE_I_E2G: decode_rm(s, rs, addr, rd_, w); imm(); break;
+    case TYPE_SI2E: decode_rm(s, &s->isa.rd, &s->isa.gp_idx, w); simm(1);break;
+    case TYPE_E:    decode_rm(s, &s->isa.rd, &s->isa.gp_idx, w); s->isa.rs = s->isa.rd; break;
+    case TYPE_1_E:  decode_rm(s, &s->isa.rd, &s->isa.gp_idx, w); s->isa.imm = 1; break;
+    case TYPE_cl2E: decode_rm(s, &s->isa.rd, &s->isa.gp_idx, w); break;
+    case TYPE_Ib2E: decode_rm(s, &s->isa.rd, &s->isa.gp_idx, w); s->isa.imm = x86_inst_fetch(s, 1); break;
+    case TYPE_Ib_G2E: decode_rm(s, &s->isa.rd, &s->isa.rs, w); s->isa.imm = x86_inst_fetch(s, 1); break;
+    case TYPE_cl_G2E: decode_rm(s, &s->isa.rd, &s->isa.rs, w); break;
+    case TYPE_SI_E2G: decode_rm(s, &s->isa.rs, &s->isa.rd, w); simm(1); break;
+    case TYPE_I_E2G: decode_rm(s, &s->isa.rs, &s->isa.rd, w); imm(); break;
     default: panic("Unsupported type = %d", type);
   }
 }
-static inline void update_eflags(int gp_idx, word_t dest, word_t src, word_t res, int width)
-{
-  int shift = width * 8 - 1;
-  if (width == 1) {
-    res &= 0xff;
-    dest &= 0xff;
-    src &= 0xff;
-  }
-  else if (width == 2) {
-    res &= 0xffff;
-    dest &= 0xffff;
-    src &= 0xffff;
-  }
-  
-  cpu.eflags.ZF = (res == 0);
-  cpu.eflags.SF = (res >> shift) & 1;
-
-  // Parity Flag (PF): Set if the least-significant byte of the result contains an even number of 1 bits.
-  uint8_t low_byte = res & 0xff;
-  // Brian Kernighan's algorithm to count set bits
-  int count = 0;
-  for (int i = 0; i < 8; i++) {
-      if ((low_byte >> i) & 1) count++;
-  }
-  cpu.eflags.PF = (count % 2 == 0);
 
-  // CF & OF: 只有加减法需要
-  if (gp_idx == 0) { // ADD
-    cpu.eflags.CF = (res < dest); // 无符号溢出
-    // 有符号溢出: 两个加数符号相同，但与结果符号不同
-    cpu.eflags.OF = (((dest >> shift) & 1) == ((src >> shift) & 1)) && (((dest >> shift) & 1) != ((res >> shift) & 1));
-  }
-  else if (gp_idx == 5 || gp_idx == 7) { // SUB (cmp 也用这个)
-    cpu.eflags.CF = (dest < src); // 无符号借位
-    // 有符号溢出: 减数与被减数符号不同，且结果符号与被减数不同
-    // (例如: 正 - 负 = 负)
-    cpu.eflags.OF = (((dest >> shift) & 1) != ((src >> shift) & 1)) && (((dest >> shift) & 1) != ((res >> shift) & 1));
-  }else if (gp_idx == 4)
-  {
-    cpu.eflags.OF = 0;
-    cpu.eflags.CF = 0;
+// operands read from registers, `type' is a constant in every INSTPAT
+__attribute__((always_inline))
+static inline void bind_operand(Decode *s, word_t *src1, word_t *imm, int w, int type) {
+  switch (type) {
+    case TYPE_G2E: case TYPE_Ib_G2E: *src1 = Rr(s->isa.rs, w); break;
+    case TYPE_cl_G2E: *src1 = Rr(s->isa.rs, w); *imm = reg_b(R_CL); break;
+    case TYPE_cl2E: *imm = reg_b(R_CL); break;
   }
+}
+// the flags are only computed when they are read, see `eflags_sync()'
+static inline void update_eflags(int gp_idx, word_t dest, word_t src, word_t res, int width)
+{
+  int op = (gp_idx == 0 ? LAZY_ADD : (gp_idx == 5 || gp_idx == 7) ? LAZY_SUB : LAZY_LOGIC);
+  eflags_lazy(op, dest, src, res, width);
+}
 
-  if (gp_idx == 1 || gp_idx == 4 || gp_idx == 6) {
-    cpu.eflags.CF = 0;
-    cpu.eflags.OF = 0;
-  }
+// inc and dec set the flags as add and sub, except that CF is kept
+static inline void update_eflags_keep_cf(int gp_idx, word_t dest, word_t src, word_t res, int width)
+{
+  cpu.eflags.CF = eflags_CF();
+  eflags_lazy(gp_idx == 0 ? LAZY_INC : LAZY_DEC, dest, src, res, width);
 }
 
 static inline word_t x86_bsf(word_t value, int width) {
@@ -304,9 +339,7 @@ cpu.esp += w;\
       if (w == 1) res &= 0xff; \
       else if (w == 2) res &= 0xffff; \
       RMw(res); \
-      bool old_cf = cpu.eflags.CF; \
-      update_eflags(0, dest, 1, res, w); \
-      cpu.eflags.CF = old_cf; \
+      update_eflags_keep_cf(0, dest, 1, res, w); \
       break; \
     } \
     case 1: { \
@@ -315,9 +348,7 @@ cpu.esp += w;\
       if (w == 1) res &= 0xff; \
       else if (w == 2) res &= 0xffff; \
       RMw(res); \
-      bool old_cf = cpu.eflags.CF; \
-      update_eflags(5, dest, 1, res, w); \
-      cpu.eflags.CF = old_cf; \
+      update_eflags_keep_cf(5, dest, 1, res, w); \
       break; \
     } \
     default: INV(s->pc); \
@@ -332,9 +363,7 @@ cpu.esp += w;\
       if (w == 1) res &= 0xff; \
       else if (w == 2) res &= 0xffff; \
       RMw(res); \
-      bool old_cf = cpu.eflags.CF; \
-      update_eflags(0, dest, 1, res, w); \
-      cpu.eflags.CF = old_cf; \
+      update_eflags_keep_cf(0, dest, 1, res, w); \
       break; \
     } \
     case 1: { \
@@ -343,9 +372,7 @@ cpu.esp += w;\
       if (w == 1) res &= 0xff; \
       else if (w == 2) res &= 0xffff; \
       RMw(res); \
-      bool old_cf = cpu.eflags.CF; \
-      update_eflags(5, dest, 1, res, w); \
-      cpu.eflags.CF = old_cf; \
+      update_eflags_keep_cf(5, dest, 1, res, w); \
       break; \
     } \
     case 2: \
@@ -374,6 +401,7 @@ cpu.esp += w;\
  */
 
 #define gp2() do { \
+  eflags_sync(); \
   uint32_t count = imm & 0x1f; \
   word_t dest = ddest; \
   word_t res = dest; \
@@ -470,11 +498,11 @@ cpu.esp += w;\
       word_t dest = ddest; \
       word_t res = -dest; \
       RMw(res); \
-      update_eflags(5, 0, dest, res, w); /* neg is like 0 - dest */ \
-      if (dest != 0) cpu.eflags.CF = 1; else cpu.eflags.CF = 0; \
+      update_eflags(5, 0, dest, res, w); /* neg is like 0 - dest, CF = (dest != 0) */ \
       break; \
     } \
     case 4: /* mul */ \
+      eflags_sync(); \
       if (w == 1) { \
         uint16_t res = (uint16_t)reg_b(R_AL) * (uint16_t)ddest; \
         reg_w(R_AX) = res; \
@@ -495,6 +523,7 @@ cpu.esp += w;\
       } \
       break; \
     case 5: /* imul */ \
+      eflags_sync(); \
       if (w == 1) { \
         int16_t res = (int16_t)(int8_t)reg_b(R_AL) * (int16_t)(int8_t)ddest; \
         reg_w(R_AX) = res; \
@@ -572,6 +601,7 @@ cpu.esp += w;\
 } while (0)
 
 #define adc(dest, src) do { \
+  eflags_sync(); \
   word_t d = (dest); \
   word_t carry = cpu.eflags.CF; \
   uint64_t full = (uint64_t)d + (uint64_t)src + carry; \
@@ -588,6 +618,7 @@ cpu.esp += w;\
 } while (0)
 
 #define sbb(dest, src) do { \
+  eflags_sync(); \
   word_t d = (dest); \
   word_t borrow = cpu.eflags.CF; \
   uint64_t sub = (uint64_t)src + borrow; \
@@ -613,34 +644,48 @@ word_t res = dest - src; \
 update_eflags(5, dest, src, res, w); \
 } while (0)
 
-void _2byte_esc(Decode *s, bool is_operand_size_16) {
-  uint8_t opcode = x86_inst_fetch(s, 1);
-  INSTPAT_START();
+#define cmpxchg() do { \
+word_t dest = ddest; \
+word_t eax = Rr(R_EAX, w); \
+cmp(eax, dest); \
+if (eax == dest) RMw(src1); \
+else Rw(R_EAX, w, dest); \
+} while (0)
+
+void _2byte_esc(Decode *s, bool is_operand_size_16, const void *hit) {
+  uint8_t opcode = 0;
+  INSTPAT_TABLE_START(, 7, 0);
+  if (hit != NULL) { opcode = s->isa.opcode; goto *hit; }
+  s->isa.esc = true;
+  opcode = x86_inst_fetch(s, 1);
+  INSTPAT_DISPATCH();
 
   INSTPAT("1001 ????", setcc, E, 1, {
     int cond = opcode & 0xf;
     bool set = false;
     switch (cond) {
-      case 0: set = cpu.eflags.OF; break;
-      case 1: set = !cpu.eflags.OF; break;
-      case 2: set = cpu.eflags.CF; break;
-      case 3: set = !cpu.eflags.CF; break;
-      case 4: set = cpu.eflags.ZF; break;
-      case 5: set = !cpu.eflags.ZF; break;
-      case 6: set = cpu.eflags.CF || cpu.eflags.ZF; break;
-      case 7: set = !cpu.eflags.CF && !cpu.eflags.ZF; break;
-      case 8: set = cpu.eflags.SF; break;
-      case 9: set = !cpu.eflags.SF; break;
-      case 10: set = cpu.eflags.PF; break;
-      case 11: set = !cpu.eflags.PF; break;
-      case 12: set = cpu.eflags.SF != cpu.eflags.OF; break;
-      case 13: set = cpu.eflags.SF == cpu.eflags.OF; break;
-      case 14: set = cpu.eflags.ZF || (cpu.eflags.SF != cpu.eflags.OF); break;
-      case 15: set = !cpu.eflags.ZF && (cpu.eflags.SF == cpu.eflags.OF); break;
+      case 0: set = eflags_OF(); break;
+      case 1: set = !eflags_OF(); break;
+      case 2: set = eflags_CF(); break;
+      case 3: set = !eflags_CF(); break;
+      case 4: set = eflags_ZF(); break;
+      case 5: set = !eflags_ZF(); break;
+      case 6: set = eflags_CF() || eflags_ZF(); break;
+      case 7: set = !eflags_CF() && !eflags_ZF(); break;
+      case 8: set = eflags_SF(); break;
+      case 9: set = !eflags_SF(); break;
+      case 10: set = eflags_PF(); break;
+      case 11: set = !eflags_PF(); break;
+      case 12: set = eflags_SF() != eflags_OF(); break;
+      case 13: set = eflags_SF() == eflags_OF(); break;
+      case 14: set = eflags_ZF() || (eflags_SF() != eflags_OF()); break;
+      case 15: set = !eflags_ZF() && (eflags_SF() == eflags_OF()); break;
     }
     RMw(set ? 1 : 0);
   });
 
+  INSTPAT("1011 0000", cmpxchg, G2E, 1, cmpxchg());
+  INSTPAT("1011 0001", cmpxchg, G2E, 0, cmpxchg());
   INSTPAT("1011 0110", movzx, E2G, 0, {
     word_t src = (rs != -1 ? Rr(rs, 1) : Mr(addr, 1)); // 强制宽 1
     Rw(rd, w, src); // 零扩展是自动的，因为 src 是 word_t(uint32)，读出来高位就是0
@@ -658,6 +703,7 @@ void _2byte_esc(Decode *s, bool is_operand_size_16) {
     Rw(rd, w, SEXT(src, 16));
   });
   INSTPAT("1011 1100", bsf, E2G, 0, {
+    eflags_sync();
     word_t src = dsrc1;
     if (src == 0) {
       cpu.eflags.ZF = 1;
@@ -667,6 +713,7 @@ void _2byte_esc(Decode *s, bool is_operand_size_16) {
     }
   });
   INSTPAT("1011 1101", bsr, E2G, 0, {
+    eflags_sync();
     word_t src = dsrc1;
     if (src == 0) {
       cpu.eflags.ZF = 1;
@@ -676,6 +723,7 @@ void _2byte_esc(Decode *s, bool is_operand_size_16) {
     }
   });
   INSTPAT("1010 0101", shld, cl_G2E, 0, {
+    eflags_sync();
     word_t count = imm & 0x1f;
     if (count > 0) {
       word_t dest = ddest;
@@ -688,6 +736,7 @@ void _2byte_esc(Decode *s, bool is_operand_size_16) {
     }
   });
   INSTPAT("1010 0100", shld, Ib_G2E, 0, {
+    eflags_sync();
     word_t count = imm & 0x1f;
     if (count > 0) {
       word_t dest = ddest;
@@ -700,6 +749,7 @@ void _2byte_esc(Decode *s, bool is_operand_size_16) {
     }
   });
   INSTPAT("1010 1101", shrd, cl_G2E, 0, {
+    eflags_sync();
     word_t count = imm & 0x1f;
     if (count > 0) {
       word_t dest = ddest;
@@ -712,6 +762,7 @@ void _2byte_esc(Decode *s, bool is_operand_size_16) {
     }
   });
   INSTPAT("1010 1100", shrd, Ib_G2E, 0, {
+    eflags_sync();
     word_t count = imm & 0x1f;
     if (count > 0) {
       word_t dest = ddest;
@@ -724,6 +775,7 @@ void _2byte_esc(Decode *s, bool is_operand_size_16) {
     }
   });
   INSTPAT("1010 0011", bt, G2E, 0, {
+    eflags_sync();
     word_t src = dsrc1;
     if (rd == -1) {
       word_t byte_addr = addr + (sword_t)src / 8;
@@ -735,6 +787,7 @@ void _2byte_esc(Decode *s, bool is_operand_size_16) {
     }
   });
   INSTPAT("1011 1010", gp7, Ib2E, 0, {
+    eflags_sync();
     word_t dest = ddest;
     word_t src = imm & (w * 8 - 1);
     switch (gp_idx) {
@@ -746,6 +799,7 @@ void _2byte_esc(Decode *s, bool is_operand_size_16) {
     }
   });
   INSTPAT("1010 1111", imul2, E2G, 0, {
+    eflags_sync();
     word_t src = dsrc1;
     word_t dest = ddest;
     int64_t src_s, dest_s;
@@ -766,22 +820,22 @@ void _2byte_esc(Decode *s, bool is_operand_size_16) {
     int cond = opcode & 0xf;
     bool jump = false;
     switch(cond) {
-      case 0: jump = cpu.eflags.OF; break; // jo
-      case 1: jump = !cpu.eflags.OF; break; // jno
-      case 2: jump = cpu.eflags.CF; break; // jb
-      case 3: jump = !cpu.eflags.CF; break; // jae
-      case 4: jump = cpu.eflags.ZF; break; // je
-      case 5: jump = !cpu.eflags.ZF; break; // jne
-      case 6: jump = cpu.eflags.CF || cpu.eflags.ZF; break; // jbe
-      case 7: jump = !cpu.eflags.CF && !cpu.eflags.ZF; break; // ja
-      case 8: jump = cpu.eflags.SF; break; // js
-      case 9: jump = !cpu.eflags.SF; break; // jns
-      case 10: jump = cpu.eflags.PF; break; // jp
-      case 11: jump = !cpu.eflags.PF; break; // jnp
-      case 12: jump = cpu.eflags.SF != cpu.eflags.OF; break; // jl
-      case 13: jump = cpu.eflags.SF == cpu.eflags.OF; break; // jge
-      case 14: jump = cpu.eflags.ZF || (cpu.eflags.SF != cpu.eflags.OF); break; // jle
-      case 15: jump = !cpu.eflags.ZF && (cpu.eflags.SF == cpu.eflags.OF); break; // jg
+      case 0: jump = eflags_OF(); break; // jo
+      case 1: jump = !eflags_OF(); break; // jno
+      case 2: jump = eflags_CF(); break; // jb
+      case 3: jump = !eflags_CF(); break; // jae
+      case 4: jump = eflags_ZF(); break; // je
+      case 5: jump = !eflags_ZF(); break; // jne
+      case 6: jump = eflags_CF() || eflags_ZF(); break; // jbe
+      case 7: jump = !eflags_CF() && !eflags_ZF(); break; // ja
+      case 8: jump = eflags_SF(); break; // js
+      case 9: jump = !eflags_SF(); break; // jns
+      case 10: jump = eflags_PF(); break; // jp
+      case 11: jump = !eflags_PF(); break; // jnp
+      case 12: jump = eflags_SF() != eflags_OF(); break; // jl
+      case 13: jump = eflags_SF() == eflags_OF(); break; // jge
+      case 14: jump = eflags_ZF() || (eflags_SF() != eflags_OF()); break; // jle
+      case 15: jump = !eflags_ZF() && (eflags_SF() == eflags_OF()); break; // jg
     }
     if (jump) {
       if (w == 2) s->dnpc += (sword_t)(int16_t)imm;
@@ -803,28 +857,40 @@ void _2byte_esc(Decode *s, bool is_operand_size_16) {
   INSTPAT_END();
 }
 
-int isa_exec_once(Decode *s) {
+static int decode_exec(Decode *s, const void *hit) {
   bool is_operand_size_16 = false;
-  bool has_rep = false;
   uint8_t opcode = 0;
 
+  INSTPAT_TABLE_START(, 7, 0);
+  if (hit != NULL) {
+    opcode = s->isa.opcode;
+    is_operand_size_16 = s->isa.is_operand_size_16;
+    if (!s->isa.esc) goto *hit;
+    _2byte_esc(s, is_operand_size_16, hit);
+    return 0;
+  }
+  s->isa.has_rep = false;
+  s->isa.lock = false;
+  s->isa.esc = false;
+
 again:
   opcode = x86_inst_fetch(s, 1);
-
-  INSTPAT_START();
+  INSTPAT_DISPATCH();
 
   //INSTPAT(模式, 名称, 译码类型, 宽度标志, 执行逻辑);
   /* rd, rs, gp_idx, src1, addr, imm, w这些变量在INSTPAT_MATCH宏中已经被填充了，可以直接用 */
 
-  INSTPAT("0000 1111", 2byte_esc, N,    0, _2byte_esc(s, is_operand_size_16));
+  INSTPAT("0000 1111", 2byte_esc, N,    0, _2byte_esc(s, is_operand_size_16, NULL));
 
   INSTPAT("0110 0110", data_size, N,    0, is_operand_size_16 = true; goto again;);
 
-  INSTPAT("1111 0011", rep,       N,    0, has_rep = true; goto again;);
+  INSTPAT("1111 0011", rep,       N,    0, s->isa.has_rep = true; goto again;);
+  INSTPAT("1111 0000", lock,      N,    0, IFDEF(CONFIG_HAS_MPE, lock_begin(s)); goto again;);
   INSTPAT("1001 0000", nop,       N,    0, );
   INSTPAT("0011 1010", cmp,       E2G,  1, cmp(ddest, dsrc1));
-  INSTPAT("1000 0110", xchg,      G2E,  1, { word_t temp = ddest; RMw(src1); Rw(rd, 1, temp); });
-  INSTPAT("1000 0111", xchg,      G2E,  0, { word_t temp = ddest; RMw(src1); Rw(rd, w, temp); });
+  // xchg with memory is always locked
+  INSTPAT("1000 0110", xchg,      G2E,  1, { IFDEF(CONFIG_HAS_MPE, if (rd == -1) lock_begin(s)); word_t temp = ddest; RMw(src1); Rw(rs, 1, temp); });
+  INSTPAT("1000 0111", xchg,      G2E,  0, { IFDEF(CONFIG_HAS_MPE, if (rd == -1) lock_begin(s)); word_t temp = ddest; RMw(src1); Rw(rs, w, temp); });
   INSTPAT("1001 0???", xchg,      N,    0, { int reg = opcode & 0x7; word_t temp = reg_read(reg, w); reg_write(reg, w, reg_read(R_EAX, w)); reg_write(R_EAX, w, temp); });
   INSTPAT("1001 1000", cbw,       N,    0, { if (is_operand_size_16) reg_w(R_AX) = (int16_t)(int8_t)reg_b(R_AL); else reg_l(R_EAX) = (int32_t)(int16_t)reg_w(R_AX); });
 
@@ -856,6 +922,7 @@ again:
   INSTPAT("0011 0100", xor,       I2a,  1, xor(Rr(R_EAX, 1), imm));
   INSTPAT("0011 0101", xor,       I2a,  0, xor(Rr(R_EAX, w), imm));
   INSTPAT("0110 1011", imul3,     SI_E2G, 0, {
+    eflags_sync();
     word_t src = (rs != -1 ? Rr(rs, w) : Mr(addr, w));
     int64_t full = (int64_t)(int32_t)src * (int64_t)(int32_t)imm;
     word_t res = (word_t)full;
@@ -863,6 +930,7 @@ again:
     cpu.eflags.CF = cpu.eflags.OF = (full != (int64_t)(int32_t)res);
   });
   INSTPAT("0110 1001", imul3,     I_E2G, 0, {
+    eflags_sync();
     word_t src = (rs != -1 ? Rr(rs, w) : Mr(addr, w));
     int64_t full = (int64_t)(int32_t)src * (int64_t)(int32_t)imm;
     word_t res = (word_t)full;
@@ -892,6 +960,8 @@ again:
     pop(s->dnpc);
     pop(cpu.cs);
     pop(cpu.eflags.val);
+    cpu.lazy.op = LAZY_NONE;
+    if (cpu.eflags.IF) event_check_intr();
     etrace_write(INTR_EMPTY, s->pc, s->dnpc);
   });
   INSTPAT("1100 1100", nemu_trap, N,    0, NEMUTRAP(s->pc, cpu.eax));
@@ -952,33 +1022,32 @@ again:
   INSTPAT("0001 1011", sbb,       E2G,  0, sbb(ddest, dsrc1));
   INSTPAT("0001 1100", sbb,       I2a,  1, sbb(Rr(R_EAX, 1), imm));
   INSTPAT("0001 1101", sbb,       I2a,  0, sbb(Rr(R_EAX, w), imm));
-  INSTPAT("1001 0000", nop,       N,    0, );
 
-  INSTPAT("1010 0100", movs,      N,    1, { if (has_rep) { while (cpu.ecx != 0) { Mw(cpu.edi, 1, Mr(cpu.esi, 1)); cpu.esi += (cpu.eflags.DF ? -1 : 1); cpu.edi += (cpu.eflags.DF ? -1 : 1); cpu.ecx --; } } else { Mw(cpu.edi, 1, Mr(cpu.esi, 1)); cpu.esi += (cpu.eflags.DF ? -1 : 1); cpu.edi += (cpu.eflags.DF ? -1 : 1); } });
-  INSTPAT("1010 0101", movs,      N,    0, { if (has_rep) { while (cpu.ecx != 0) { Mw(cpu.edi, w, Mr(cpu.esi, w)); cpu.esi += (cpu.eflags.DF ? -w : w); cpu.edi += (cpu.eflags.DF ? -w : w); cpu.ecx --; } } else { Mw(cpu.edi, w, Mr(cpu.esi, w)); cpu.esi += (cpu.eflags.DF ? -w : w); cpu.edi += (cpu.eflags.DF ? -w : w); } });
-  INSTPAT("1010 1010", stos,      N,    1, { if (has_rep) { while (cpu.ecx != 0) { Mw(cpu.edi, 1, reg_b(R_AL)); cpu.edi += (cpu.eflags.DF ? -1 : 1); cpu.ecx --; } } else { Mw(cpu.edi, 1, reg_b(R_AL)); cpu.edi += (cpu.eflags.DF ? -1 : 1); } });
-  INSTPAT("1010 1011", stos,      N,    0, { if (has_rep) { while (cpu.ecx != 0) { Mw(cpu.edi, w, reg_read(R_EAX, w)); cpu.edi += (cpu.eflags.DF ? -w : w); cpu.ecx --; } } else { Mw(cpu.edi, w, reg_read(R_EAX, w)); cpu.edi += (cpu.eflags.DF ? -w : w); } });
+  INSTPAT("1010 0100", movs,      N,    1, { if (s->isa.has_rep) { while (cpu.ecx != 0) { Mw(cpu.edi, 1, Mr(cpu.esi, 1)); cpu.esi += (cpu.eflags.DF ? -1 : 1); cpu.edi += (cpu.eflags.DF ? -1 : 1); cpu.ecx --; } } else { Mw(cpu.edi, 1, Mr(cpu.esi, 1)); cpu.esi += (cpu.eflags.DF ? -1 : 1); cpu.edi += (cpu.eflags.DF ? -1 : 1); } });
+  INSTPAT("1010 0101", movs,      N,    0, { if (s->isa.has_rep) { while (cpu.ecx != 0) { Mw(cpu.edi, w, Mr(cpu.esi, w)); cpu.esi += (cpu.eflags.DF ? -w : w); cpu.edi += (cpu.eflags.DF ? -w : w); cpu.ecx --; } } else { Mw(cpu.edi, w, Mr(cpu.esi, w)); cpu.esi += (cpu.eflags.DF ? -w : w); cpu.edi += (cpu.eflags.DF ? -w : w); } });
+  INSTPAT("1010 1010", stos,      N,    1, { if (s->isa.has_rep) { while (cpu.ecx != 0) { Mw(cpu.edi, 1, reg_b(R_AL)); cpu.edi += (cpu.eflags.DF ? -1 : 1); cpu.ecx --; } } else { Mw(cpu.edi, 1, reg_b(R_AL)); cpu.edi += (cpu.eflags.DF ? -1 : 1); } });
+  INSTPAT("1010 1011", stos,      N,    0, { if (s->isa.has_rep) { while (cpu.ecx != 0) { Mw(cpu.edi, w, reg_read(R_EAX, w)); cpu.edi += (cpu.eflags.DF ? -w : w); cpu.ecx --; } } else { Mw(cpu.edi, w, reg_read(R_EAX, w)); cpu.edi += (cpu.eflags.DF ? -w : w); } });
 
   INSTPAT("0111 ????", jcc, J, 1, {
     int cond = opcode & 0xf;
     bool jump = false;
     switch(cond) {
-      case 0: jump = cpu.eflags.OF; break; // jo
-      case 1: jump = !cpu.eflags.OF; break; // jno
-      case 2: jump = cpu.eflags.CF; break; // jb
-      case 3: jump = !cpu.eflags.CF; break; // jae
-      case 4: jump = cpu.eflags.ZF; break; // je
-      case 5: jump = !cpu.eflags.ZF; break; // jne
-      case 6: jump = cpu.eflags.CF || cpu.eflags.ZF; break; // jbe
-      case 7: jump = !cpu.eflags.CF && !cpu.eflags.ZF; break; // ja
-      case 8: jump = cpu.eflags.SF; break; // js
-      case 9: jump = !cpu.eflags.SF; break; // jns
+      case 0: jump = eflags_OF(); break; // jo
+      case 1: jump = !eflags_OF(); break; // jno
+      case 2: jump = eflags_CF(); break; // jb
+      case 3: jump = !eflags_CF(); break; // jae
+      case 4: jump = eflags_ZF(); break; // je
+      case 5: jump = !eflags_ZF(); break; // jne
+      case 6: jump = eflags_CF() || eflags_ZF(); break; // jbe
+      case 7: jump = !eflags_CF() && !eflags_ZF(); break; // ja
+      case 8: jump = eflags_SF(); break; // js
+      case 9: jump = !eflags_SF(); break; // jns
       case 10: panic("JP not implemented"); break; // jp
       case 11: panic("JNP not implemented"); break; // jnp
-      case 12: jump = cpu.eflags.SF != cpu.eflags.OF; break; // jl
-      case 13: jump = cpu.eflags.SF == cpu.eflags.OF; break; // jge
-      case 14: jump = cpu.eflags.ZF || (cpu.eflags.SF != cpu.eflags.OF); break; // jle
-      case 15: jump = !cpu.eflags.ZF && (cpu.eflags.SF == cpu.eflags.OF); break; // jg
+      case 12: jump = eflags_SF() != eflags_OF(); break; // jl
+      case 13: jump = eflags_SF() == eflags_OF(); break; // jge
+      case 14: jump = eflags_ZF() || (eflags_SF() != eflags_OF()); break; // jle
+      case 15: jump = !eflags_ZF() && (eflags_SF() == eflags_OF()); break; // jg
     }
     if (jump) s->dnpc += (int8_t)imm;
   });
@@ -995,18 +1064,14 @@ again:
   word_t src = Rr(reg, w);
   word_t res = src + 1;
   Rw(reg, w, res);
-  bool old_cf = cpu.eflags.CF; // 1. 备份 CF
-  update_eflags(0, src, 1, res, w); // 2. 用 ADD 的逻辑更新所有标志位 (GP_IDX=0)
-  cpu.eflags.CF = old_cf; // 3. 恢复 CF，假装无事发生
+  update_eflags_keep_cf(0, src, 1, res, w);
   });
   INSTPAT("0100 1???", dec,       N,    0, {
   int reg = opcode & 0x7;
   word_t src = Rr(reg, w);
   word_t res = src - 1;
   Rw(reg, w, res);
-  bool old_cf = cpu.eflags.CF;
-  update_eflags(5, src, 1, res, w); // SUB logic
-  cpu.eflags.CF = old_cf;
+  update_eflags_keep_cf(5, src, 1, res, w); // SUB logic
   });
   INSTPAT("0010 1000", sub,       G2E,  1, {
   word_t dest = ddest;
@@ -1065,10 +1130,10 @@ again:
     push(cpu.edi);
   });
 
-  INSTPAT("1111 1000", clc, N, 0, cpu.eflags.CF = 0);
-  INSTPAT("1111 1001", stc, N, 0, cpu.eflags.CF = 1);
+  INSTPAT("1111 1000", clc, N, 0, { eflags_sync(); cpu.eflags.CF = 0; });
+  INSTPAT("1111 1001", stc, N, 0, { eflags_sync(); cpu.eflags.CF = 1; });
   INSTPAT("1111 1010", cli, N, 0, cpu.eflags.IF = 0);
-  INSTPAT("1111 1011", sti, N, 0, cpu.eflags.IF = 1);
+  INSTPAT("1111 1011", sti, N, 0, cpu.eflags.IF = 1; event_check_intr());
   INSTPAT("1111 1100", cld, N, 0, cpu.eflags.DF = 0);
   INSTPAT("1111 1101", std, N, 0, cpu.eflags.DF = 1);
   INSTPAT("???? ????", inv,       N,    0, INV(s->pc));//通配符
@@ -1076,3 +1141,31 @@ again:
 
   return 0;
 }
+
+#ifdef CONFIG_DCACHE
+int isa_exec_cached(Decode *s, const void *handler) {
+  return decode_exec(s, handler);
+}
+#endif
+
+int isa_exec_once(Decode *s) {
+#ifdef CONFIG_DCACHE
+  DCacheEntry *e = dcache_lookup(s->pc);
+  if (e != NULL) {
+    s->snpc = e->snpc;
+    s->isa = e->isa;
+    return decode_exec(s, e->handler);
+  }
+#endif
+#ifdef CONFIG_HAS_MPE
+  int ret = decode_exec(s, NULL);
+  while (unlikely(s->isa.lock && locked.failed)) {
+    cpu = locked.cpu;
+    s->snpc = s->pc;
+    ret = decode_exec(s, NULL);
+  }
+  return ret;
+#else
+  return decode_exec(s, NULL);
+#endif
+}
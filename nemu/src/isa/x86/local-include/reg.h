@@ -43,6 +43,77 @@ static inline const char* reg_name(int index, int width) {
   }
 }
 
+/* An arithmetic instruction only records its operands and result in
+ * `cpu.lazy', the flags are computed when they are read. `cpu.eflags'
+ * holds CF, PF, ZF, SF and OF only when `cpu.lazy.op' is LAZY_NONE, so
+ * any code accessing them there directly should call `eflags_sync()'
+ * first. Other flags (IF, DF) are always kept in `cpu.eflags'.
+ */
+enum { LAZY_NONE, LAZY_ADD, LAZY_SUB, LAZY_LOGIC, LAZY_INC, LAZY_DEC };
+
+static inline void eflags_lazy(int op, word_t dest, word_t src, word_t res, int width) {
+  cpu.lazy.op = op;
+  cpu.lazy.width = width;
+  cpu.lazy.dest = dest;
+  cpu.lazy.src = src;
+  cpu.lazy.res = res;
+}
+
+static inline word_t lazy_mask() {
+  return cpu.lazy.width == 4 ? 0xffffffff : (1u << (cpu.lazy.width * 8)) - 1;
+}
+
+static inline word_t lazy_msb(word_t x) {
+  return (x >> (cpu.lazy.width * 8 - 1)) & 1;
+}
+
+static inline bool eflags_ZF() {
+  if (cpu.lazy.op == LAZY_NONE) return cpu.eflags.ZF;
+  return (cpu.lazy.res & lazy_mask()) == 0;
+}
+
+static inline bool eflags_SF() {
+  if (cpu.lazy.op == LAZY_NONE) return cpu.eflags.SF;
+  return lazy_msb(cpu.lazy.res);
+}
+
+static inline bool eflags_PF() {
+  if (cpu.lazy.op == LAZY_NONE) return cpu.eflags.PF;
+  return !__builtin_parity(cpu.lazy.res & 0xff);
+}
+
+static inline bool eflags_CF() {
+  word_t mask = lazy_mask();
+  switch (cpu.lazy.op) {
+    case LAZY_ADD: return (cpu.lazy.res & mask) < (cpu.lazy.dest & mask);
+    case LAZY_SUB: return (cpu.lazy.dest & mask) < (cpu.lazy.src & mask);
+    case LAZY_LOGIC: return 0;
+    default: return cpu.eflags.CF; // inc and dec keep CF
+  }
+}
+
+static inline bool eflags_OF() {
+  word_t d = lazy_msb(cpu.lazy.dest), s = lazy_msb(cpu.lazy.src), r = lazy_msb(cpu.lazy.res);
+  switch (cpu.lazy.op) {
+    case LAZY_ADD: case LAZY_INC: return d == s && d != r;
+    case LAZY_SUB: case LAZY_DEC: return d != s && d != r;
+    case LAZY_LOGIC: return 0;
+    default: return cpu.eflags.OF;
+  }
+}
+
+// write the pending flags back to `cpu.eflags'
+static inline void eflags_sync() {
+  if (cpu.lazy.op == LAZY_NONE) return;
+  bool CF = eflags_CF(), PF = eflags_PF(), ZF = eflags_ZF(), SF = eflags_SF(), OF = eflags_OF();
+  cpu.eflags.CF = CF;
+  cpu.eflags.PF = PF;
+  cpu.eflags.ZF = ZF;
+  cpu.eflags.SF = SF;
+  cpu.eflags.OF = OF;
+  cpu.lazy.op = LAZY_NONE;
+}
+
 static inline const char* sreg_name(int index) {
   const char *name[] = { "es", "cs", "ss", "ds", "fs", "gs" };
   IFDEF(CONFIG_RT_CHECK, assert(index >= 0 && index < ARRLEN(name)));
@@ -67,6 +67,7 @@ void isa_reg_display() {
     printf("%-3s = 0x%08x\n", regsl[i], reg_l(i));
   }
   printf("pc  = 0x%08x\n", cpu.pc);
+  eflags_sync();
   printf("eflags = 0x%08x [ CF=%d ZF=%d SF=%d OF=%d IF=%d ]\n",
          cpu.eflags.val,
          cpu.eflags.CF,
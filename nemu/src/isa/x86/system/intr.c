@@ -15,6 +15,7 @@
 
 #include <isa.h>
 #include <memory/vaddr.h>
+#include "../local-include/reg.h"
 
 #include "../../../../../abstract-machine/am/src/x86/x86.h"
 
@@ -24,6 +25,7 @@ word_t isa_raise_intr(word_t NO, vaddr_t ret_addr) {
   /* TODO: Trigger an interrupt/exception with ``NO''.
    * That is, use ``NO'' to index the IDT.
    */
+  eflags_sync();
   push32(cpu.eflags.val);
   push32(cpu.cs);
   push32(ret_addr);
@@ -50,6 +52,11 @@ word_t isa_raise_intr(word_t NO, vaddr_t ret_addr) {
   return target_addr;
 }
 
+// the line is the timer interrupt, taken when IF is set
 word_t isa_query_intr() {
+  if (cpu.INTR && cpu.eflags.IF) {
+    cpu.INTR = false;
+    return T_IRQ0 + IRQ_TIMER;
+  }
   return INTR_EMPTY;
 }
@@ -17,6 +17,11 @@
 #include <memory/paddr.h>
 #include <memory/vaddr.h>
 
+/* Not used yet, isa_mmu_check() always returns MMU_DIRECT and the TLB
+ * only caches the identity mapping. With paging, the walker here should
+ * call paddr_mark_pt_page() for each page table it reads, and a write to
+ * CR3 should call tlb_flush(), or mpe_tlb_flush() with multiple harts.
+ */
 paddr_t isa_mmu_translate(vaddr_t vaddr, int len, int type) {
   return MEM_RET_FAIL;
 }
@@ -15,8 +15,19 @@
 
 #include <memory/host.h>
 #include <memory/paddr.h>
+#include <memory/vaddr.h>
 #include <device/mmio.h>
+#include <cpu/dcache.h>
+#include <cpu/snapshot.h>
+#include <cpu/difftest.h>
 #include <isa.h>
+#include <cpu/mpe.h>
+
+#ifndef CONFIG_TARGET_AM
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
 #if   defined(CONFIG_PMEM_MALLOC)
 static uint8_t *pmem = NULL;
@@ -24,14 +35,92 @@ static uint8_t *pmem = NULL;
 static uint8_t pmem[CONFIG_MSIZE] PG_ALIGN = {};
 #endif
 
+// may be set smaller than CONFIG_MSIZE with --msize
+size_t pmem_size = CONFIG_MSIZE;
+
 uint8_t* guest_to_host(paddr_t paddr) { return pmem + paddr - CONFIG_MBASE; }
 paddr_t host_to_guest(uint8_t *haddr) { return haddr - pmem + CONFIG_MBASE; }
 /*
- * paddr - CONFIG_MBASE 算出了目标地址在 pmem 数组中的索引。
  * paddr - CONFIG_MBASE 算出了目标地址在 pmem 数组中的索引。
  */
 
 
+// pages read by watchpoint expressions
+static uint8_t watch_page[CONFIG_MSIZE >> PAGE_SHIFT] = {};
+static bool has_watch_page = false;
+bool paddr_watch_hit = false;
+
+void paddr_watch(paddr_t addr, int len) {
+  assert(in_pmem(addr) && in_pmem(addr + len - 1));
+  watch_page[pmem_page(addr)] = 1;
+  watch_page[pmem_last_page(addr, len)] = 1;
+  has_watch_page = true;
+  MUXDEF(CONFIG_HAS_MPE, mpe_tlb_flush(), tlb_flush_write());
+}
+
+void paddr_unwatch_all() {
+  if (has_watch_page) memset(watch_page, 0, sizeof(watch_page));
+  has_watch_page = false;
+}
+
+static inline void check_watch(paddr_t addr, int len) {
+  if (unlikely(has_watch_page) &&
+      (watch_page[pmem_page(addr)] | watch_page[pmem_last_page(addr, len)])) {
+    paddr_watch_hit = true;
+  }
+}
+
+// pages holding page tables of the guest
+static uint8_t pt_page[CONFIG_MSIZE >> PAGE_SHIFT] = {};
+
+void paddr_mark_pt_page(paddr_t addr) {
+  uint8_t *p = &pt_page[pmem_page(addr)];
+  if (*p == 0) {
+    *p = 1;
+    MUXDEF(CONFIG_HAS_MPE, mpe_tlb_flush(), tlb_flush_write());
+  }
+}
+
+static inline void check_pt_page(paddr_t addr, int len) {
+  if (unlikely(pt_page[pmem_page(addr)] | pt_page[pmem_last_page(addr, len)])) {
+    // the TLB of every hart may map the page with the old entry
+    MUXDEF(CONFIG_HAS_MPE, mpe_tlb_flush(), tlb_flush());
+  }
+}
+
+#ifdef CONFIG_MEM_RANDOM
+// pages never accessed, they get filled with `pmem_fill_byte' on the first
+// access so that the untouched part of pmem costs no host memory
+uint8_t pmem_fresh_page[CONFIG_MSIZE >> PAGE_SHIFT] = {};
+uint8_t pmem_fill_byte = 0;
+
+void pmem_prepare(paddr_t addr, size_t len) {
+  if (len == 0) return;
+  uint32_t idx0 = pmem_page(addr);
+  uint32_t idx1 = pmem_last_page(addr, len);
+  for (uint32_t idx = idx0; idx <= idx1; idx ++) {
+    if (pmem_fresh_page[idx]) {
+      memset(pmem + ((size_t)idx << PAGE_SHIFT), pmem_fill_byte, PAGE_SIZE);
+      pmem_fresh_page[idx] = 0;
+    }
+  }
+}
+
+static inline void check_fresh(paddr_t addr, int len) {
+  if (unlikely(pmem_fresh_page[pmem_page(addr)] | pmem_fresh_page[pmem_last_page(addr, len)])) {
+    pmem_prepare(addr, len);
+  }
+}
+#endif
+
+bool paddr_plain_page(paddr_t addr) {
+  uint32_t idx = pmem_page(addr);
+  return !(watch_page[idx] | pt_page[idx]
+      IFDEF(CONFIG_DCACHE, | dcache_code_page[idx])
+      IFDEF(CONFIG_SNAPSHOT, | snapshot_cow_page[idx])
+      IFDEF(CONFIG_DIFFTEST, | !difftest_saved_page[idx]));
+}
+
 static word_t pmem_read(paddr_t addr, int len) {
   word_t ret = host_read(guest_to_host(addr), len);
   return ret;
@@ -46,17 +135,88 @@ static void out_of_bound(paddr_t addr) {
       addr, PMEM_LEFT, PMEM_RIGHT, cpu.pc);
 }
 
-void init_mem() {
+// `fill_random' is false if pmem will be replaced by a snapshot
+void init_mem(bool fill_random) {
+  Assert(pmem_size > 0 && pmem_size <= CONFIG_MSIZE && (pmem_size & PAGE_MASK) == 0,
+      "memory size should be a multiple of the page size and at most " FMT_PADDR,
+      (paddr_t)CONFIG_MSIZE);
+  Assert(CONFIG_PC_RESET_OFFSET < pmem_size, "the reset vector is out of memory");
 #if   defined(CONFIG_PMEM_MALLOC)
-  pmem = malloc(CONFIG_MSIZE);
+#ifdef CONFIG_TARGET_AM
+  pmem = malloc(pmem_size);
   assert(pmem);
+#else
+  // anonymous pages are only allocated by the host when touched
+  pmem = mmap(NULL, pmem_size, PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  Assert(pmem != MAP_FAILED, "fail to allocate pmem");
+#endif
+#endif
+#if !defined(CONFIG_TARGET_AM) && defined(MADV_HUGEPAGE)
+  // fewer host TLB misses for a guest touching memory all over
+  madvise(pmem, pmem_size, MADV_HUGEPAGE);
+#endif
+#ifdef CONFIG_MEM_RANDOM
+  if (fill_random) {
+    pmem_fill_byte = rand();
+    memset(pmem_fresh_page, 1, pmem_size >> PAGE_SHIFT);
+  }
 #endif
-  IFDEF(CONFIG_MEM_RANDOM, memset(pmem, rand(), CONFIG_MSIZE));
+  tlb_flush();
   Log("physical memory area [" FMT_PADDR ", " FMT_PADDR "]", PMEM_LEFT, PMEM_RIGHT);
 }
 
+#ifndef CONFIG_TARGET_AM
+// back pmem with a private mapping of a file, so that a page
+// is only read from the file when it is touched
+void pmem_map_file(int fd, size_t offset) {
+#if   defined(CONFIG_PMEM_MALLOC)
+  munmap(pmem, pmem_size);
+  uint8_t *p = mmap(NULL, pmem_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, offset);
+#else
+  uint8_t *p = mmap(pmem, pmem_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, offset);
+#endif
+  Assert(p != MAP_FAILED, "fail to map pmem from the snapshot file");
+  IFDEF(CONFIG_PMEM_MALLOC, pmem = p);
+  tlb_flush();
+}
+
+long pmem_map_img(const char *img_file) {
+  int fd = open(img_file, O_RDONLY);
+  Assert(fd >= 0, "Can not open '%s'", img_file);
+  off_t size = lseek(fd, 0, SEEK_END);
+  Assert(size <= PMEM_RIGHT - RESET_VECTOR + 1, "the image is larger than the memory");
+  if (size > 0) {
+    uint8_t *p = mmap(guest_to_host(RESET_VECTOR), size, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_FIXED, fd, 0);
+    Assert(p != MAP_FAILED, "fail to map the image '%s'", img_file);
+  }
+  close(fd);
+#ifdef CONFIG_MEM_RANDOM
+  // the rest of the last page is zero
+  uint32_t idx = pmem_page(RESET_VECTOR);
+  memset(&pmem_fresh_page[idx], 0, ROUNDUP(size, PAGE_SIZE) >> PAGE_SHIFT);
+#endif
+  tlb_flush();
+  return size;
+}
+
+#ifdef CONFIG_PMEM_MALLOC
+// use `p' of the same size as pmem, e.g. the one of another instance,
+// and return the pmem used before
+uint8_t* pmem_switch(uint8_t *p) {
+  uint8_t *old = pmem;
+  pmem = p;
+  tlb_flush();
+  return old;
+}
+#endif
+#endif
+
 word_t paddr_read(paddr_t addr, int len) {
   if (likely(in_pmem(addr))) {
+    if (unlikely(!in_pmem(addr + len - 1))) out_of_bound(addr + len - 1);
+    IFDEF(CONFIG_MEM_RANDOM, check_fresh(addr, len));
     word_t ret = pmem_read(addr, len);
 #ifdef CONFIG_MTRACE
     if (MTRACE_COND) log_write("mtrace: read at " FMT_PADDR " len=%d, val=" FMT_WORD "\n", addr, len, ret);
@@ -69,8 +229,15 @@ word_t paddr_read(paddr_t addr, int len) {
 }
 
 void paddr_write(paddr_t addr, int len, word_t data) {
-  if (likely(in_pmem(addr))) { 
+  if (likely(in_pmem(addr))) {
+    if (unlikely(!in_pmem(addr + len - 1))) out_of_bound(addr + len - 1);
+    IFDEF(CONFIG_MEM_RANDOM, check_fresh(addr, len));
+    IFDEF(CONFIG_SNAPSHOT, snapshot_check_write(addr, len));
+    IFDEF(CONFIG_DIFFTEST, difftest_check_write(addr, len));
     pmem_write(addr, len, data);
+    IFDEF(CONFIG_DCACHE, dcache_check_write(addr, len));
+    check_watch(addr, len);
+    IFDEF(CONFIG_TLB, check_pt_page(addr, len));
 #ifdef CONFIG_MTRACE
     if (MTRACE_COND) log_write("mtrace: write at " FMT_PADDR " len=%d, val=" FMT_WORD "\n", addr, len, data);
 #endif
@@ -79,3 +246,20 @@ void paddr_write(paddr_t addr, int len, word_t data) {
   IFDEF(CONFIG_DEVICE, mmio_write(addr, len, data); return);
   out_of_bound(addr);
 }
+
+#ifdef CONFIG_HAS_MPE
+// the write of a locked instruction, it fails if another hart
+// has changed the memory since the instruction read it
+bool paddr_cmpxchg(paddr_t addr, int len, word_t old, word_t data) {
+  Assert(in_pmem(addr) && in_pmem(addr + len - 1),
+      "a locked access to " FMT_PADDR " is out of pmem at pc = " FMT_WORD, addr, cpu.pc);
+  IFDEF(CONFIG_MEM_RANDOM, check_fresh(addr, len));
+  if (!host_cmpxchg(guest_to_host(addr), len, old, data)) return false;
+  check_watch(addr, len);
+  IFDEF(CONFIG_TLB, check_pt_page(addr, len));
+#ifdef CONFIG_MTRACE
+  if (MTRACE_COND) log_write("mtrace: write at " FMT_PADDR " len=%d, val=" FMT_WORD "\n", addr, len, data);
+#endif
+  return true;
+}
+#endif
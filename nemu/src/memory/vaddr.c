@@ -14,16 +14,152 @@
 ***************************************************************************************/
 
 #include <isa.h>
+#include <memory/host.h>
 #include <memory/paddr.h>
+#include <memory/vaddr.h>
+#include <device/mmio.h>
+
+static paddr_t translate(vaddr_t addr, int len, int type) {
+  switch (isa_mmu_check(addr, len, type)) {
+    case MMU_DIRECT: return addr;
+    case MMU_TRANSLATE: {
+      paddr_t pg = isa_mmu_translate(addr, len, type);
+      Assert((pg & PAGE_MASK) == MEM_RET_OK,
+          "address translation fails at vaddr = " FMT_WORD ", pc = " FMT_WORD, addr, cpu.pc);
+      return (pg & ~(paddr_t)PAGE_MASK) | (addr & PAGE_MASK);
+    }
+    default: panic("invalid access to vaddr = " FMT_WORD " at pc = " FMT_WORD, addr, cpu.pc);
+  }
+}
+
+static inline bool cross_page(vaddr_t addr, int len) {
+  return ((addr ^ (addr + len - 1)) & ~(vaddr_t)PAGE_MASK) != 0;
+}
+
+#ifdef CONFIG_TLB
+
+static_assert((CONFIG_TLB_SIZE & (CONFIG_TLB_SIZE - 1)) == 0,
+    "CONFIG_TLB_SIZE should be a power of 2");
+
+/* An entry maps the virtual page `tag` to host memory, the host address
+ * of `addr` inside the page is `addr + addend`. Only pmem and device
+ * regions without callback (e.g. the frame buffer) are filled, accesses
+ * to other pages always go through translate() and paddr_read()/paddr_write().
+ */
+typedef struct {
+  vaddr_t tag;
+  uintptr_t addend;
+} TLBEntry;
+
+#define TLB_INVALID 1 // never equals a page-aligned tag
+
+// indexed by MEM_TYPE_*, each hart has its own
+static HART_LOCAL TLBEntry tlb[3][CONFIG_TLB_SIZE];
+HART_LOCAL uint64_t tlb_hit = 0, tlb_miss = 0, tlb_nr_flush = 0;
+
+static inline TLBEntry* tlb_slot(int type, vaddr_t addr) {
+  return &tlb[type][(addr >> PAGE_SHIFT) & (CONFIG_TLB_SIZE - 1)];
+}
+
+// return the host address of `addr`, or NULL if it misses
+static inline uint8_t* tlb_lookup(int type, vaddr_t addr, int len) {
+  TLBEntry *e = tlb_slot(type, addr);
+  if (likely(e->tag == (addr & ~(vaddr_t)PAGE_MASK) && !cross_page(addr, len))) {
+    tlb_hit ++;
+    return (uint8_t *)(addr + e->addend);
+  }
+  tlb_miss ++;
+  return NULL;
+}
+
+static void tlb_fill(int type, vaddr_t addr, paddr_t paddr) {
+  uint8_t *host;
+  if (likely(in_pmem(paddr))) {
+    // stores to these pages have more to do than the store itself
+    if (type == MEM_TYPE_WRITE && !paddr_plain_page(paddr)) return;
+    host = guest_to_host(paddr);
+  } else {
+    host = MUXDEF(CONFIG_DEVICE, mmio_host_page(paddr), NULL);
+    if (host == NULL) return;
+  }
+  TLBEntry *e = tlb_slot(type, addr);
+  e->tag = addr & ~(vaddr_t)PAGE_MASK;
+  e->addend = (uintptr_t)host - addr;
+}
+
+static void flush(int type) {
+  for (int i = 0; i < CONFIG_TLB_SIZE; i ++) {
+    tlb[type][i].tag = TLB_INVALID;
+  }
+}
+
+void tlb_flush() {
+  flush(MEM_TYPE_IFETCH);
+  flush(MEM_TYPE_READ);
+  flush(MEM_TYPE_WRITE);
+  tlb_nr_flush ++;
+}
+
+void tlb_flush_write() {
+  flush(MEM_TYPE_WRITE);
+  tlb_nr_flush ++;
+}
+
+#else
+static inline uint8_t* tlb_lookup(int type, vaddr_t addr, int len) { return NULL; }
+static inline void tlb_fill(int type, vaddr_t addr, paddr_t paddr) {}
+#endif
+
+// an access crossing a page boundary may be mapped to two unrelated
+// physical pages, split it into bytes (all supported ISAs are little-endian)
+static word_t read_cross_page(vaddr_t addr, int len, int type) {
+  word_t ret = 0;
+  for (int i = 0; i < len; i ++) {
+    ret |= (word_t)paddr_read(translate(addr + i, 1, type), 1) << (i * 8);
+  }
+  return ret;
+}
+
+static word_t read_slow(vaddr_t addr, int len, int type) {
+  if (unlikely(cross_page(addr, len)) && isa_mmu_check(addr, len, type) == MMU_TRANSLATE) {
+    return read_cross_page(addr, len, type);
+  }
+  paddr_t paddr = translate(addr, len, type);
+  tlb_fill(type, addr, paddr);
+  return paddr_read(paddr, len);
+}
 
 word_t vaddr_ifetch(vaddr_t addr, int len) {
-  return paddr_read(addr, len);
+  uint8_t *p = tlb_lookup(MEM_TYPE_IFETCH, addr, len);
+  if (likely(p != NULL)) return host_read(p, len);
+  return read_slow(addr, len, MEM_TYPE_IFETCH);
 }
 
 word_t vaddr_read(vaddr_t addr, int len) {
-  return paddr_read(addr, len);
+  uint8_t *p = tlb_lookup(MEM_TYPE_READ, addr, len);
+  if (likely(p != NULL)) return host_read(p, len);
+  return read_slow(addr, len, MEM_TYPE_READ);
 }
 
 void vaddr_write(vaddr_t addr, int len, word_t data) {
-  paddr_write(addr, len, data);
+  uint8_t *p = tlb_lookup(MEM_TYPE_WRITE, addr, len);
+  if (likely(p != NULL)) { host_write(p, len, data); return; }
+
+  if (unlikely(cross_page(addr, len)) && isa_mmu_check(addr, len, MEM_TYPE_WRITE) == MMU_TRANSLATE) {
+    for (int i = 0; i < len; i ++) {
+      paddr_write(translate(addr + i, 1, MEM_TYPE_WRITE), 1, data >> (i * 8));
+    }
+    return;
+  }
+  paddr_t paddr = translate(addr, len, MEM_TYPE_WRITE);
+  tlb_fill(MEM_TYPE_WRITE, addr, paddr);
+  paddr_write(paddr, len, data);
+}
+
+#ifdef CONFIG_HAS_MPE
+// the write of a locked instruction, atomic to the other harts
+bool vaddr_cmpxchg(vaddr_t addr, int len, word_t old, word_t data) {
+  Assert(!cross_page(addr, len), "a locked access crosses a page at pc = " FMT_WORD, cpu.pc);
+  return paddr_cmpxchg(translate(addr, len, MEM_TYPE_WRITE), len, old, data);
 }
+#endif
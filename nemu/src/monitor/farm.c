@@ -0,0 +1,181 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <isa.h>
+#include <cpu/cpu.h>
+#include <memory/paddr.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#ifdef CONFIG_TARGET_NATIVE_ELF
+
+/* Run the images in a manifest in child processes forked from NEMU
+ * after it is set up, so that the children share the setup and pmem
+ * untouched by the images. An image is mapped privately, so children
+ * running the same image share its pages until they write them.
+ * Each line of the manifest is `IMAGE [HALT_RET]', HALT_RET defaults
+ * to 0, and lines starting with `#' are ignored.
+ */
+
+typedef struct {
+  int state, halt_ret;
+  uint64_t nr_inst, time_us;
+} FarmResult;
+
+typedef struct {
+  char *img;
+  int expect;
+  pid_t pid;
+  int fd;
+  FarmResult res;
+} FarmJob;
+
+extern HART_LOCAL uint64_t g_nr_guest_inst;
+extern uint64_t g_timer;
+extern FILE *log_fp;
+
+static FarmJob *job = NULL;
+static int nr_job = 0;
+
+static void read_manifest(const char *file) {
+  FILE *fp = fopen(file, "r");
+  Assert(fp, "Can not open '%s'", file);
+  char line[4096];
+  int max_job = 0;
+  while (fgets(line, sizeof(line), fp) != NULL) {
+    char *img = strtok(line, " \t\n");
+    if (img == NULL || img[0] == '#') continue;
+    char *expect = strtok(NULL, " \t\n");
+    if (nr_job == max_job) {
+      max_job = (max_job == 0 ? 64 : max_job * 2);
+      job = realloc(job, sizeof(*job) * max_job);
+      assert(job);
+    }
+    job[nr_job ++] = (FarmJob){ .img = strdup(img), .expect = (expect ? atoi(expect) : 0), .pid = -1 };
+  }
+  fclose(fp);
+}
+
+static void run_child(FarmJob *j, int fd) {
+  // the log and the output of the guest are dropped
+  log_fp = NULL;
+  int null = open("/dev/null", O_WRONLY);
+  dup2(null, STDOUT_FILENO);
+  dup2(null, STDERR_FILENO);
+
+  pmem_map_img(j->img);
+  cpu_exec(-1);
+  FarmResult r = { .state = nemu_state.state, .halt_ret = nemu_state.halt_ret,
+    .nr_inst = g_nr_guest_inst, .time_us = g_timer };
+  Assert(write(fd, &r, sizeof(r)) == sizeof(r), "fail to send the result");
+  _exit(0);
+}
+
+static void start(FarmJob *j) {
+  int fd[2];
+  Assert(pipe(fd) == 0, "fail to create a pipe");
+  fflush(NULL);
+  j->pid = fork();
+  Assert(j->pid >= 0, "fail to fork");
+  if (j->pid == 0) { close(fd[0]); run_child(j, fd[1]); }
+  close(fd[1]);
+  j->fd = fd[0];
+}
+
+static void finish(pid_t pid) {
+  for (int i = 0; i < nr_job; i ++) {
+    FarmJob *j = &job[i];
+    if (j->pid != pid) continue;
+    // a child aborted by an assertion sends nothing
+    if (read(j->fd, &j->res, sizeof(j->res)) != sizeof(j->res)) {
+      j->res = (FarmResult){ .state = NEMU_ABORT };
+    }
+    close(j->fd);
+    j->pid = -1;
+    return;
+  }
+}
+
+static bool passed(FarmJob *j) {
+  return j->res.state == NEMU_END && j->res.halt_ret == j->expect;
+}
+
+static const char* result_str(FarmJob *j) {
+  switch (j->res.state) {
+    case NEMU_END: return (j->res.halt_ret == 0 ? "HIT GOOD TRAP" : "HIT BAD TRAP");
+    case NEMU_QUIT: return "QUIT";
+    default: return "ABORT";
+  }
+}
+
+static void write_str(FILE *fp, const char *s) {
+  fputc('"', fp);
+  for (; *s; s ++) {
+    if (*s == '"' || *s == '\\') fputc('\\', fp);
+    fputc(*s, fp);
+  }
+  fputc('"', fp);
+}
+
+static void write_report(FILE *fp, int nr_pass, uint64_t time_us) {
+  fprintf(fp, "{\n  \"jobs\": %d,\n  \"passed\": %d,\n  \"failed\": %d,\n  \"time_us\": %" PRIu64 ",\n  \"results\": [\n",
+      nr_job, nr_pass, nr_job - nr_pass, time_us);
+  for (int i = 0; i < nr_job; i ++) {
+    FarmJob *j = &job[i];
+    fprintf(fp, "    {\"image\": ");
+    write_str(fp, j->img);
+    fprintf(fp, ", \"result\": \"%s\", \"halt_ret\": %d, \"expect\": %d, \"pass\": %s, "
+        "\"nr_inst\": %" PRIu64 ", \"time_us\": %" PRIu64 ", \"mips\": %.2f}%s\n",
+        result_str(j), j->res.halt_ret, j->expect, (passed(j) ? "true" : "false"),
+        j->res.nr_inst, j->res.time_us,
+        (j->res.time_us > 0 ? (double)j->res.nr_inst / j->res.time_us : 0.0),
+        (i == nr_job - 1 ? "" : ","));
+  }
+  fprintf(fp, "  ]\n}\n");
+}
+
+void farm_run(const char *manifest, int nr_worker, const char *report) {
+  Assert(ISNDEF(CONFIG_DIFFTEST), "--farm can not be used with DiffTest");
+  read_manifest(manifest);
+  if (nr_worker <= 0) nr_worker = sysconf(_SC_NPROCESSORS_ONLN);
+  Log("Run %d images with %d workers", nr_job, nr_worker);
+  log_flush();
+
+  uint64_t start_time = get_time();
+  int next = 0, running = 0;
+  while (next < nr_job || running > 0) {
+    if (next < nr_job && running < nr_worker) {
+      start(&job[next ++]);
+      running ++;
+      continue;
+    }
+    pid_t pid = wait(NULL);
+    Assert(pid > 0, "fail to wait for the workers");
+    finish(pid);
+    running --;
+  }
+  uint64_t time_us = get_time() - start_time;
+
+  int nr_pass = 0;
+  for (int i = 0; i < nr_job; i ++) nr_pass += passed(&job[i]);
+  FILE *fp = (strcmp(report, "-") == 0 ? stdout : fopen(report, "w"));
+  Assert(fp, "Can not open '%s'", report);
+  write_report(fp, nr_pass, time_us);
+  if (fp != stdout) fclose(fp);
+  Log("%d of %d images passed in %" PRIu64 " us", nr_pass, nr_job, time_us);
+  exit(nr_pass == nr_job ? 0 : 1);
+}
+#endif
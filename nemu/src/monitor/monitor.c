@@ -15,20 +15,32 @@
 
 #include <isa.h>
 #include <memory/paddr.h>
+#include <cpu/snapshot.h>
+#include <cpu/itrace.h>
+#include <cpu/record.h>
 
 void init_rand();
 void init_log(const char *log_file);
-void init_mem();
+void init_mem(bool fill_random);
 void init_difftest(char *ref_so_file, long img_size, int port);
 void init_device();
 void init_sdb();
 void init_disasm();
+void farm_run(const char *manifest, int nr_worker, const char *report);
 
 static void welcome() {
   Log("Trace: %s", MUXDEF(CONFIG_TRACE, ANSI_FMT("ON", ANSI_FG_GREEN), ANSI_FMT("OFF", ANSI_FG_RED)));
   IFDEF(CONFIG_TRACE, Log("If trace is enabled, a log file will be generated "
         "to record the trace. This may lead to a large log file. "
         "If it is not necessary, you can disable it in menuconfig"));
+#ifdef CONFIG_ENGINE_BLOCK
+  // the options keeping execute() in cpu-exec.c on the interpreter
+  const char *slow = "" IFDEF(CONFIG_ITRACE, " ITRACE") IFDEF(CONFIG_MTRACE, " MTRACE")
+    IFDEF(CONFIG_FTRACE, " FTRACE") IFDEF(CONFIG_DIFFTEST, " DIFFTEST") IFDEF(CONFIG_PROFILE, " PROFILE");
+  if (slow[0] != '\0') {
+    Log(ANSI_FMT("The block engine is not used, the interpreter runs instead because of:%s", ANSI_FG_RED), slow);
+  }
+#endif
   Log("Build time: %s, %s", __TIME__, __DATE__);
   printf("Welcome to %s-NEMU!\n", ANSI_FMT(str(__GUEST_ISA__), ANSI_FG_YELLOW ANSI_BG_RED));
   printf("For help, type \"help\"\n");
@@ -40,12 +52,36 @@ static void welcome() {
 #include <getopt.h>
 
 void sdb_set_batch_mode();
+void sdb_set_save_snapshot(char *file);
 
 static char *log_file = NULL;
 static char *diff_so_file = NULL;
 static char *img_file = NULL;
-static char *elf_file = NULL;
+#define MAX_ELF 8
+static char *elf_file[MAX_ELF] = {};
+static int nr_elf = 0;
+static char *itrace_file = NULL;
+static char *profile_file = NULL;
 static int difftest_port = 1234;
+static char *load_snapshot = NULL;
+static char *farm_file = NULL;
+static char *farm_report = "-";
+static int farm_jobs = 0;
+static char *record_file = NULL;
+static char *replay_file = NULL;
+
+// accept a K, M or G suffix
+static size_t parse_size(const char *s) {
+  char *end;
+  size_t size = strtoull(s, &end, 0);
+  switch (*end) {
+    case 'G': case 'g': size <<= 10; // fall through
+    case 'M': case 'm': size <<= 10; // fall through
+    case 'K': case 'k': size <<= 10; end ++; break;
+  }
+  Assert(end != s && *end == '\0', "invalid size '%s'", s);
+  return size;
+}
 
 static long load_img() {
   if (img_file == NULL) {
@@ -60,8 +96,10 @@ static long load_img() {
   long size = ftell(fp);
 
   Log("The image is %s, size = %ld", img_file, size);
+  Assert(size <= PMEM_RIGHT - RESET_VECTOR + 1, "the image is larger than the memory");
 
   fseek(fp, 0, SEEK_SET);
+  pmem_prepare(RESET_VECTOR, size);
   int ret = fread(guest_to_host(RESET_VECTOR), size, 1, fp);
   assert(ret == 1);
 
@@ -77,16 +115,46 @@ static int parse_args(int argc, char *argv[]) {
     {"port"     , required_argument, NULL, 'p'},
     {"help"     , no_argument      , NULL, 'h'},
     {"elf"      , required_argument, NULL, 'e'},
+    {"save-snapshot", required_argument, NULL, 's'},
+    {"load-snapshot", required_argument, NULL, 'r'},
+    {"msize"    , required_argument, NULL, 'm'},
+    {"itrace"   , required_argument, NULL, 't'},
+    {"profile"  , required_argument, NULL, 'f'},
+    {"farm"     , required_argument, NULL, 'F'},
+    {"jobs"     , required_argument, NULL, 'j'},
+    {"report"   , required_argument, NULL, 'o'},
+    {"icount"   , required_argument, NULL, 'I'},
+    {"record"   , required_argument, NULL, 'R'},
+    {"replay"   , required_argument, NULL, 'P'},
     {0          , 0                , NULL,  0 },
   };
   int o;
-  while ( (o = getopt_long(argc, argv, "-bhl:d:p:e:", table, NULL)) != -1) {
+  while ( (o = getopt_long(argc, argv, "-bhl:d:p:e:s:r:m:t:f:F:j:o:I:R:P:", table, NULL)) != -1) {
     switch (o) {
       case 'b': sdb_set_batch_mode(); break;
       case 'p': sscanf(optarg, "%d", &difftest_port); break;
       case 'l': log_file = optarg; break;
       case 'd': diff_so_file = optarg; break;
-      case 'e': elf_file = optarg; break;
+      case 'e':
+        Assert(nr_elf < MAX_ELF, "too many ELF files");
+        elf_file[nr_elf ++] = optarg;
+        break;
+      case 's': sdb_set_save_snapshot(optarg); break;
+      case 'r': load_snapshot = optarg; break;
+      case 'm': pmem_size = parse_size(optarg); break;
+      case 't': itrace_file = optarg; break;
+      case 'f': profile_file = optarg; break;
+      case 'F': farm_file = optarg; break;
+      case 'j': farm_jobs = atoi(optarg); break;
+      case 'o': farm_report = optarg; break;
+      case 'R': record_file = optarg; break;
+      case 'P': replay_file = optarg; break;
+      case 'I':
+        icount_shift = atoi(optarg);
+        Assert(icount_shift >= 0 && icount_shift <= 10, "SHIFT of --icount should be in [0, 10]");
+        // every hart counts its own instructions
+        IFDEF(CONFIG_HAS_MPE, panic("--icount does not support multiple harts"));
+        break;
       case 1: img_file = optarg; return 0;
       default:
         printf("Usage: %s [OPTION...] IMAGE [args]\n\n", argv[0]);
@@ -94,7 +162,20 @@ static int parse_args(int argc, char *argv[]) {
         printf("\t-l,--log=FILE           output log to FILE\n");
         printf("\t-d,--diff=REF_SO        run DiffTest with reference REF_SO\n");
         printf("\t-p,--port=PORT          run DiffTest with port PORT\n");
-        printf("\t-e,--elf=FILE           read symbol table from ELF FILE for ftrace\n");
+        printf("\t-e,--elf=FILE[@LO:HI]   read symbol table from ELF FILE for ftrace, only in [LO, HI) if given;\n");
+        printf("\t                        repeat it for more files, e.g. the kernel and an app\n");
+        printf("\t-s,--save-snapshot=FILE[@N]\n");
+        printf("\t                        save the machine to FILE after N instructions if given, or when NEMU exits\n");
+        printf("\t-r,--load-snapshot=FILE start from the machine saved in FILE instead of IMAGE\n");
+        printf("\t-m,--msize=SIZE         use SIZE bytes of memory (K/M/G suffix), at most %#x\n", CONFIG_MSIZE);
+        printf("\t-t,--itrace=FILE        write the binary instruction trace to FILE\n");
+        printf("\t-f,--profile=FILE       write the profiled call stacks to FILE for flamegraph.pl\n");
+        printf("\t-F,--farm=MANIFEST      run the images listed in MANIFEST in parallel instead of IMAGE\n");
+        printf("\t-j,--jobs=N             run N images at a time with --farm, the number of CPUs by default\n");
+        printf("\t-o,--report=FILE        write the JSON report of --farm to FILE, stdout by default\n");
+        printf("\t-I,--icount=SHIFT       run 2^SHIFT ns of guest time per instruction instead of the host time\n");
+        printf("\t-R,--record=FILE        record the device input and the interrupts to FILE\n");
+        printf("\t-P,--replay=FILE        replay the input recorded in FILE without a window\n");
         printf("\n");
         exit(0);
     }
@@ -114,8 +195,11 @@ void init_monitor(int argc, char *argv[]) {
   /* Open the log file. */
   init_log(log_file);
 
+  /* Record or replay the device input, which also fixes the random seed. */
+  init_record(record_file, replay_file);
+
   /* Initialize memory. */
-  init_mem();
+  init_mem(load_snapshot == NULL);
 
   /* Initialize devices. */
   IFDEF(CONFIG_DEVICE, init_device());
@@ -123,8 +207,16 @@ void init_monitor(int argc, char *argv[]) {
   /* Perform ISA dependent initialization. */
   init_isa();
 
-  /* Load the image to memory. This will overwrite the built-in image. */
-  long img_size = load_img();
+  /* Load the image to memory. This will overwrite the built-in image.
+   * A snapshot replaces the whole machine, the difftest REF should get
+   * all memory from the reset vector. */
+  long img_size;
+  if (load_snapshot != NULL) {
+    snapshot_load_file(load_snapshot);
+    img_size = PMEM_RIGHT - RESET_VECTOR + 1;
+  } else {
+    img_size = load_img();
+  }
 
   /* Initialize differential testing. */
   init_difftest(diff_so_file, img_size, difftest_port);
@@ -133,7 +225,18 @@ void init_monitor(int argc, char *argv[]) {
   init_sdb();
 
   IFDEF(CONFIG_ITRACE, init_disasm());
-  IFDEF(CONFIG_FTRACE, init_ftrace(elf_file));
+  IFDEF(CONFIG_ITRACE, init_itrace(itrace_file));
+#ifdef CONFIG_FTRACE
+  for (int i = 0; i < nr_elf; i ++) init_ftrace(elf_file[i]);
+#endif
+  IFDEF(CONFIG_PROFILE, init_profile(profile_file));
+
+  /* The machine set up so far is shared by the images of the farm. */
+  if (farm_file != NULL) {
+    Assert(itrace_file == NULL && profile_file == NULL, "--itrace and --profile can not be used with --farm");
+    Assert(record_file == NULL && replay_file == NULL, "--record and --replay can not be used with --farm");
+    farm_run(farm_file, farm_jobs, farm_report);
+  }
 
   /* Display welcome message. */
 
@@ -144,13 +247,14 @@ static long load_img() {
   extern char bin_start, bin_end;
   size_t size = &bin_end - &bin_start;
   Log("img size = %ld", size);
+  pmem_prepare(RESET_VECTOR, size);
   memcpy(guest_to_host(RESET_VECTOR), &bin_start, size);
   return size;
 }
 
 void am_init_monitor() {
   init_rand();
-  init_mem();
+  init_mem(true);
   init_isa();
   load_img();
   IFDEF(CONFIG_DEVICE, init_device());
@@ -15,6 +15,7 @@
 
 #include <isa.h>
 #include <memory/vaddr.h>
+#include "sdb.h"
 
 /* We use the POSIX regex functions to process regular expressions.
  * Type 'man regex' for more information about POSIX regex functions.
@@ -303,69 +304,62 @@ static int find_main_operator(int p, int q)
 }
 
 
-word_t eval(int p, int q, bool *success) {
+static bool emit(ExprCode *code, int type, word_t val, const char *reg) {
+  if (code->nr_op >= MAX_EXPR_OP) {
+    printf("Error: Expression too long\n");
+    return false;
+  }
+  ExprOp *op = &code->op[code->nr_op ++];
+  op->type = type;
+  op->val = val;
+  if (reg != NULL) {
+    strncpy(op->reg, reg, sizeof(op->reg) - 1);
+    op->reg[sizeof(op->reg) - 1] = '\0';
+  }
+  return true;
+}
+
+/* Turn tokens[p..q] into postfix operations, the operands are
+ * evaluated in the same order as a recursive evaluation would do.
+ */
+static bool compile(int p, int q, ExprCode *code) {
   if (p > q) {
     printf("Error: Invalid expression (empty range: p=%d > q=%d)\n", p, q);
-    *success = false;
-    return 0;
+    return false;
   }
   else if (p == q) {
     if (tokens[p].type == TK_NUM) {
-      return strtol(tokens[p].str, NULL, 0);
+      return emit(code, TK_NUM, strtol(tokens[p].str, NULL, 0), NULL);
     }
     if (tokens[p].type == TK_REG) {
-      return isa_reg_str2val(tokens[p].str, success);
+      bool success = true;
+      isa_reg_str2val(tokens[p].str, &success);
+      if (!success) return false;
+      code->use_reg = true;
+      return emit(code, TK_REG, 0, tokens[p].str);
     }
-    *success = false;
-    return 0;
+    return false;
   }
 
   if (check_parentheses(p, q) == true) {
-    return eval(p + 1, q - 1, success);
+    return compile(p + 1, q - 1, code);
   }
 
   int op = find_main_operator(p, q);
-  if (op == -1) {
-    *success = false;
-    return 0;
-  }
+  if (op == -1) return false;
 
   if (tokens[op].type == TK_DEREF || tokens[op].type == TK_NEGATIVE) {
-    word_t val = eval(op + 1, q, success);
-    if (!*success) return 0;
-    if (tokens[op].type == TK_NEGATIVE) return -val;
-    if (tokens[op].type == TK_DEREF) return vaddr_read(val, 4);
+    return compile(op + 1, q, code) && emit(code, tokens[op].type, 0, NULL);
   }
 
-  word_t val1 = eval(p, op - 1, success);
-  if (!*success) return 0;
-
-  word_t val2 = eval(op + 1, q, success);
-  if (!*success) return 0;
-
-  switch (tokens[op].type) {
-    case '+': return val1 + val2;
-    case '-': return val1 - val2;
-    case '*': return val1 * val2;
-    case '/': 
-      if (val2 == 0) {
-        printf("Error: Division by zero\n");
-        *success = false;
-        return 0;
-      }
-      return val1 / val2;
-    case TK_EQ: return val1 == val2;
-    case TK_NOT_EQ: return val1 != val2;
-    case TK_AND: return val1 && val2;
-    default: *success = false; return 0;
-  }
+  return compile(p, op - 1, code) && compile(op + 1, q, code) &&
+    emit(code, tokens[op].type, 0, NULL);
 }
 
-word_t expr(char *e, bool *success) {
-  if (!make_token(e)) {
-    *success = false;
-    return 0;
-  }
+bool expr_compile(char *e, ExprCode *code) {
+  code->nr_op = 0;
+  code->use_reg = false;
+  if (!make_token(e)) return false;
 
   /* Post-processing to distinguish unary operators */
   for (int i = 0; i < nr_token; i++) {
@@ -376,6 +370,62 @@ word_t expr(char *e, bool *success) {
     }
   }
 
+  return compile(0, nr_token - 1, code);
+}
+
+word_t expr_run(ExprCode *code, vaddr_t *addr, int *nr_addr, bool *success) {
+  word_t stack[MAX_EXPR_OP];
+  int top = 0, n = 0;
   *success = true;
-  return eval(0, nr_token-1, success);
-}
\ No newline at end of file
+  for (int i = 0; i < code->nr_op; i ++) {
+    ExprOp *op = &code->op[i];
+    switch (op->type) {
+      case TK_NUM: stack[top ++] = op->val; continue;
+      case TK_REG:
+        stack[top ++] = isa_reg_str2val(op->reg, success);
+        if (!*success) return 0;
+        continue;
+      case TK_NEGATIVE: stack[top - 1] = -stack[top - 1]; continue;
+      case TK_DEREF:
+        if (n < MAX_EXPR_DEREF) addr[n] = stack[top - 1];
+        n ++;
+        stack[top - 1] = vaddr_read(stack[top - 1], 4);
+        continue;
+    }
+
+    word_t val2 = stack[-- top];
+    word_t val1 = stack[top - 1];
+    word_t res = 0;
+    switch (op->type) {
+      case '+': res = val1 + val2; break;
+      case '-': res = val1 - val2; break;
+      case '*': res = val1 * val2; break;
+      case '/':
+        if (val2 == 0) {
+          printf("Error: Division by zero\n");
+          *success = false;
+          return 0;
+        }
+        res = val1 / val2;
+        break;
+      case TK_EQ: res = val1 == val2; break;
+      case TK_NOT_EQ: res = val1 != val2; break;
+      case TK_AND: res = val1 && val2; break;
+      default: *success = false; return 0;
+    }
+    stack[top - 1] = res;
+  }
+  // too many reads to record, the caller can not tell when the value changes
+  if (nr_addr != NULL) *nr_addr = (n <= MAX_EXPR_DEREF ? n : -1);
+  return stack[0];
+}
+
+word_t expr(char *e, bool *success) {
+  ExprCode code;
+  if (!expr_compile(e, &code)) {
+    *success = false;
+    return 0;
+  }
+  vaddr_t addr[MAX_EXPR_DEREF];
+  return expr_run(&code, addr, NULL, success);
+}
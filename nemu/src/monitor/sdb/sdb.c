@@ -15,6 +15,9 @@
 
 #include <isa.h>
 #include <cpu/cpu.h>
+#include <cpu/event.h>
+#include <cpu/snapshot.h>
+#include <cpu/record.h>
 #include <utils.h>
 #include <readline/readline.h>
 #include <readline/history.h>
@@ -23,6 +26,12 @@
 #include <memory/vaddr.h>
 
 static int is_batch_mode = false;
+static char *save_snapshot = NULL;
+// with FILE@N, the instruction count to save the machine at, 0 for the exit
+static uint64_t save_at = 0;
+static int save_event = -1;
+
+extern HART_LOCAL uint64_t g_nr_guest_inst;
 
 void init_regex();
 void init_wp_pool();
@@ -180,6 +189,36 @@ static int cmd_d(char *args) {
   return 0;
 }
 
+#ifdef CONFIG_SNAPSHOT
+static int cmd_rsi(char *args) {
+  uint64_t step = 1;
+  if (args != NULL) {
+    char *endptr;
+    step = strtoull(args, &endptr, 10);
+    if (*endptr != '\0') {
+      printf("Usage: rsi [N]\n");
+      return 0;
+    }
+  }
+  snapshot_step_back(step);
+  return 0;
+}
+
+static int cmd_rc(char *args) {
+  snapshot_reverse_continue();
+  return 0;
+}
+#endif
+
+static int cmd_save(char *args) {
+  if (args == NULL) {
+    printf("Usage: save FILE\n");
+    return 0;
+  }
+  snapshot_save_file(args);
+  return 0;
+}
+
 static struct {
   const char *name;
   const char *description;
@@ -193,7 +232,12 @@ static struct {
   {"x","Examine memory (N 4-byte words starting from expression result)",cmd_x},
   {"p","Evaluate expression", cmd_p},
   {"w", "Set watchpoint (w EXPR)", cmd_w},
-  {"d", "Delete watchpoint (d N)", cmd_d}
+  {"d", "Delete watchpoint (d N)", cmd_d},
+  {"save", "Save the machine to a snapshot file (save FILE)", cmd_save},
+#ifdef CONFIG_SNAPSHOT
+  {"rsi", "Step back N instructions, default is 1", cmd_rsi},
+  {"rc", "Continue backwards to the last change of a watchpoint", cmd_rc},
+#endif
   /* TODO: Add more commands */
 
 };//回调函数
@@ -227,11 +271,52 @@ void sdb_set_batch_mode() {
   is_batch_mode = true;
 }
 
-void sdb_mainloop() {
-  if (is_batch_mode) {
-    cmd_c(NULL);
+void sdb_set_save_snapshot(char *file) {
+  save_snapshot = file;
+  char *at = strrchr(file, '@');
+  if (at != NULL) {
+    char *end;
+    save_at = strtoull(at + 1, &end, 0);
+    Assert(end != at + 1 && *end == '\0' && save_at > 0,
+        "invalid instruction count in '%s', expected FILE@N", file);
+    *at = '\0';
+  }
+}
+
+static void save_snapshot_now() {
+  // the deadline is moved earlier when going back to a checkpoint
+  if (g_nr_guest_inst < save_at) {
+    event_schedule(save_event, save_at - g_nr_guest_inst);
     return;
   }
+  snapshot_save_file(save_snapshot);
+  save_snapshot = NULL;
+}
+
+static void sdb_loop();
+
+void sdb_mainloop() {
+  if (is_batch_mode) cmd_c(NULL);
+  else sdb_loop();
+
+  // the program may not end before `q'
+  IFDEF(CONFIG_PROFILE, profile_report());
+
+  if (save_snapshot != NULL) {
+    if (save_at != 0) {
+      Log("The program has ended before the instruction count to save, snapshot is not saved");
+    } else if (nemu_state.state == NEMU_END || nemu_state.state == NEMU_ABORT) {
+      Log("The program has ended, snapshot is not saved");
+    } else {
+      snapshot_save_file(save_snapshot);
+    }
+  }
+}
+
+static void sdb_loop() {
+
+  // going back is not recorded, nor replayed from the file
+  IFDEF(CONFIG_SNAPSHOT, if (!record_on && !record_replaying) snapshot_start());
 
   for (char *str; (str = rl_gets()) != NULL; ) {
     char *str_end = str + strlen(str);
@@ -271,4 +356,12 @@ void init_sdb() {
 
   /* Initialize the watchpoint pool. */
   init_wp_pool();
+
+  /* Count the instructions to save the machine at from here, which may be
+   * in the middle of a loaded snapshot. */
+  if (save_at != 0) {
+    save_at += g_nr_guest_inst;
+    save_event = event_add("save-snapshot", save_snapshot_now);
+    event_schedule(save_event, save_at - g_nr_guest_inst);
+  }
 }
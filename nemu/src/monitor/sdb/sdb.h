@@ -17,14 +17,47 @@
 #define __SDB_H__
 
 #include <common.h>
+#include <memory/paddr.h>
 
 typedef struct watchpoint WP;
 
+// an expression parsed once and evaluated many times
+#define MAX_EXPR_OP 32
+#define MAX_EXPR_DEREF 8
+
+typedef struct {
+  int type; // token type of an operand or an operator
+  word_t val;
+  char reg[16];
+} ExprOp;
+
+typedef struct {
+  int nr_op;
+  bool use_reg;
+  ExprOp op[MAX_EXPR_OP]; // in postfix order
+} ExprCode;
+
 word_t expr(char *e, bool *success);
+bool expr_compile(char *e, ExprCode *code);
+// the addresses dereferenced are recorded to `addr', and their number
+// to `nr_addr', which is -1 if there are more than MAX_EXPR_DEREF
+word_t expr_run(ExprCode *code, vaddr_t *addr, int *nr_addr, bool *success);
+
 int set_watchpoint(char *e);
 bool delete_watchpoint(int no);
 void list_watchpoints();
+bool has_watchpoint();
 WP* scan_watchpoint();
 void init_wp_pool();
+void watchpoint_set_quiet(bool q);
+void watchpoint_reset();
+
+// the number of watchpoints to check after every instruction,
+// the others only depend on memory watched by `paddr_watch()'
+extern int nr_wp_step;
+
+static inline bool watchpoint_pending() {
+  return nr_wp_step > 0 || paddr_watch_hit;
+}
 
 #endif
@@ -13,6 +13,7 @@
 * See the Mulan PSL v2 for more details.
 ***************************************************************************************/
 
+#include <isa.h>
 #include "sdb.h"
 
 #define NR_WP 32
@@ -21,6 +22,10 @@ typedef struct watchpoint {
   int NO;
   struct watchpoint *next;
   char expr[128];
+  ExprCode code;
+  // memory read by the last evaluation, -1 if it is not known
+  int nr_addr;
+  vaddr_t addr[MAX_EXPR_DEREF];
   word_t old_val;
   word_t new_val;
   /* TODO: Add more members if necessary */
@@ -28,6 +33,8 @@ typedef struct watchpoint {
 
 static WP wp_pool[NR_WP] = {};
 static WP *head = NULL, *free_ = NULL;
+int nr_wp_step = 0;
+static bool quiet = false;
 
 void init_wp_pool() {
   int i;
@@ -77,19 +84,64 @@ void free_wp(WP *wp)
   wp->next = free_;
   free_ = wp;
 }
+/* A watchpoint reading registers, or memory which can not be watched,
+ * is checked after every instruction. Otherwise its value can only change
+ * after a write to the memory it read, so it is checked after such a write.
+ * Pages are watched by physical address, so memory read through address
+ * translation can not be watched, as the mapping may change.
+ */
+static bool need_step(WP *wp) {
+  return wp->code.use_reg || wp->nr_addr < 0;
+}
+
+static word_t wp_eval(WP *wp, bool *success) {
+  word_t val = expr_run(&wp->code, wp->addr, &wp->nr_addr, success);
+  if (!*success) wp->nr_addr = -1;
+  for (int i = 0; i < wp->nr_addr; i ++) {
+    if (isa_mmu_check(wp->addr[i], 4, MEM_TYPE_READ) != MMU_DIRECT ||
+        !in_pmem(wp->addr[i]) || !in_pmem(wp->addr[i] + 3)) {
+      wp->nr_addr = -1;
+      break;
+    }
+  }
+  return val;
+}
+
+static void update_watch() {
+  paddr_unwatch_all();
+  nr_wp_step = 0;
+  for (WP *wp = head; wp != NULL; wp = wp->next) {
+    if (need_step(wp)) {
+      nr_wp_step ++;
+      continue;
+    }
+    for (int i = 0; i < wp->nr_addr; i ++) {
+      paddr_watch(wp->addr[i], 4);
+    }
+  }
+}
+
 int set_watchpoint(char *e)
 {
-  bool success;
-  word_t val = expr(e, &success);
-  if (!success) {
+  ExprCode code;
+  if (!expr_compile(e, &code)) {
     printf("Invalid expression: %s\n", e);
     return -1;
   }
 
   WP *wp = new_wp();
   strcpy(wp->expr, e);
+  wp->code = code;
+  bool success;
+  word_t val = wp_eval(wp, &success);
+  if (!success) {
+    free_wp(wp);
+    printf("Invalid expression: %s\n", e);
+    return -1;
+  }
   wp->old_val = val;
   wp->new_val = val;
+  update_watch();
   printf("Watchpoint %d: %s\n", wp->NO, wp->expr);
   return wp->NO;
 }
@@ -99,6 +151,7 @@ bool delete_watchpoint(int no) {
   while(wp != NULL) {
     if (wp->NO == no) {
       free_wp(wp);
+      update_watch();
       return true;
     }
     wp = wp->next;
@@ -119,20 +172,49 @@ void list_watchpoints() {
   }
 }
 
+bool has_watchpoint() {
+  return head != NULL;
+}
+
 WP* scan_watchpoint() {
-  WP *wp = head;
-  while (wp != NULL) {
+  bool mem_written = paddr_watch_hit;
+  paddr_watch_hit = false;
+  bool reeval_mem = false;
+  WP *hit = NULL;
+  for (WP *wp = head; wp != NULL; wp = wp->next) {
+    if (!need_step(wp) && !mem_written) continue;
+    reeval_mem |= !wp->code.use_reg;
+
     bool success;
-    word_t new_val = expr(wp->expr, &success);
+    word_t new_val = wp_eval(wp, &success);
     if (success && new_val != wp->old_val) {
-      printf("Watchpoint %d: %s\n", wp->NO, wp->expr);
-      printf("Old value = 0x%08x\n", wp->old_val);
-      printf("New value = 0x%08x\n", new_val);
-      
+      if (!quiet) {
+        printf("Watchpoint %d: %s\n", wp->NO, wp->expr);
+        printf("Old value = 0x%08x\n", wp->old_val);
+        printf("New value = 0x%08x\n", new_val);
+      }
+
       wp->old_val = new_val;
-      return wp;
+      if (hit == NULL) hit = wp;
     }
-    wp = wp->next;
   }
-  return NULL;
+  // the addresses read may be different now
+  if (reeval_mem) update_watch();
+  return hit;
+}
+
+void watchpoint_set_quiet(bool q) {
+  quiet = q;
+}
+
+// take the current values as the old ones, e.g. after the machine
+// is brought back to a checkpoint
+void watchpoint_reset() {
+  for (WP *wp = head; wp != NULL; wp = wp->next) {
+    bool success;
+    word_t val = wp_eval(wp, &success);
+    if (success) wp->old_val = wp->new_val = val;
+  }
+  paddr_watch_hit = false;
+  update_watch();
 }
@@ -16,6 +16,7 @@
 #include <dlfcn.h>
 #include <capstone/capstone.h>
 #include <common.h>
+#include <cpu/itrace.h>
 
 #if defined(__APPLE__)
 #define CS_LIB_SUFFIX "5.dylib"
@@ -25,6 +26,11 @@
 #error "Unsupported platform"
 #endif
 
+// tools outside NEMU_HOME give the full path
+#ifndef LIBCAPSTONE_PATH
+#define LIBCAPSTONE_PATH "tools/capstone/repo/libcapstone." CS_LIB_SUFFIX
+#endif
+
 static size_t (*cs_disasm_dl)(csh handle, const uint8_t *code,
     size_t code_size, uint64_t address, size_t count, cs_insn **insn);
 static void (*cs_free_dl)(cs_insn *insn, size_t count);
@@ -33,7 +39,7 @@ static csh handle;
 
 void init_disasm() {
   void *dl_handle;
-  dl_handle = dlopen("tools/capstone/repo/libcapstone." CS_LIB_SUFFIX, RTLD_LAZY);
+  dl_handle = dlopen(LIBCAPSTONE_PATH, RTLD_LAZY);
   assert(dl_handle);
 
   cs_err (*cs_open_dl)(cs_arch arch, cs_mode mode, csh *handle) = NULL;
@@ -81,3 +87,27 @@ void disassemble(char *str, int size, uint64_t pc, uint8_t *code, int nbyte) {
   cs_free_dl(insn, count);
 
 }
+
+void itrace_format(char *str, int size, const ItraceRecord *r) {
+  char *p = str, *end = str + size;
+  p += snprintf(p, end - p, FMT_WORD ":", (word_t)r->pc);
+  int ilen = (r->len < sizeof(r->inst) ? r->len : sizeof(r->inst));
+  uint8_t inst[sizeof(r->inst)];
+  memcpy(inst, r->inst, ilen);
+  int i;
+#ifdef CONFIG_ISA_x86
+  for (i = 0; i < ilen; i ++) {
+#else
+  for (i = ilen - 1; i >= 0; i --) {
+#endif
+    p += snprintf(p, 4, " %02x", inst[i]);
+  }
+  int ilen_max = MUXDEF(CONFIG_ISA_x86, 8, 4);
+  int space_len = ilen_max - ilen;
+  if (space_len < 0) space_len = 0;
+  space_len = space_len * 3 + 1;
+  memset(p, ' ', space_len);
+  p += space_len;
+
+  disassemble(p, end - p, MUXDEF(CONFIG_ISA_x86, r->pc + r->len, r->pc), inst, ilen);
+}
@@ -3,15 +3,30 @@
 
 #ifdef CONFIG_FTRACE
 
+// We assume the ELF file matches the CONFIG_ISA bitness
+typedef MUXDEF(CONFIG_ISA64, Elf64_Ehdr, Elf32_Ehdr) Elf_Ehdr;
+typedef MUXDEF(CONFIG_ISA64, Elf64_Shdr, Elf32_Shdr) Elf_Shdr;
+typedef MUXDEF(CONFIG_ISA64, Elf64_Sym,  Elf32_Sym)  Elf_Sym;
+#define ELF_ST_TYPE(info) MUXDEF(CONFIG_ISA64, ELF64_ST_TYPE(info), ELF32_ST_TYPE(info))
+
+/* The functions of all the ELF files loaded are kept in one table sorted
+ * by address, and their names are kept in a shared string pool. An ELF
+ * file can be tagged with an address range, e.g. a kernel and an app
+ * linked at a higher address: only its functions in the range are kept,
+ * and they replace the functions of the earlier files there.
+ */
 typedef struct {
-  char name[128];
   paddr_t addr;
-  size_t size;
+  uint32_t size;
+  uint32_t name; // offset in `pool'
 } SymbolEntry;
 
 static SymbolEntry *symbols = NULL;
 static int nr_sym = 0;
 static int capacity = 0;
+static char *pool = NULL;
+static uint32_t pool_size = 0, pool_capacity = 0;
+static int last_hit = 0;
 
 static void add_symbol(const char *name, paddr_t addr, size_t size) {
   if (nr_sym >= capacity) {
@@ -19,24 +34,73 @@ static void add_symbol(const char *name, paddr_t addr, size_t size) {
     symbols = realloc(symbols, capacity * sizeof(SymbolEntry));
     assert(symbols);
   }
-  strncpy(symbols[nr_sym].name, name, 127);
-  symbols[nr_sym].name[127] = '\0';
+  uint32_t len = strlen(name) + 1;
+  if (pool_size + len > pool_capacity) {
+    pool_capacity = (pool_capacity == 0 ? 4096 : pool_capacity * 2) + len;
+    pool = realloc(pool, pool_capacity);
+    assert(pool);
+  }
+  memcpy(pool + pool_size, name, len);
   symbols[nr_sym].addr = addr;
   symbols[nr_sym].size = size;
+  symbols[nr_sym].name = pool_size;
+  pool_size += len;
   nr_sym++;
 }
 
+static int cmp_symbol(const void *a, const void *b) {
+  paddr_t x = ((const SymbolEntry *)a)->addr, y = ((const SymbolEntry *)b)->addr;
+  return (x > y) - (x < y);
+}
+
+static inline bool in_symbol(const SymbolEntry *s, paddr_t addr) {
+  return addr - s->addr < s->size;
+}
+
 static const char* find_symbol(paddr_t addr) {
+  // calls and returns often stay in the same function
+  if (nr_sym > 0 && in_symbol(&symbols[last_hit], addr)) return pool + symbols[last_hit].name;
+  // the last function starting at or below `addr'
+  int lo = 0, hi = nr_sym;
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (symbols[mid].addr <= addr) lo = mid + 1;
+    else hi = mid;
+  }
+  if (lo == 0 || !in_symbol(&symbols[lo - 1], addr)) return "???";
+  last_hit = lo - 1;
+  return pool + symbols[last_hit].name;
+}
+
+const char* ftrace_symbol(paddr_t addr) {
+  return find_symbol(addr);
+}
+
+bool ftrace_symbol_range(const char *name, paddr_t *start, paddr_t *end) {
   for (int i = 0; i < nr_sym; i++) {
-    if (addr >= symbols[i].addr && addr < symbols[i].addr + symbols[i].size) {
-      return symbols[i].name;
+    if (strcmp(pool + symbols[i].name, name) == 0) {
+      *start = symbols[i].addr;
+      *end = symbols[i].addr + symbols[i].size;
+      return true;
     }
   }
-  return "???";
+  return false;
 }
 
-void init_ftrace(const char *elf_file) {
-  if (elf_file == NULL) return;
+// `spec' is FILE or FILE@LO:HI
+void init_ftrace(const char *spec) {
+  if (spec == NULL) return;
+
+  char elf_file[256];
+  paddr_t lo = 0, hi = (paddr_t)-1;
+  const char *at = strrchr(spec, '@');
+  if (at != NULL) {
+    char *end;
+    lo = strtoull(at + 1, &end, 0);
+    Assert(*end == ':', "Invalid address range in '%s', it should be FILE@LO:HI", spec);
+    hi = strtoull(end + 1, NULL, 0);
+  }
+  snprintf(elf_file, sizeof(elf_file), "%.*s", (int)(at ? at - spec : strlen(spec)), spec);
 
   FILE *fp = fopen(elf_file, "rb");
   if (fp == NULL) {
@@ -44,10 +108,7 @@ void init_ftrace(const char *elf_file) {
     return;
   }
 
-  // Determine architecture from config
-  // We assume the ELF file matches the CONFIG_ISA bitness
-#ifdef CONFIG_ISA64
-  Elf64_Ehdr ehdr;
+  Elf_Ehdr ehdr;
   assert(fread(&ehdr, sizeof(ehdr), 1, fp) == 1);
   // Verify magic
   if (memcmp(ehdr.e_ident, ELFMAG, SELFMAG) != 0) {
@@ -57,20 +118,20 @@ void init_ftrace(const char *elf_file) {
   }//e_ident是Header的第一个字段
 
   // Load Section Headers
-  Elf64_Shdr *shdrs = malloc(sizeof(Elf64_Shdr) * ehdr.e_shnum);//shdrs是一个数组
+  Elf_Shdr *shdrs = malloc(sizeof(Elf_Shdr) * ehdr.e_shnum);//shdrs是一个数组
   fseek(fp, ehdr.e_shoff, SEEK_SET);//fp指向shdrs入口
-  assert(fread(shdrs, sizeof(Elf64_Shdr), ehdr.e_shnum, fp) == ehdr.e_shnum);//e_shnum代表有几个section Header
+  assert(fread(shdrs, sizeof(Elf_Shdr), ehdr.e_shnum, fp) == ehdr.e_shnum);//e_shnum代表有几个section Header
 
   // Find .symtab and .strtab
   // We look for SHT_SYMTAB
   char *strtab = NULL;
-  Elf64_Sym *symtab = NULL;
+  Elf_Sym *symtab = NULL;
   int sym_count = 0;
 
   for (int i = 0; i < ehdr.e_shnum; i++) {
     if (shdrs[i].sh_type == SHT_SYMTAB) {
       // Found symtab
-      sym_count = shdrs[i].sh_size / sizeof(Elf64_Sym);
+      sym_count = shdrs[i].sh_size / sizeof(Elf_Sym);
       symtab = malloc(shdrs[i].sh_size);
       fseek(fp, shdrs[i].sh_offset, SEEK_SET);
       assert(fread(symtab, shdrs[i].sh_size, 1, fp) == 1);
@@ -86,55 +147,17 @@ void init_ftrace(const char *elf_file) {
     }
   }
 
-  if (symtab && strtab) {
-    for (int i = 0; i < sym_count; i++) {
-      if (ELF64_ST_TYPE(symtab[i].st_info) == STT_FUNC) {
-        add_symbol(strtab + symtab[i].st_name, symtab[i].st_value, symtab[i].st_size);
-      }
-    }
-  }
-
-  free(shdrs);
-  if (symtab) free(symtab);
-  if (strtab) free(strtab);
-
-#else // 32-bit
-  Elf32_Ehdr ehdr;
-  assert(fread(&ehdr, sizeof(ehdr), 1, fp) == 1);
-  if (memcmp(ehdr.e_ident, ELFMAG, SELFMAG) != 0) {
-    Log("Invalid ELF file '%s'", elf_file);
-    fclose(fp);
-    return;
-  }
-
-  Elf32_Shdr *shdrs = malloc(sizeof(Elf32_Shdr) * ehdr.e_shnum);
-  fseek(fp, ehdr.e_shoff, SEEK_SET);
-  assert(fread(shdrs, sizeof(Elf32_Shdr), ehdr.e_shnum, fp) == ehdr.e_shnum);
-
-  char *strtab = NULL;
-  Elf32_Sym *symtab = NULL;
-  int sym_count = 0;
-
-  for (int i = 0; i < ehdr.e_shnum; i++) {
-    if (shdrs[i].sh_type == SHT_SYMTAB) {
-      sym_count = shdrs[i].sh_size / sizeof(Elf32_Sym);
-      symtab = malloc(shdrs[i].sh_size);
-      fseek(fp, shdrs[i].sh_offset, SEEK_SET);
-      assert(fread(symtab, shdrs[i].sh_size, 1, fp) == 1);
-
-      int strtab_idx = shdrs[i].sh_link;
-      long strtab_offset = shdrs[strtab_idx].sh_offset;
-      long strtab_size = shdrs[strtab_idx].sh_size;
-      strtab = malloc(strtab_size);
-      fseek(fp, strtab_offset, SEEK_SET);
-      assert(fread(strtab, strtab_size, 1, fp) == 1);
-      break;
-    }
+  // drop the functions of the earlier files in the range
+  int n = 0;
+  for (int i = 0; i < nr_sym; i++) {
+    if (symbols[i].addr < lo || symbols[i].addr >= hi) symbols[n++] = symbols[i];
   }
+  nr_sym = n;
 
   if (symtab && strtab) {
     for (int i = 0; i < sym_count; i++) {
-      if (ELF32_ST_TYPE(symtab[i].st_info) == STT_FUNC) {
+      if (ELF_ST_TYPE(symtab[i].st_info) == STT_FUNC &&
+          symtab[i].st_value >= lo && symtab[i].st_value < hi) {
         add_symbol(strtab + symtab[i].st_name, symtab[i].st_value, symtab[i].st_size);
       }
     }
@@ -143,32 +166,35 @@ void init_ftrace(const char *elf_file) {
   free(shdrs);
   if (symtab) free(symtab);
   if (strtab) free(strtab);
-#endif
-
   fclose(fp);
-  Log("FTRACE: Loaded %d symbols from %s", nr_sym, elf_file);
+
+  qsort(symbols, nr_sym, sizeof(SymbolEntry), cmp_symbol);
+  last_hit = 0;
+  Log("FTRACE: Loaded %d symbols from %s", nr_sym - n, elf_file);
 }
 
 void ftrace_write(paddr_t pc, paddr_t target, bool is_call) {
-  static int depth = 0;
+  static HART_LOCAL int depth = 0;
+  IFDEF(CONFIG_PROFILE, profile_call(pc, target, is_call));
   
+  // the symbol is only looked up when the line is logged
   if (is_call) {
-    const char *func_name = find_symbol(target);
-    log_write(FMT_PADDR ": %*scall [%s@" FMT_PADDR "]\n", pc, depth * 2, "", func_name, target);
+    log_write(FMT_PADDR ": %*scall [%s@" FMT_PADDR "]\n", pc, depth * 2, "", find_symbol(target), target);
     depth++;
   } else {
     // For return, 'target' is actually the destination PC (where we return to),
     // but the doc says "record current PC" to identify which function we are returning FROM.
     // The visual output typically shows "ret [func_name]" where func_name is the current function.
     if (depth > 0) depth--;
-    const char *func_name = find_symbol(pc);
-    log_write(FMT_PADDR ": %*sret  [%s]\n", pc, depth * 2, "", func_name);
+    log_write(FMT_PADDR ": %*sret  [%s]\n", pc, depth * 2, "", find_symbol(pc));
   }
 }
 
 #else
 
-void init_ftrace(const char *elf_file) {}
+const char* ftrace_symbol(paddr_t addr) { return "???"; }
+bool ftrace_symbol_range(const char *name, paddr_t *start, paddr_t *end) { return false; }
+void init_ftrace(const char *spec) {}
 void ftrace_write(paddr_t pc, paddr_t target, bool is_call) {}
 
 #endif
@@ -1,39 +1,36 @@
-#include <common.h>
+#include <cpu/itrace.h>
 
 #ifdef CONFIG_IRINGBUF
 
 #define RINGBUF_SIZE 16
 
-typedef struct {
-  char log[128];
-} IRingBufItem;
-
-static IRingBufItem ringbuf[RINGBUF_SIZE];
+// records are only disassembled when displayed
+static ItraceRecord ringbuf[RINGBUF_SIZE];
 static int ringbuf_end = 0; // Points to the next write position
+static bool ringbuf_full = false;
 
-void iringbuf_write(const char *log) {
-  if (!log) return;
-  strncpy(ringbuf[ringbuf_end].log, log, 128);
-  ringbuf[ringbuf_end].log[127] = '\0'; // Ensure null-termination
+void iringbuf_write(const ItraceRecord *r) {
+  ringbuf[ringbuf_end] = *r;
   ringbuf_end = (ringbuf_end + 1) % RINGBUF_SIZE;
+  if (ringbuf_end == 0) ringbuf_full = true;
 }
 
 void iringbuf_display() {
-  if (!ringbuf[0].log[0]) return;
+  if (ringbuf_end == 0 && !ringbuf_full) return;
 
   printf("Most recent instructions:\n");
-  int i = ringbuf_end;
+  int i = (ringbuf_full ? ringbuf_end : 0);
   do {
-    if (ringbuf[i].log[0] != '\0') {
-      printf("  %s\n", ringbuf[i].log);
-    }
+    char line[128];
+    itrace_format(line, sizeof(line), &ringbuf[i]);
+    printf("  %s\n", line);
     i = (i + 1) % RINGBUF_SIZE;
   } while (i != ringbuf_end);
 }
 
 #else
 
-void iringbuf_write(const char *log) {}
+void iringbuf_write(const ItraceRecord *r) {}
 void iringbuf_display() {}
 
 #endif
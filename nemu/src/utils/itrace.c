@@ -0,0 +1,76 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <isa.h>
+#include <cpu/itrace.h>
+
+#ifdef CONFIG_ITRACE
+
+bool log_enable();
+
+#ifdef CONFIG_ITRACE_BIN
+#define NR_BUF (1024 * 1024 / sizeof(ItraceRecord))
+
+static FILE *trace_fp = NULL;
+static ItraceRecord buf[NR_BUF];
+static int nr_buf = 0;
+
+void init_itrace(const char *file) {
+  if (file == NULL) {
+    Log("No file is given by --itrace, the instruction trace is dropped");
+    return;
+  }
+  trace_fp = fopen(file, "wb");
+  Assert(trace_fp, "Can not open '%s'", file);
+
+  extern const char *MUXDEF(CONFIG_ISA_x86, regsl, regs)[];
+  ItraceHeader h = {};
+  memcpy(h.magic, ITRACE_MAGIC, sizeof(h.magic));
+  strncpy(h.isa, CONFIG_ISA, sizeof(h.isa) - 1);
+  h.record_size = sizeof(ItraceRecord);
+  h.nr_reg = ARRLEN(cpu.gpr);
+  for (int i = 0; i < h.nr_reg; i ++) {
+    strncpy(h.reg_name[i], MUXDEF(CONFIG_ISA_x86, regsl, regs)[i], sizeof(h.reg_name[i]) - 1);
+  }
+  Assert(fwrite(&h, sizeof(h), 1, trace_fp) == 1, "Can not write '%s'", file);
+  Log("Instruction trace is written to %s", file);
+}
+
+void itrace_write(const ItraceRecord *r) {
+  if (trace_fp == NULL || !log_enable()) return;
+  buf[nr_buf ++] = *r;
+  if (nr_buf == NR_BUF) itrace_flush();
+}
+
+void itrace_flush() {
+  if (trace_fp == NULL || nr_buf == 0) return;
+  Assert(fwrite(buf, sizeof(buf[0]), nr_buf, trace_fp) == nr_buf, "Can not write the instruction trace");
+  fflush(trace_fp);
+  nr_buf = 0;
+}
+#else
+void init_itrace(const char *file) { }
+
+void itrace_write(const ItraceRecord *r) {
+  if (!log_enable()) return;
+  char line[128];
+  itrace_format(line, sizeof(line), r);
+  log_write("%s\n", line);
+}
+
+void itrace_flush() { }
+#endif
+
+#endif
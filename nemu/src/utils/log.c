@@ -15,18 +15,164 @@
 
 #include <common.h>
 #include <isa.h>
+#include <stdarg.h>
 
-extern uint64_t g_nr_guest_inst;
+extern HART_LOCAL uint64_t g_nr_guest_inst;
 
 #ifndef CONFIG_TARGET_AM
 FILE *log_fp = NULL;
 
+#ifdef CONFIG_LOG_ASYNC
+#include <pthread.h>
+#ifdef CONFIG_LOG_COMPRESS
+#include <zlib.h>
+static gzFile log_gz = NULL;
+#endif
+
+/* The log lines are formatted into a large buffer, and a full buffer is
+ * handed to a writer thread, which writes it with a single call. The
+ * CPU thread only waits when all the buffers are waiting to be written.
+ * This is used only when the log goes to a file, since the lines to
+ * stdout are mixed with printf().
+ */
+#define LOG_BUF_SIZE (1024 * 1024)
+#define NR_LOG_BUF 8
+
+typedef struct {
+  size_t len;
+  char data[LOG_BUF_SIZE];
+} LogBuf;
+
+static LogBuf log_buf[NR_LOG_BUF];
+// free-running indices, buffers in [tail, head) are waiting to be written
+static uint64_t head = 0, tail = 0;
+static bool log_async = false;
+static pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t log_full = PTHREAD_COND_INITIALIZER, log_free = PTHREAD_COND_INITIALIZER;
+
+static void write_buf(LogBuf *b) {
+#ifdef CONFIG_LOG_COMPRESS
+  if (log_gz != NULL) { gzwrite(log_gz, b->data, b->len); return; }
+#endif
+  fwrite(b->data, 1, b->len, log_fp);
+}
+
+static void* log_writer(void *arg) {
+  pthread_mutex_lock(&log_lock);
+  while (true) {
+    while (tail == head) pthread_cond_wait(&log_full, &log_lock);
+    LogBuf *b = &log_buf[tail % NR_LOG_BUF];
+    pthread_mutex_unlock(&log_lock);
+    write_buf(b);
+    b->len = 0;
+    pthread_mutex_lock(&log_lock);
+    tail ++;
+    pthread_cond_broadcast(&log_free);
+  }
+  return NULL;
+}
+
+// hand the current buffer to the writer and wait for a free one
+static void hand_off() {
+  pthread_mutex_lock(&log_lock);
+  head ++;
+  pthread_cond_signal(&log_full);
+  while (head - tail >= NR_LOG_BUF) pthread_cond_wait(&log_free, &log_lock);
+  pthread_mutex_unlock(&log_lock);
+}
+
+static void log_close() {
+  log_flush();
+#ifdef CONFIG_LOG_COMPRESS
+  if (log_gz != NULL) gzclose(log_gz);
+#endif
+}
+
+static void init_log_async(const char *log_file) {
+#ifdef CONFIG_LOG_COMPRESS
+  size_t n = strlen(log_file);
+  if (n > 3 && strcmp(log_file + n - 3, ".gz") == 0) {
+    log_gz = gzdopen(fileno(log_fp), "wb1");
+    Assert(log_gz, "Can not compress '%s'", log_file);
+  }
+#endif
+  pthread_t thread;
+  Assert(pthread_create(&thread, NULL, log_writer, NULL) == 0, "fail to create the log writer");
+  pthread_detach(thread);
+  log_async = true;
+  atexit(log_close);
+}
+#endif
+
+#ifdef CONFIG_HAS_MPE
+#include <pthread.h>
+// the harts log on their own threads, one line at a time
+static pthread_mutex_t hart_log_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static void log_vprintf(const char *fmt, va_list ap) {
+#ifdef CONFIG_LOG_ASYNC
+  if (log_async) {
+    while (true) {
+      LogBuf *b = &log_buf[head % NR_LOG_BUF];
+      size_t left = LOG_BUF_SIZE - b->len;
+      va_list aq;
+      va_copy(aq, ap);
+      int n = vsnprintf(b->data + b->len, left, fmt, aq);
+      va_end(aq);
+      // a line longer than the buffer is cut
+      if (n < left || b->len == 0) { b->len += (n < left ? n : left - 1); return; }
+      hand_off();
+    }
+  }
+#endif
+  vfprintf(log_fp, fmt, ap);
+  fflush(log_fp);
+}
+
+void log_printf(const char *fmt, ...) {
+  if (log_fp == NULL) return;
+  va_list ap;
+  va_start(ap, fmt);
+  IFDEF(CONFIG_HAS_MPE, pthread_mutex_lock(&hart_log_lock));
+  log_vprintf(fmt, ap);
+  IFDEF(CONFIG_HAS_MPE, pthread_mutex_unlock(&hart_log_lock));
+  va_end(ap);
+}
+
+static void flush() {
+#ifdef CONFIG_LOG_ASYNC
+  if (log_async) {
+    pthread_mutex_lock(&log_lock);
+    if (log_buf[head % NR_LOG_BUF].len > 0) {
+      head ++;
+      pthread_cond_signal(&log_full);
+    }
+    while (tail != head) pthread_cond_wait(&log_free, &log_lock);
+    pthread_mutex_unlock(&log_lock);
+#ifdef CONFIG_LOG_COMPRESS
+    if (log_gz != NULL) { gzflush(log_gz, Z_SYNC_FLUSH); return; }
+#endif
+  }
+#endif
+  fflush(log_fp);
+}
+
+// write out everything logged, also called before NEMU aborts
+void log_flush() {
+  if (log_fp == NULL) return;
+  IFDEF(CONFIG_HAS_MPE, pthread_mutex_lock(&hart_log_lock));
+  flush();
+  IFDEF(CONFIG_HAS_MPE, pthread_mutex_unlock(&hart_log_lock));
+}
+
 void init_log(const char *log_file) {
   log_fp = stdout;
   if (log_file != NULL) {
     FILE *fp = fopen(log_file, "w");
     Assert(fp, "Can not open '%s'", log_file);
     log_fp = fp;
+    IFDEF(CONFIG_LOG_ASYNC, init_log_async(log_file));
   }
   Log("Log is written to %s", log_file ? log_file : "stdout");
 }
@@ -37,13 +183,10 @@ bool log_enable() {
 }
 
 void etrace_write(word_t NO, vaddr_t epc, vaddr_t target) {
-  if (log_fp != NULL) {
-    if (NO == INTR_EMPTY) {
-      fprintf(log_fp, "[etrace] iret at pc = " FMT_WORD "\n", epc);
-    } else {
-      fprintf(log_fp, "[etrace] raise intr #%d at pc = " FMT_WORD ", jump to " FMT_WORD "\n", (int)NO, epc, target);
-    }
-    fflush(log_fp);
+  if (NO == INTR_EMPTY) {
+    log_printf("[etrace] iret at pc = " FMT_WORD "\n", epc);
+  } else {
+    log_printf("[etrace] raise intr #%d at pc = " FMT_WORD ", jump to " FMT_WORD "\n", (int)NO, epc, target);
   }
 }
 #endif
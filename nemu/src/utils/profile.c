@@ -0,0 +1,188 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <common.h>
+
+#ifdef CONFIG_PROFILE
+
+/* Every instruction is counted twice: in a hash table by its pc, which
+ * gives the instructions of each function, and in the node of the call
+ * tree for the current call stack, which is moved by the calls and the
+ * returns detected by ftrace. At exit the functions are listed by their
+ * instructions, and the stacks are written in the collapsed format read
+ * by flamegraph.pl.
+ */
+#define MAX_NODE (1 << 20)
+
+typedef struct {
+  vaddr_t pc;
+  uint64_t count; // 0 for an empty slot
+} PcCount;
+
+typedef struct {
+  paddr_t func;
+  uint32_t parent, child, sibling; // 0 for none, node 0 is the root
+  uint64_t count;
+} Node;
+
+static PcCount *pc_tab = NULL;
+static uint32_t pc_cap = 0, nr_pc = 0;
+
+static Node *node = NULL;
+static uint32_t nr_node = 0, cur = 0;
+static uint64_t lost_depth = 0; // calls not in the tree since it is full
+
+static FILE *stack_fp = NULL;
+
+static inline uint32_t pc_hash(vaddr_t pc) {
+  return (uint32_t)(((uint64_t)pc * 0x9e3779b97f4a7c15ull) >> 32);
+}
+
+static void pc_grow() {
+  PcCount *old = pc_tab;
+  uint32_t old_cap = pc_cap;
+  pc_cap = (pc_cap == 0 ? 65536 : pc_cap * 2);
+  pc_tab = calloc(pc_cap, sizeof(PcCount));
+  assert(pc_tab);
+  for (uint32_t i = 0; i < old_cap; i ++) {
+    if (old[i].count == 0) continue;
+    uint32_t h = pc_hash(old[i].pc) & (pc_cap - 1);
+    while (pc_tab[h].count != 0) h = (h + 1) & (pc_cap - 1);
+    pc_tab[h] = old[i];
+  }
+  free(old);
+}
+
+void profile_inst(vaddr_t pc) {
+  uint32_t h = pc_hash(pc) & (pc_cap - 1);
+  while (pc_tab[h].count != 0 && pc_tab[h].pc != pc) h = (h + 1) & (pc_cap - 1);
+  if (pc_tab[h].count == 0) {
+    if ((nr_pc + 1) * 4 > pc_cap * 3) {
+      pc_grow();
+      profile_inst(pc);
+      return;
+    }
+    // the root is the function of the first instruction
+    if (nr_node == 0) { node[0].func = pc; nr_node = 1; }
+    pc_tab[h].pc = pc;
+    nr_pc ++;
+  }
+  pc_tab[h].count ++;
+  node[cur].count ++;
+}
+
+void profile_call(paddr_t pc, paddr_t target, bool is_call) {
+  if (!is_call) {
+    if (lost_depth > 0) lost_depth --;
+    else if (cur != 0) cur = node[cur].parent;
+    return;
+  }
+  // the children are kept with the last called one first
+  uint32_t prev = 0, c = node[cur].child;
+  while (c != 0 && node[c].func != target) { prev = c; c = node[c].sibling; }
+  if (c == 0) {
+    if (nr_node == MAX_NODE) { lost_depth ++; return; }
+    c = nr_node ++;
+    node[c] = (Node){ .func = target, .parent = cur, .sibling = node[cur].child };
+    node[cur].child = c;
+  } else if (prev != 0) {
+    node[prev].sibling = node[c].sibling;
+    node[c].sibling = node[cur].child;
+    node[cur].child = c;
+  }
+  cur = c;
+}
+
+static void write_stack(uint32_t n, uint32_t *path) {
+  int depth = 0;
+  for (; n != 0; n = node[n].parent) path[depth ++] = n;
+  fputs(ftrace_symbol(node[0].func), stack_fp);
+  while (depth > 0) {
+    fputc(';', stack_fp);
+    fputs(ftrace_symbol(node[path[-- depth]].func), stack_fp);
+  }
+}
+
+typedef struct {
+  const char *name;
+  uint64_t count;
+} FuncCount;
+
+static int cmp_name(const void *a, const void *b) {
+  const char *x = ((const FuncCount *)a)->name, *y = ((const FuncCount *)b)->name;
+  return (x > y) - (x < y);
+}
+
+static int cmp_count(const void *a, const void *b) {
+  uint64_t x = ((const FuncCount *)a)->count, y = ((const FuncCount *)b)->count;
+  return (x < y) - (x > y);
+}
+
+void profile_report() {
+  // it is called at the end of the program, at `q' and on a panic
+  static bool reported = false;
+  if (reported) return;
+  reported = true;
+
+  // ftrace_symbol() returns the same string for the pcs in a function
+  FuncCount *f = malloc(sizeof(FuncCount) * (nr_pc + 1));
+  assert(f);
+  uint32_t n = 0;
+  uint64_t total = 0;
+  for (uint32_t i = 0; i < pc_cap; i ++) {
+    if (pc_tab[i].count == 0) continue;
+    f[n ++] = (FuncCount){ ftrace_symbol(pc_tab[i].pc), pc_tab[i].count };
+    total += pc_tab[i].count;
+  }
+  qsort(f, n, sizeof(f[0]), cmp_name);
+  uint32_t nr_func = 0;
+  for (uint32_t i = 0; i < n; i ++) {
+    if (nr_func > 0 && f[nr_func - 1].name == f[i].name) f[nr_func - 1].count += f[i].count;
+    else f[nr_func ++] = f[i];
+  }
+  qsort(f, nr_func, sizeof(f[0]), cmp_count);
+
+  Log("profile: the top %d of %u functions by instructions executed", CONFIG_PROFILE_TOP, nr_func);
+  for (uint32_t i = 0; i < nr_func && i < CONFIG_PROFILE_TOP; i ++) {
+    Log("  %6.2f%%  %12" PRIu64 "  %s", total ? f[i].count * 100.0 / total : 0.0, f[i].count, f[i].name);
+  }
+  free(f);
+
+  if (stack_fp != NULL) {
+    uint32_t *path = malloc(sizeof(uint32_t) * nr_node);
+    assert(path);
+    for (uint32_t i = 0; i < nr_node; i ++) {
+      if (node[i].count == 0) continue;
+      write_stack(i, path);
+      fprintf(stack_fp, " %" PRIu64 "\n", node[i].count);
+    }
+    free(path);
+    fclose(stack_fp);
+    stack_fp = NULL;
+    Log("profile: %u call stacks are written", nr_node);
+  }
+}
+
+void init_profile(const char *file) {
+  pc_grow();
+  node = calloc(MAX_NODE, sizeof(Node));
+  assert(node);
+  if (file != NULL) {
+    stack_fp = fopen(file, "w");
+    Assert(stack_fp, "Can not open '%s'", file);
+  }
+}
+
+#endif
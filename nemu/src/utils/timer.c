@@ -44,6 +44,15 @@ uint64_t get_time() {
   return now - boot_time;
 }
 
+int icount_shift = -1;
+
+uint64_t get_guest_time() {
+  extern HART_LOCAL uint64_t g_nr_guest_inst;
+  if (icount_shift < 0) return get_time();
+  return (g_nr_guest_inst << icount_shift) / 1000;
+}
+
 void init_rand() {
-  srand(get_time_internal());
+  // two runs with --icount should see the same memory
+  srand(icount_shift < 0 ? get_time_internal() : 0);
 }
@@ -0,0 +1,157 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+/* A mix of integer, memory, string and control flow work with a few
+ * traps, printing a hash of the results. Every engine must print the
+ * same hash after the same number of instructions.
+ */
+
+#include <am.h>
+#include <klib.h>
+#include <klib-macros.h>
+
+static uint32_t hash = 2166136261u;
+static int nr_yield = 0;
+
+static void mix(uint32_t x) {
+  hash = (hash ^ x) * 16777619u;
+}
+
+static Context* on_event(Event ev, Context *c) {
+  if (ev.event == EVENT_YIELD) nr_yield ++;
+  return c;
+}
+
+static char buf[256], buf2[512];
+
+static uint32_t strings() {
+  uint32_t s = 0;
+  for (int i = 0; i < 200; i ++) {
+    sprintf(buf, "%d:%x:%s:%c:%d", i * 7919, i * 31337, "nemu", 'a' + i % 26, -i);
+    s = s * 131 + strlen(buf);
+    strcpy(buf2, buf);
+    strcat(buf2, buf);
+    s += strcmp(buf, buf2) < 0;
+    memcpy(buf2 + 100, buf, 50);
+    memset(buf2 + 3, i, 77);
+    for (int k = 0; k < 200; k ++) s += (uint8_t)buf2[k] * k;
+    if (i % 50 == 0) yield();
+  }
+  return s;
+}
+
+static int64_t ll[256];
+
+static uint32_t int64s() {
+  uint32_t s = 0;
+  for (int i = 0; i < 256; i ++) ll[i] = (int64_t)i * 0x123456789ll - 77777;
+  for (int i = 0; i < 256; i ++) {
+    int64_t x = ll[i] * 3 + (ll[i] >> 5);
+    s += (uint32_t)(x ^ (x >> 32)) + (uint32_t)(ll[i] / 1000) + (uint32_t)(ll[i] % 997);
+  }
+  return s;
+}
+
+// compiled to a jump table
+static int jump_table(int n) {
+  int s = 0;
+  for (int i = 0; i < n; i ++) {
+    switch ((i * 13) & 15) {
+      case 0: s += 3; break;         case 1: s -= 7; break;
+      case 2: s ^= 0x55; break;      case 3: s *= 3; break;
+      case 4: s += i; break;         case 5: s -= i; break;
+      case 6: s |= 1; break;         case 7: s &= ~2; break;
+      case 8: s += 100; break;       case 9: s /= 3; break;
+      case 10: s = -s; break;        case 11: s += s >> 2; break;
+      case 12: s ^= i << 3; break;   case 13: s %= 1000003; break;
+      case 14: s += 9; break;        default: s -= 1; break;
+    }
+  }
+  return s;
+}
+
+static int data[2000];
+
+static uint32_t sorting() {
+  uint32_t x = 12345;
+  for (int i = 0; i < 2000; i ++) {
+    x = x * 1103515245 + 12345;
+    data[i] = (x >> 8) % 100000;
+  }
+  for (int i = 1; i < 1000; i ++) {
+    int v = data[i], j = i - 1;
+    for (; j >= 0 && data[j] > v; j --) data[j + 1] = data[j];
+    data[j + 1] = v;
+  }
+  uint32_t s = 0;
+  for (int i = 0; i < 2000; i ++) s = s * 7 + data[i];
+  return s;
+}
+
+static int ackermann(int m, int n) {
+  if (m == 0) return n + 1;
+  if (n == 0) return ackermann(m - 1, 1);
+  return ackermann(m - 1, ackermann(m, n - 1));
+}
+
+// byte and halfword stores and sign extension
+static struct { int8_t c; int16_t sh; int32_t i; uint8_t uc; } st[300];
+
+static uint32_t structs() {
+  uint32_t s = 0;
+  for (int i = 0; i < 300; i ++) {
+    st[i].c = i - 150;
+    st[i].sh = i * 300 - 40000;
+    st[i].i = i * i;
+    st[i].uc = i;
+  }
+  for (int r = 0; r < 20; r ++) {
+    for (int i = 0; i < 300; i ++) {
+      s += st[i].c + st[i].sh + st[i].i + st[i].uc;
+      st[i].c += r;
+      st[i].sh ^= r << 4;
+    }
+  }
+  return s;
+}
+
+static uint32_t bits() {
+  uint32_t s = 0, x = 0xdeadbeef;
+  for (int i = 0; i < 3000; i ++) {
+    x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+    s += (x & 0x0f0f) + (x >> (i & 31)) + (uint32_t)((int32_t)x >> (i & 15));
+    s += (x & 0x80) ? 1 : 2;
+    s -= (int32_t)x < 0 ? 5 : -3;
+    s += (uint8_t)x > 100;
+  }
+  return s;
+}
+
+int main(const char *args) {
+  cte_init(on_event);
+  for (int r = 0; r < 4; r ++) {
+    mix(strings());
+    mix(int64s());
+    mix(jump_table(20000));
+    mix(sorting());
+    mix(ackermann(2, 300));
+    mix(structs());
+    mix(bits());
+    for (int i = 0; i < 25; i ++) yield();
+  }
+  mix(nr_yield);
+  printf("hash %x\n", hash);
+  return 0;
+}
@@ -0,0 +1,45 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+/* Draw frames paced by the timer and poll the keyboard, so that the
+ * path of the guest depends on the device input. A replay of a recorded
+ * run must take exactly the same number of instructions.
+ */
+
+#include <am.h>
+#include <klib.h>
+#include <klib-macros.h>
+
+#define NR_FRAME 20
+#define FRAME_US 10000
+
+static uint32_t pixel[16 * 16];
+
+int main() {
+  ioe_init();
+  int w = io_read(AM_GPU_CONFIG).width;
+  uint64_t start = io_read(AM_TIMER_UPTIME).us;
+  int nr_poll = 0, nr_key = 0;
+  for (int f = 0; f < NR_FRAME; f ++) {
+    while (io_read(AM_TIMER_UPTIME).us - start < (uint64_t)(f + 1) * FRAME_US) {
+      if (io_read(AM_INPUT_KEYBRD).keycode != AM_KEY_NONE) nr_key ++;
+      nr_poll ++;
+    }
+    for (int i = 0; i < LENGTH(pixel); i ++) pixel[i] = f * 0x010101;
+    io_write(AM_GPU_FBDRAW, (f * 16) % w, 0, pixel, 16, 16, true);
+  }
+  printf("%d frames, %d keys\n", NR_FRAME, nr_key);
+  return 0;
+}
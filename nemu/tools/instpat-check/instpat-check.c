@@ -0,0 +1,211 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+/* Check the INSTPAT lists in a decoder source for overlapping patterns.
+ * Every list between INSTPAT_START/INSTPAT_TABLE_START and INSTPAT_END
+ * is checked with the rule of the decode table: two patterns may only
+ * overlap if the earlier one is strictly more specific than the later
+ * one. Every violation is reported and the exit status is 1, so that
+ * make stops before compiling the decoder.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
+
+#define MAX_PAT 1024
+
+typedef struct {
+  uint64_t key, mask;
+  char pattern[80], name[32];
+  int line;
+} Pat;
+
+static Pat pat[MAX_PAT];
+static int nr_pat = 0;
+static const char *file = NULL;
+static char *src = NULL;
+static int nr_error = 0;
+
+static char* read_file(const char *path) {
+  FILE *fp = fopen(path, "r");
+  if (fp == NULL) { perror(path); exit(1); }
+  fseek(fp, 0, SEEK_END);
+  long size = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+  char *buf = malloc(size + 1);
+  if (fread(buf, 1, size, fp) != size) { perror(path); exit(1); }
+  buf[size] = '\0';
+  fclose(fp);
+  return buf;
+}
+
+// replace comments with spaces, keep the newlines for line numbers
+static void strip_comments(char *p) {
+  while (*p) {
+    if (*p == '"' || *p == '\'') {
+      char q = *p ++;
+      while (*p && *p != q) { if (*p == '\\' && p[1]) p ++; p ++; }
+      if (*p) p ++;
+    } else if (p[0] == '/' && p[1] == '/') {
+      while (*p && *p != '\n') *p ++ = ' ';
+    } else if (p[0] == '/' && p[1] == '*') {
+      *p ++ = ' '; *p ++ = ' ';
+      while (*p && !(p[0] == '*' && p[1] == '/')) { if (*p != '\n') *p = ' '; p ++; }
+      if (*p) { *p ++ = ' '; *p ++ = ' '; }
+    } else {
+      p ++;
+    }
+  }
+}
+
+static int line_of(const char *p) {
+  int line = 1;
+  for (const char *q = src; q < p; q ++) line += (*q == '\n');
+  return line;
+}
+
+static bool is_ident(char c) { return isalnum((unsigned char)c) || c == '_'; }
+
+// match the identifier `id' at `p', return the position after it
+static const char* match_ident(const char *p, const char *id) {
+  if (p > src && is_ident(p[-1])) return NULL;
+  int len = strlen(id);
+  if (strncmp(p, id, len) != 0 || is_ident(p[len])) return NULL;
+  return p + len;
+}
+
+static const char* skip_space(const char *p) {
+  while (isspace((unsigned char)*p)) p ++;
+  return p;
+}
+
+static void error(int line, const char *fmt, const char *arg) {
+  fprintf(stderr, "%s:%d: error: ", file, line);
+  fprintf(stderr, fmt, arg);
+  fprintf(stderr, "\n");
+  nr_error ++;
+}
+
+// parse `INSTPAT("pattern", name, ...' after the identifier
+static void add_pat(const char *p, int line) {
+  p = skip_space(p);
+  if (*p != '(') return;
+  p = skip_space(p + 1);
+  if (*p != '"') { error(line, "the pattern of INSTPAT is not a string literal", NULL); return; }
+  if (nr_pat == MAX_PAT) { error(line, "too many patterns", NULL); return; }
+
+  Pat *t = &pat[nr_pat];
+  *t = (Pat) { .line = line };
+  int len = 0;
+  for (p ++; *p && *p != '"'; p ++) {
+    if (len < sizeof(t->pattern) - 1) t->pattern[len ++] = *p;
+    if (*p == ' ') continue;
+    if (*p != '0' && *p != '1' && *p != '?') {
+      char c[2] = { *p, '\0' };
+      error(line, "invalid character '%s' in pattern string", c);
+      return;
+    }
+    if (t->key >> 63 || t->mask >> 63) { error(line, "pattern too long", NULL); return; }
+    t->key  = (t->key  << 1) | (*p == '1');
+    t->mask = (t->mask << 1) | (*p != '?');
+  }
+
+  p = skip_space(*p ? p + 1 : p);
+  if (*p == ',') {
+    p = skip_space(p + 1);
+    for (len = 0; is_ident(*p) && len < sizeof(t->name) - 1; p ++) t->name[len ++] = *p;
+  }
+  nr_pat ++;
+}
+
+static inline bool pat_overlap(Pat *a, Pat *b) {
+  return ((a->key ^ b->key) & a->mask & b->mask) == 0;
+}
+
+// every instruction matching `b' also matches `a'
+static inline bool pat_cover(Pat *a, Pat *b) {
+  return pat_overlap(a, b) && (a->mask & ~b->mask) == 0;
+}
+
+static void check_overlap() {
+  for (int j = 0; j < nr_pat; j ++) {
+    Pat *b = &pat[j];
+    for (int i = 0; i < j; i ++) {
+      Pat *a = &pat[i];
+      if (!pat_overlap(a, b)) continue;
+      // an earlier pattern may only pick a special case of a later one
+      if (pat_cover(b, a) && !pat_cover(a, b)) continue;
+      fprintf(stderr, "%s:%d: error: pattern \"%s\" (%s) %s \"%s\" (%s) at line %d\n",
+          file, b->line, b->pattern, b->name,
+          pat_cover(a, b) ? "is shadowed by" : "overlaps with",
+          a->pattern, a->name, a->line);
+      nr_error ++;
+    }
+  }
+}
+
+static void check_file(const char *path) {
+  file = path;
+  src = read_file(path);
+  strip_comments(src);
+
+  bool in_list = false;
+  int start_line = 0;
+  for (const char *p = src; *p; p ++) {
+    if (*p == '"' || *p == '\'') {
+      char q = *p ++;
+      while (*p && *p != q) { if (*p == '\\' && p[1]) p ++; p ++; }
+      if (*p == '\0') break;
+      continue;
+    }
+    const char *q;
+    if ((q = match_ident(p, "INSTPAT_START")) || (q = match_ident(p, "INSTPAT_TABLE_START"))) {
+      if (in_list) error(line_of(p), "the previous INSTPAT list is not ended", NULL);
+      in_list = true;
+      start_line = line_of(p);
+      nr_pat = 0;
+      p = q - 1;
+    } else if ((q = match_ident(p, "INSTPAT"))) {
+      if (!in_list) error(line_of(p), "INSTPAT outside an INSTPAT list", NULL);
+      else add_pat(q, line_of(p));
+      p = q - 1;
+    } else if ((q = match_ident(p, "INSTPAT_END"))) {
+      if (!in_list) error(line_of(p), "INSTPAT_END without a start", NULL);
+      else check_overlap();
+      in_list = false;
+      p = q - 1;
+    }
+  }
+  if (in_list) {
+    fprintf(stderr, "%s:%d: error: INSTPAT list is not ended\n", file, start_line);
+    nr_error ++;
+  }
+  free(src);
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    printf("Usage: %s FILE...\n", argv[0]);
+    return 1;
+  }
+  for (int i = 1; i < argc; i ++) {
+    check_file(argv[i]);
+  }
+  return nr_error == 0 ? 0 : 1;
+}
@@ -0,0 +1,127 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <common.h>
+#include <cpu/itrace.h>
+#include <getopt.h>
+
+// ftrace.c is built for NEMU and expects these
+bool log_enable() { return false; }
+void log_printf(const char *fmt, ...) { }
+void log_flush() { }
+void assert_fail_msg() { }
+void profile_call(paddr_t pc, paddr_t target, bool is_call) { }
+
+void init_disasm();
+
+#define NR_BUF 4096
+
+static uint64_t pc_lo = 0, pc_hi = UINT64_MAX;   // [pc_lo, pc_hi)
+static uint64_t win_lo = 0, win_hi = UINT64_MAX; // [win_lo, win_hi)
+static char *elf_file = NULL, *symbol = NULL;
+
+static void usage(const char *name) {
+  printf("Usage: %s [OPTION...] TRACE\n\n", name);
+  printf("\t-e,--elf=FILE          read symbol table from ELF FILE\n");
+  printf("\t-s,--symbol=NAME       only show the instructions in function NAME, needs -e\n");
+  printf("\t-p,--pc=LO:HI          only show the instructions with LO <= pc < HI\n");
+  printf("\t-w,--window=FIRST:LAST only show the FIRST-th to the (LAST-1)-th records\n");
+  printf("\n");
+  exit(0);
+}
+
+static void parse_range(const char *s, uint64_t *lo, uint64_t *hi) {
+  char *end;
+  *lo = strtoull(s, &end, 0);
+  if (*end != ':') { printf("Invalid range '%s', it should be LO:HI\n", s); exit(1); }
+  if (end[1] != '\0') *hi = strtoull(end + 1, NULL, 0);
+}
+
+static void parse_args(int argc, char *argv[]) {
+  const struct option table[] = {
+    {"elf"   , required_argument, NULL, 'e'},
+    {"symbol", required_argument, NULL, 's'},
+    {"pc"    , required_argument, NULL, 'p'},
+    {"window", required_argument, NULL, 'w'},
+    {"help"  , no_argument      , NULL, 'h'},
+    {0       , 0                , NULL,  0 },
+  };
+  int o;
+  while ( (o = getopt_long(argc, argv, "he:s:p:w:", table, NULL)) != -1) {
+    switch (o) {
+      case 'e': elf_file = optarg; break;
+      case 's': symbol = optarg; break;
+      case 'p': parse_range(optarg, &pc_lo, &pc_hi); break;
+      case 'w': parse_range(optarg, &win_lo, &win_hi); break;
+      default: usage(argv[0]);
+    }
+  }
+  if (optind != argc - 1) usage(argv[0]);
+}
+
+int main(int argc, char *argv[]) {
+  parse_args(argc, argv);
+  const char *trace_file = argv[optind];
+
+  if (elf_file != NULL) init_ftrace(elf_file);
+  if (symbol != NULL) {
+    paddr_t start, end;
+    if (elf_file == NULL || !ftrace_symbol_range(symbol, &start, &end)) {
+      printf("Can not find function '%s'\n", symbol);
+      return 1;
+    }
+    if (start > pc_lo) pc_lo = start;
+    if (end < pc_hi) pc_hi = end;
+  }
+
+  FILE *fp = fopen(trace_file, "rb");
+  if (fp == NULL) { printf("Can not open '%s'\n", trace_file); return 1; }
+  ItraceHeader h;
+  if (fread(&h, sizeof(h), 1, fp) != 1 || memcmp(h.magic, ITRACE_MAGIC, sizeof(h.magic) - 1) != 0) {
+    printf("'%s' is not an instruction trace of NEMU\n", trace_file);
+    return 1;
+  }
+  if (h.magic[sizeof(h.magic) - 1] != ITRACE_MAGIC[sizeof(h.magic) - 1] ||
+      h.record_size != sizeof(ItraceRecord)) {
+    printf("'%s' is written in an older trace format (%.8s), "
+        "dump it with the tool of that version\n", trace_file, h.magic);
+    return 1;
+  }
+  if (strcmp(h.isa, CONFIG_ISA) != 0) {
+    printf("'%s' is written by %s NEMU, but this tool is built for %s\n", trace_file, h.isa, CONFIG_ISA);
+    return 1;
+  }
+
+  init_disasm();
+  static ItraceRecord buf[NR_BUF];
+  uint64_t idx = 0;
+  size_t n;
+  while (idx < win_hi && (n = fread(buf, sizeof(buf[0]), NR_BUF, fp)) > 0) {
+    for (size_t i = 0; i < n; i ++, idx ++) {
+      ItraceRecord *r = &buf[i];
+      if (idx < win_lo || idx >= win_hi || r->pc < pc_lo || r->pc >= pc_hi) continue;
+      char line[128];
+      itrace_format(line, sizeof(line), r);
+      printf("%-10" PRIu64 " %s", idx, line);
+      if (elf_file != NULL) printf("\t<%s>", ftrace_symbol(r->pc));
+      if (r->reg != ITRACE_NO_REG && r->reg < h.nr_reg) {
+        printf("\t%s = " FMT_WORD, h.reg_name[r->reg], (word_t)r->val);
+      }
+      putchar('\n');
+    }
+  }
+  fclose(fp);
+  return 0;
+}